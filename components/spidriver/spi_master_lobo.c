@@ -82,6 +82,7 @@ Main driver's function is 'spi_lobo_transfer_data()'
 #include "driver/periph_ctrl.h"
 #include "esp_heap_caps.h"
 #include "driver/periph_ctrl.h"
+#include "soc/soc_memory_layout.h"
 #include "spi_master_lobo.h"
 
 
@@ -828,6 +829,9 @@ esp_err_t IRAM_ATTR spi_lobo_device_deselect(spi_lobo_device_handle_t handle)
 {
 	if (handle == NULL) return ESP_ERR_INVALID_ARG;
 
+	// Pending DMA transfer must finish before CS is released
+	if (handle->host->cur_trans) spi_lobo_transfer_wait(handle);
+
 	if (handle->cfg.selected == 0) return ESP_OK;  // already deselected
 
 	int i;
@@ -916,9 +920,135 @@ B: Receive only   (trans->txlength = 0)
 C: Send & receive (trans->txlength > 0 & trans->rxlength > 0)
 D: No operation   (trans->txlength = 0 & trans->rxlength = 0)
 
+
+Transfers longer than SPI_LOBO_DMA_THRESHOLD bytes are done by DMA if the host has a DMA channel
+and the transfer fits into host's DMA descriptors. Send & receive is done by DMA only in full duplex
+mode with equal number of bytes transmitted and received; in half duplex mode the received data
+follows the transmitted data and the FIFO is used.
 */
-//----------------------------------------------------------------------------------------------------------
-esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans) {
+
+//-----------------------------------------------------------------------------------------------------
+static int IRAM_ATTR _dma_usable(spi_lobo_host_t *host, uint8_t duplex, uint32_t txlen, uint32_t rxlen)
+{
+	if (host->dma_chan == 0) return 0;
+	if ((txlen <= SPI_LOBO_DMA_THRESHOLD) && (rxlen <= SPI_LOBO_DMA_THRESHOLD)) return 0;
+	if ((txlen > host->max_transfer_sz) || (rxlen > host->max_transfer_sz)) return 0;
+	if ((txlen) && (rxlen)) {
+		// In full duplex mode data is received while transmitting
+		if (!duplex) return 0;
+		if (txlen != rxlen) return 0;
+	}
+	return 1;
+}
+
+//--------------------------------------
+static void IRAM_ATTR _dma_reset(spi_lobo_host_t *host)
+{
+	host->hw->dma_conf.val |= SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST;
+	host->hw->dma_out_link.start=0;
+	host->hw->dma_in_link.start=0;
+	host->hw->dma_conf.val &= ~(SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST);
+	host->hw->dma_conf.out_data_burst_en=1;
+}
+
+// Start DMA transfer, does not wait for it to finish
+// Buffers which DMA cannot use directly are replaced by bounce buffers allocated from the heap,
+// so this must not be used from an ISR or while the flash cache is disabled;
+// word aligned buffers in DMA capable memory need no allocation
+//-----------------------------------------------------------------------------------------------------------------------------------
+static esp_err_t IRAM_ATTR _dma_transfer_start(spi_lobo_host_t *host, const uint8_t *txbuffer, uint32_t txlen, uint8_t *rxbuffer, uint32_t rxlen)
+{
+	host->dma_txbuf = NULL;
+	host->dma_rxbuf = NULL;
+	host->dma_rxlen = 0;
+
+	if ((txlen) && ((!esp_ptr_dma_capable(txbuffer)) || ((uint32_t)txbuffer & 3))) {
+		host->dma_txbuf = heap_caps_malloc(txlen, MALLOC_CAP_DMA);
+		if (host->dma_txbuf == NULL) return ESP_ERR_NO_MEM;
+		memcpy(host->dma_txbuf, txbuffer, txlen);
+		txbuffer = host->dma_txbuf;
+	}
+	if (rxlen) {
+		// Receive DMA writes whole 32-bit words to word aligned address
+		if ((!esp_ptr_dma_capable(rxbuffer)) || ((uint32_t)rxbuffer & 3) || (rxlen & 3)) {
+			host->dma_rxbuf = heap_caps_malloc((rxlen + 3) & (~3), MALLOC_CAP_DMA);
+			if (host->dma_rxbuf == NULL) {
+				free(host->dma_txbuf);
+				host->dma_txbuf = NULL;
+				return ESP_ERR_NO_MEM;
+			}
+			host->dma_rxdest = rxbuffer;
+			host->dma_rxlen = rxlen;
+			rxbuffer = host->dma_rxbuf;
+		}
+	}
+
+	spi_lobo_dmaworkaround_transfer_active(host->dma_chan); //mark channel as active
+	_dma_reset(host);
+
+	if (rxlen) {
+		spi_lobo_setup_dma_desc_links(host->dmadesc_rx, rxlen, rxbuffer, true);
+		host->hw->dma_in_link.addr=(int)(&host->dmadesc_rx[0]) & 0xFFFFF;
+		host->hw->dma_in_link.start=1;
+		host->hw->miso_dlen.usr_miso_dbitlen = (rxlen * 8) - 1;
+		host->hw->user.usr_miso = 1;
+	}
+	else {
+		host->hw->miso_dlen.usr_miso_dbitlen = 0;
+		host->hw->user.usr_miso = 0;
+	}
+	if (txlen) {
+		spi_lobo_setup_dma_desc_links(host->dmadesc_tx, txlen, txbuffer, false);
+		host->hw->dma_out_link.addr=(int)(&host->dmadesc_tx[0]) & 0xFFFFF;
+		host->hw->dma_out_link.start=1;
+		host->hw->mosi_dlen.usr_mosi_dbitlen = (txlen * 8) - 1;
+		host->hw->user.usr_mosi = 1;
+	}
+	else {
+		host->hw->mosi_dlen.usr_mosi_dbitlen = 0;
+		host->hw->user.usr_mosi = 0;
+	}
+
+	// ** Start the transaction ***
+	host->hw->cmd.usr=1;
+	return ESP_OK;
+}
+
+//=============================================================================
+esp_err_t IRAM_ATTR spi_lobo_transfer_wait(spi_lobo_device_handle_t handle)
+{
+	if (!handle) return ESP_ERR_INVALID_ARG;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	spi_lobo_transaction_t *trans = host->cur_trans;
+	if (trans == NULL) return ESP_OK;
+
+	// Wait the transaction to finish
+	while (host->hw->cmd.usr);
+	spi_lobo_dmaworkaround_idle(host->dma_chan);
+	host->cur_trans = NULL;
+
+	if (host->dma_rxbuf) {
+		memcpy(host->dma_rxdest, host->dma_rxbuf, host->dma_rxlen);
+		free(host->dma_rxbuf);
+		host->dma_rxbuf = NULL;
+	}
+	if (host->dma_txbuf) {
+		free(host->dma_txbuf);
+		host->dma_txbuf = NULL;
+	}
+
+	spi_lobo_device_handle_t dev = host->cur_trans_dev;
+	// ** Call post-transmission callback, if any
+	if (dev->cfg.post_cb) dev->cfg.post_cb(trans);
+
+	// Spi device was selected by the transfer function, we have to deselect it now
+	if (host->cur_trans_deselect) return spi_lobo_device_deselect(dev);
+	return ESP_OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+static esp_err_t IRAM_ATTR _transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans, uint8_t wait) {
 	if (!handle) return ESP_ERR_INVALID_ARG;
 
 	// *** For now we can only handle 8-bit bytes transmission
@@ -960,7 +1090,8 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 	if ((txbuffer == &trans->tx_data[0]) && (txlen > 4)) return ESP_ERR_INVALID_ARG;
 	if ((rxbuffer == &trans->rx_data[0]) && (rxlen > 4)) return ESP_ERR_INVALID_ARG;
 
-	// --- Wait for SPI bus ready ---
+	// --- Finish pending DMA transfer, wait for SPI bus ready ---
+	if (host->cur_trans) spi_lobo_transfer_wait(host->cur_trans_dev);
 	while (host->hw->cmd.usr);
 
     // ** If the device was not selected, select it
@@ -995,6 +1126,17 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 		host->hw->addr=trans->address & 0xffffffff;
 	}
 
+	// ** Use DMA if possible; if bounce buffers cannot be allocated transfer through hw spi buffer
+	if (_dma_usable(host, duplex, txlen, rxlen)) {
+		if (_dma_transfer_start(host, txbuffer, txlen, rxbuffer, rxlen) == ESP_OK) {
+			host->cur_trans = trans;
+			host->cur_trans_dev = handle;
+			host->cur_trans_deselect = do_deselect;
+			if (wait) return spi_lobo_transfer_wait(handle);
+			return ESP_OK;
+		}
+	}
+
 	// Check if we have to transmit some data
 	if (txlen > 0) {
 		host->hw->user.usr_mosi = 1;
@@ -1151,3 +1293,122 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 
 	return ESP_OK;
 }
+
+//===================================================================================================
+esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans)
+{
+	return _transfer_data(handle, trans, 1);
+}
+
+//=========================================================================================================
+esp_err_t IRAM_ATTR spi_lobo_transfer_data_async(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans)
+{
+	return _transfer_data(handle, trans, 0);
+}
+
+//==============================================================================================================================
+esp_err_t IRAM_ATTR spi_lobo_transfer_segments(spi_lobo_device_handle_t handle, const spi_lobo_segment_t *seg, int count)
+{
+	if ((!handle) || (seg == NULL) || (count <= 0)) return ESP_ERR_INVALID_ARG;
+	if ((handle->cfg.command_bits) || (handle->cfg.address_bits) || (handle->cfg.dummy_bits)) return ESP_ERR_INVALID_ARG;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	spi_lobo_transaction_t t;
+	esp_err_t ret = ESP_OK;
+	uint8_t do_deselect = 0;
+	uint8_t linked = (host->dma_chan > 0);
+	uint32_t total = 0;
+	int first = -1;
+	int i, n, ndesc = 0;
+
+	for (i=0; i<count; i++) {
+		if (seg[i].length == 0) continue;
+		if (seg[i].tx_buffer == NULL) return ESP_ERR_INVALID_ARG;
+		if (first < 0) first = i;
+		if ((!esp_ptr_dma_capable(seg[i].tx_buffer)) || ((uint32_t)seg[i].tx_buffer & 3)) linked = 0;
+		if ((i < (count-1)) && (seg[i].length & 3)) linked = 0;
+		total += seg[i].length;
+		ndesc += (seg[i].length + SPI_MAX_DMA_LEN - 1) / SPI_MAX_DMA_LEN;
+	}
+	if (total == 0) return ESP_ERR_INVALID_ARG;
+	if (total > ((1 << 24) / 8)) linked = 0;	// 24-bit mosi_dlen register
+
+	// --- Finish pending DMA transfer, wait for SPI bus ready ---
+	if (host->cur_trans) spi_lobo_transfer_wait(host->cur_trans_dev);
+	while (host->hw->cmd.usr);
+
+    // ** If the device was not selected, select it
+	if (handle->cfg.selected == 0) {
+		ret = spi_lobo_device_select(handle, 0);
+		if (ret) return ret;
+		do_deselect = 1;
+	}
+
+	memset(&t, 0, sizeof(spi_lobo_transaction_t));
+	t.length = total * 8;
+	t.tx_buffer = seg[first].tx_buffer;
+
+	// The bus is idle, so the host's own tx descriptors are free for the chain
+	lldesc_t *desc = NULL;
+	if ((linked) && (ndesc <= (host->max_transfer_sz / SPI_MAX_DMA_LEN))) desc = host->dmadesc_tx;
+
+	if (desc) {
+		if (handle->cfg.pre_cb) handle->cfg.pre_cb(&t);
+
+		// ** Link all segments into one descriptor chain
+		n = 0;
+		for (i=0; i<count; i++) {
+			if (seg[i].length == 0) continue;
+			spi_lobo_setup_dma_desc_links(&desc[n], seg[i].length, seg[i].tx_buffer, false);
+			n += (seg[i].length + SPI_MAX_DMA_LEN - 1) / SPI_MAX_DMA_LEN;
+			desc[n-1].eof = 0;
+			desc[n-1].qe.stqe_next = &desc[n];
+		}
+		desc[n-1].eof = 1;
+		desc[n-1].qe.stqe_next = NULL;
+
+		spi_lobo_dmaworkaround_transfer_active(host->dma_chan); //mark channel as active
+		_dma_reset(host);
+		host->hw->user.usr_mosi_highpart = 0;
+		host->hw->dma_out_link.addr=(int)(&desc[0]) & 0xFFFFF;
+		host->hw->dma_out_link.start=1;
+		host->hw->mosi_dlen.usr_mosi_dbitlen = (total * 8) - 1;
+		host->hw->user.usr_mosi = 1;
+		host->hw->miso_dlen.usr_miso_dbitlen = 0;
+		host->hw->user.usr_miso = 0;
+
+		// ** Start the transaction and wait for it to finish ***
+		host->hw->cmd.usr=1;
+		while (host->hw->cmd.usr);
+		spi_lobo_dmaworkaround_idle(host->dma_chan);
+
+		if (handle->cfg.post_cb) handle->cfg.post_cb(&t);
+	}
+	else {
+		// ** Send segments one by one, the device stays selected
+		spi_lobo_transaction_cb_t pre_cb = handle->cfg.pre_cb;
+		spi_lobo_transaction_cb_t post_cb = handle->cfg.post_cb;
+
+		if (pre_cb) pre_cb(&t);
+		handle->cfg.pre_cb = NULL;
+		handle->cfg.post_cb = NULL;
+		for (i=0; i<count; i++) {
+			if (seg[i].length == 0) continue;
+			spi_lobo_transaction_t st;
+			memset(&st, 0, sizeof(spi_lobo_transaction_t));
+			st.length = seg[i].length * 8;
+			st.tx_buffer = seg[i].tx_buffer;
+			ret = _transfer_data(handle, &st, 1);
+			if (ret != ESP_OK) break;
+		}
+		handle->cfg.pre_cb = pre_cb;
+		handle->cfg.post_cb = post_cb;
+		if (post_cb) post_cb(&t);
+	}
+
+	if (do_deselect) {
+		esp_err_t dret = spi_lobo_device_deselect(handle);
+		if (ret == ESP_OK) ret = dret;
+	}
+	return ret;
+}
@@ -35,6 +35,9 @@ extern "C"
 //Maximum amount of bytes that can be put in one DMA descriptor
 #define SPI_MAX_DMA_LEN (4096-4)
 
+//Transfers longer than this number of bytes use DMA if the host has a DMA channel
+#define SPI_LOBO_DMA_THRESHOLD 64
+
 /**
  * @brief Enum with the three SPI peripherals that are software-accessible in it
  */
@@ -122,6 +125,14 @@ struct spi_lobo_transaction_t {
     };
 };
 
+/**
+ * This structure describes one transmit segment of a scatter-gather transmission
+ */
+typedef struct {
+    const void *tx_buffer;          ///< Pointer to transmit buffer
+    size_t length;                  ///< Segment length, in bytes
+} spi_lobo_segment_t;
+
 #define NO_CS 3					    // Number of CS pins per SPI host
 #define NO_DEV 6				    // Number of spi devices per SPI host; more than 3 devices can be attached to the same bus if using software CS's
 #define SPI_SEMAPHORE_WAIT 2000     // Time in ms to wait for SPI mutex
@@ -132,7 +143,13 @@ typedef struct {
     spi_lobo_device_t *device[NO_DEV];
     intr_handle_t intr;
     spi_dev_t *hw;
-    //spi_lobo_transaction_t *cur_trans;
+    spi_lobo_transaction_t *cur_trans;     ///< DMA transaction started and not yet finished, NULL if none
+    spi_lobo_device_t *cur_trans_dev;      ///< device of 'cur_trans'
+    uint8_t cur_trans_deselect;            ///< deselect the device when 'cur_trans' is finished
+    uint8_t *dma_txbuf;                    ///< transmit bounce buffer of 'cur_trans', NULL if not used
+    uint8_t *dma_rxbuf;                    ///< receive bounce buffer of 'cur_trans', NULL if not used
+    uint8_t *dma_rxdest;                   ///< where to copy received data from the bounce buffer
+    uint32_t dma_rxlen;                    ///< number of bytes to copy from the bounce buffer
     int cur_device;
     lldesc_t *dmadesc_tx;
     lldesc_t *dmadesc_rx;
@@ -299,6 +316,61 @@ void spi_lobo_get_native_pins(int host, int *sdi, int *sdo, int *sck);
  */
 esp_err_t spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans);
 
+/**
+ * @brief Start the transmission as 'spi_lobo_transfer_data' does, but do not wait for DMA transfers to finish
+ *
+ * Transfers longer than SPI_LOBO_DMA_THRESHOLD bytes on a host with DMA channel are only started
+ * and the function returns immediately; 'trans' and its buffers must stay valid until
+ * 'spi_lobo_transfer_wait' returns. Other transfers are executed before the function returns.
+ * Starting another transfer or deselecting the device first waits for the pending transfer.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param trans Pointer to variable containing the description of the transaction that is executed
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_NO_MEM        if a bounce buffer cannot be allocated
+ *         - ESP error code        if device cannot be selected
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_transfer_data_async(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans);
+
+/**
+ * @brief Wait for the transfer started with 'spi_lobo_transfer_data_async' to finish
+ *
+ * Received data is copied to the transaction's buffer, device's 'post_cb' is called
+ * and the device is deselected if it was selected by the transfer function.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_OK                on success, or if no transfer is pending
+ */
+esp_err_t spi_lobo_transfer_wait(spi_lobo_device_handle_t handle);
+
+/**
+ * @brief Transmit several buffers to spi device in one CS assertion
+ *
+ * If all segments are word aligned, in DMA capable memory, all but the last one have
+ * lengths of 4-byte multiples and the chain fits into the host's DMA descriptors, they are
+ * linked into one DMA descriptor chain and sent in one transaction, without any allocation.
+ * Otherwise segments are sent one by one while the device stays selected.
+ * Only for devices without command, address and dummy phases.
+ * Device's 'pre_cb' and 'post_cb' are called once, with a transaction describing the total length
+ * and the first segment's buffer.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param seg Array of transmit segments
+ * @param count Number of segments
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid or the device uses command/address/dummy phases
+ *         - ESP error code        if device cannot be selected
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_transfer_segments(spi_lobo_device_handle_t handle, const spi_lobo_segment_t *seg, int count);
+
 
 /*
  * SPI transactions uses the semaphore (taken in select function) to protect the transfer
@@ -98,6 +98,7 @@ Font cfont = {
 	.offset = 0,
 	.numchars = 95,
 	.bitmap = 1,
+	.bpp = 1,
 };
 
 uint8_t font_buffered_char = 1;
@@ -118,10 +119,18 @@ typedef struct {
 static dispWin_t dispWinTemp;
 
 static uint8_t *userfont = NULL;
+static uint8_t *dejavu12aa = NULL;	// built from tft_Dejavu24 on first use
 static int TFT_OFFSET = 0;
 static propFont	fontChar;
 static float _arcAngleMax = DEFAULT_ARC_ANGLE_MAX;
 
+// Blended colors for anti-aliased fonts, indexed by glyph pixel value
+// rebuilt only when _fg, _bg or font bpp changes
+static color_t aa_lut[16];
+static color_t aa_lut_fg;
+static color_t aa_lut_bg;
+static uint8_t aa_lut_bpp = 0;
+
 
 // =========================================================================
 // ** All drawings are clipped to 'dispWin' **
@@ -1017,6 +1026,104 @@ void TFT_drawStar(int cx, int cy, int diameter, color_t color, bool fill, float
 
 // ================ Font and string functions ==================================
 
+// Bits per pixel of the font data; anti-aliased proportional fonts
+// have 'A' (0x41) in header byte 2 and 2 or 4 in header byte 3
+//--------------------------------------------
+static uint8_t fontBpp(const uint8_t *font) {
+	if ((font[0] == 0) && (font[2] == 0x41) && ((font[3] == 2) || (font[3] == 4))) return font[3];
+	return 1;
+}
+
+// Number of bytes of the packed glyph data
+//-------------------------------------------------------------
+static int glyphDataSize(int width, int height, uint8_t bpp) {
+	if (width == 0) return 0;
+	return (((width * height * bpp)-1) / 8) + 1;
+}
+
+// Size of a proportional font's data, up to and including the 0xFF end mark;
+// 0 if the end mark is not within 'max' bytes
+//-------------------------------------------------------------
+static uint32_t fontDataSize(const uint8_t *font, uint32_t max) {
+	uint8_t bpp = fontBpp(font);
+	uint32_t pos = 4;
+
+	while ((pos < max) && (font[pos] != 0xFF)) {
+		if ((pos + 6) > max) return 0;
+		pos += glyphDataSize(font[pos+2], font[pos+3], bpp) + 6;
+	}
+	return (pos < max) ? pos + 1 : 0;
+}
+
+//======================================================================
+uint8_t *TFT_fontToAA(const uint8_t *font, uint8_t scale, uint8_t bpp)
+{
+	if ((font[0] != 0) || (fontBpp(font) != 1) || ((bpp != 2) && (bpp != 4)) || (scale < 1) || (scale > 4)) return NULL;
+
+	int levels = (1 << bpp) - 1;
+	int area = scale * scale;
+	uint32_t pos = 4;
+	uint32_t size = 5;
+	uint8_t *aa, *d;
+
+	// Glyph box in the scaled grid: offsets round down, extents up
+	#define AA_BOX(_p, _x0, _y0, _w, _h) do { \
+		_x0 = font[(_p)+4] / scale; \
+		_y0 = font[(_p)+1] / scale; \
+		_w = (font[(_p)+2]) ? ((font[(_p)+4] + font[(_p)+2] + scale - 1) / scale) - _x0 : 0; \
+		_h = (font[(_p)+2]) ? ((font[(_p)+1] + font[(_p)+3] + scale - 1) / scale) - _y0 : 0; \
+	} while (0)
+
+	while (font[pos] != 0xFF) {
+		int x0, y0, w, h;
+		AA_BOX(pos, x0, y0, w, h);
+		size += glyphDataSize(w, h, bpp) + 6;
+		pos += glyphDataSize(font[pos+2], font[pos+3], 1) + 6;
+	}
+	aa = calloc(1, size);
+	if (aa == NULL) return NULL;
+
+	aa[1] = (font[1] + scale - 1) / scale;
+	aa[2] = 0x41;
+	aa[3] = bpp;
+	d = &aa[4];
+	pos = 4;
+	while (font[pos] != 0xFF) {
+		int sw = font[pos+2], sh = font[pos+3], sx0 = font[pos+4], sy0 = font[pos+1];
+		const uint8_t *src = &font[pos+6];
+		int x0, y0, w, h, bit = 0;
+
+		AA_BOX(pos, x0, y0, w, h);
+		d[0] = font[pos];
+		d[1] = y0;
+		d[2] = w;
+		d[3] = h;
+		d[4] = x0;
+		d[5] = (font[pos+5] + (scale / 2)) / scale;
+		d += 6;
+		for (int y=0; y < h; y++) {
+			for (int x=0; x < w; x++) {
+				int cover = 0;
+				// source pixels under this one, in glyph coordinates
+				for (int sy=(y0+y)*scale-sy0; sy < (y0+y+1)*scale-sy0; sy++) {
+					for (int sx=(x0+x)*scale-sx0; sx < (x0+x+1)*scale-sx0; sx++) {
+						if ((sx < 0) || (sx >= sw) || (sy < 0) || (sy >= sh)) continue;
+						int n = sy * sw + sx;
+						if (src[n / 8] & (0x80 >> (n % 8))) cover++;
+					}
+				}
+				d[bit / 8] |= ((cover * levels + (area / 2)) / area) << (8 - bpp - (bit % 8));
+				bit += bpp;
+			}
+		}
+		d += glyphDataSize(w, h, bpp);
+		pos += glyphDataSize(sw, sh, 1) + 6;
+	}
+	#undef AA_BOX
+	*d = 0xFF;
+	return aa;
+}
+
 //--------------------------------------------------------
 static int load_file_font(const char * fontfile, int info)
 {
@@ -1086,6 +1193,7 @@ static int load_file_font(const char * fontfile, int info)
 	//int offst = 0;
 	int pminwidth = 255;
 	int pmaxwidth = 0;
+	uint8_t bpp = 1;
 
 	if (width != 0) {
 		// Fixed font
@@ -1099,6 +1207,7 @@ static int load_file_font(const char * fontfile, int info)
 		size = 4; // point at first char data
 		uint8_t charCode;
 		int charwidth;
+		bpp = fontBpp(userfont);
 
 		do {
 		    charCode = userfont[size];
@@ -1106,8 +1215,7 @@ static int load_file_font(const char * fontfile, int info)
 
 		    if (charCode != 0xFF) {
 		    	numchar++;
-		    	if (charwidth != 0) size += ((((charwidth * userfont[size+3])-1) / 8) + 7);
-		    	else size += 6;
+		    	size += glyphDataSize(charwidth, userfont[size+3], bpp) + 6;
 
 		    	if (info) {
 	    			if (charwidth > pmaxwidth) pmaxwidth = charwidth;
@@ -1132,8 +1240,8 @@ static int load_file_font(const char * fontfile, int info)
 					size, width, height, numchar, first, last);
 		}
 		else {
-			printf("Proportional font:\r\n  size: %d  width: %d~%d  height: %d  characters: %d (%d~%d)\n",
-					size, pminwidth, pmaxwidth, height, numchar, first, last);
+			printf("Proportional font:\r\n  size: %d  width: %d~%d  height: %d  bpp: %d  characters: %d (%d~%d)\n",
+					size, pminwidth, pmaxwidth, height, bpp, numchar, first, last);
 		}
 	}
 
@@ -1148,8 +1256,8 @@ exit:
 	return err;
 }
 
-//------------------------------------------------
-int compile_font_file(char *fontfile, uint8_t dbg)
+//----------------------------------------------------------------------------------
+static int _compile_font_file(char *fontfile, uint8_t scale, uint8_t bpp, uint8_t dbg)
 {
 	int err = 0;
 	char err_msg[128] = {'\0'};
@@ -1159,6 +1267,8 @@ int compile_font_file(char *fontfile, uint8_t dbg)
     FILE *ffd = NULL;
     FILE *ffd_out = NULL;
     char *sourcebuf = NULL;
+    uint8_t *fontdata = NULL;
+    uint8_t *aa = NULL;
 
     len = strlen(fontfile);
 
@@ -1237,11 +1347,17 @@ int compile_font_file(char *fontfile, uint8_t dbg)
 	int lastline = 0;
 
 	fbuf = strstr(fbuf, "0x");
-	int size = 0;
+	uint32_t size = 0;
 	char *nextline;
 	char *numptr;
 
-	int bptr = 0;
+	// every byte takes at least 4 source characters
+	fontdata = malloc((fsize / 4) + 1);
+	if (fontdata == NULL) {
+		sprintf(err_msg, "memory allocation error");
+		err = 6;
+		goto exit;
+	}
 
 	while ((fbuf != NULL) && (fbuf < fend) && (lastline == 0)) {
 		nextline = strchr(fbuf, '\n'); // beginning of the next line
@@ -1256,15 +1372,9 @@ int compile_font_file(char *fontfile, uint8_t dbg)
 			if ((numptr == NULL) || ((fbuf+4) > nextline)) numptr = strstr(fbuf, "0X");
 			if ((numptr != NULL) && ((numptr+4) <= nextline)) {
 				fbuf = numptr;
-				if (bptr >= 128) {
-					// buffer full, write to file
-                    if (fwrite(outfile, 1, 128, ffd_out) != 128) goto error;
-					bptr = 0;
-					size += 128;
-				}
 				memcpy(hexstr, fbuf, 4);
 				hexstr[4] = 0;
-				outfile[bptr++] = (uint8_t)strtol(hexstr, NULL, 0);
+				fontdata[size++] = (uint8_t)strtol(hexstr, NULL, 0);
 				fbuf += 4;
 			}
 			else fbuf = nextline;
@@ -1272,10 +1382,19 @@ int compile_font_file(char *fontfile, uint8_t dbg)
 		fbuf = nextline;
 	}
 
-	if (bptr > 0) {
-		size += bptr;
-        if (fwrite(outfile, 1, bptr, ffd_out) != bptr) goto error;
+	uint8_t *outdata = fontdata;
+	if (bpp > 1) {
+		// anti-aliased output is made from a 1-bpp proportional source
+		if ((size > 4) && (fontdata[0] == 0) && (fontDataSize(fontdata, size) != 0)) aa = TFT_fontToAA(fontdata, scale, bpp);
+		if (aa == NULL) {
+			sprintf(err_msg, "not a 1-bpp proportional font, or no memory");
+			err = 8;
+			goto exit;
+		}
+		outdata = aa;
+		size = fontDataSize(aa, UINT32_MAX);
 	}
+	if (fwrite(outdata, 1, size, ffd_out) != size) goto error;
 
 	// write font ID
 	sprintf(outfile, "RPH_font");
@@ -1308,6 +1427,8 @@ error:
 
 exit:
 	if (sourcebuf) free(sourcebuf);
+	if (fontdata) free(fontdata);
+	if (aa) free(aa);
 	if (ffd) fclose(ffd);
 	if (ffd_out) fclose(ffd_out);
 
@@ -1317,6 +1438,19 @@ exit:
 }
 
 
+//------------------------------------------------
+int compile_font_file(char *fontfile, uint8_t dbg)
+{
+	return _compile_font_file(fontfile, 1, 1, dbg);
+}
+
+//------------------------------------------------------------------------------
+int compile_font_file_aa(char *fontfile, uint8_t scale, uint8_t bpp, uint8_t dbg)
+{
+	if ((bpp != 2) && (bpp != 4)) return 8;
+	return _compile_font_file(fontfile, scale, bpp, dbg);
+}
+
 // -----------------------------------------------------------------------------------------
 // Individual Proportional Font Character Format:
 // -----------------------------------------------------------------------------------------
@@ -1369,10 +1503,8 @@ void getFontCharacters(uint8_t *buf)
         ch = cfont.font[tempPtr++];
         tempPtr++;
         tempPtr++;
-		if (cw != 0) {
-			// packed bits
-			tempPtr += (((cw * ch)-1) / 8) + 1;
-		}
+		// packed bits
+		tempPtr += glyphDataSize(cw, ch, cfont.bpp);
 		buf[n++] = cc;
 	    cc = cfont.font[tempPtr++];
 	}
@@ -1402,10 +1534,8 @@ static void getMaxWidthHeight()
 		if (cd > cfont.max_x_size) cfont.max_x_size = cd;
 		if (ch > cfont.y_size) cfont.y_size = ch;
 		if (cy > cfont.y_size) cfont.y_size = cy;
-		if (cw != 0) {
-			// packed bits
-			tempPtr += (((cw * ch)-1) / 8) + 1;
-		}
+		// packed bits
+		tempPtr += glyphDataSize(cw, ch, cfont.bpp);
 	    cc = cfont.font[tempPtr++];
 	}
     cfont.size = tempPtr;
@@ -1428,10 +1558,8 @@ static uint8_t getCharPtr(uint8_t c) {
     fontChar.xDelta = cfont.font[tempPtr++];
 
     if (c != fontChar.charCode && fontChar.charCode != 0xFF) {
-      if (fontChar.width != 0) {
-        // packed bits
-        tempPtr += (((fontChar.width * fontChar.height)-1) / 8) + 1;
-      }
+      // packed bits
+      tempPtr += glyphDataSize(fontChar.width, fontChar.height, cfont.bpp);
     }
   } while ((c != fontChar.charCode) && (fontChar.charCode != 0xFF));
 
@@ -1502,6 +1630,10 @@ void TFT_setFont(uint8_t font, const char *font_file)
 	  }
 	  else if (font == DEJAVU18_FONT) cfont.font = tft_Dejavu18;
 	  else if (font == DEJAVU24_FONT) cfont.font = tft_Dejavu24;
+	  else if (font == DEJAVU12AA_FONT) {
+		  if (dejavu12aa == NULL) dejavu12aa = TFT_fontToAA(tft_Dejavu24, 2, 4);
+		  cfont.font = (dejavu12aa) ? dejavu12aa : tft_DefaultFont;
+	  }
 	  else if (font == UBUNTU16_FONT) cfont.font = tft_Ubuntu16;
 	  else if (font == COMIC24_FONT) cfont.font = tft_Comic24;
 	  else if (font == MINYA24_FONT) cfont.font = tft_minya24;
@@ -1511,6 +1643,7 @@ void TFT_setFont(uint8_t font, const char *font_file)
 	  else cfont.font = tft_DefaultFont;
 
 	  cfont.bitmap = 1;
+	  cfont.bpp = fontBpp(cfont.font);
 	  cfont.x_size = cfont.font[0];
 	  cfont.y_size = cfont.font[1];
 	  if (cfont.x_size > 0) {
@@ -1535,13 +1668,103 @@ void TFT_setFont(uint8_t font, const char *font_file)
 // Height				(height of the visible pixels)
 // xOffset				(start X of visible pixels)
 // xDelta				(the distance to move the cursor. Effective width of the character.)
-// Data[n]
+// Data[n]				(Width*Height pixels, cfont.bpp bits each, MSB first)
 // -----------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
 // Character drawing rectangle is (0, 0) (xDelta-1, cfont.y_size-1)
 // Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
 //---------------------------------------------------------------------------------------------
 
+// Build the fg/bg blend table for anti-aliased fonts
+// All multiplies are done here, once per (fg, bg) pair
+//---------------------------
+static void _aa_update_lut() {
+	if ((aa_lut_bpp == cfont.bpp) &&
+		(memcmp(&aa_lut_fg, &_fg, sizeof(color_t)) == 0) && (memcmp(&aa_lut_bg, &_bg, sizeof(color_t)) == 0)) return;
+
+	int levels = (1 << cfont.bpp) - 1;
+	for (int n=0; n <= levels; n++) {
+		aa_lut[n].r = _bg.r + ((((int)_fg.r - (int)_bg.r) * n) + (levels/2)) / levels;
+		aa_lut[n].g = _bg.g + ((((int)_fg.g - (int)_bg.g) * n) + (levels/2)) / levels;
+		aa_lut[n].b = _bg.b + ((((int)_fg.b - (int)_bg.b) * n) + (levels/2)) / levels;
+	}
+	aa_lut_fg = _fg;
+	aa_lut_bg = _bg;
+	aa_lut_bpp = cfont.bpp;
+}
+
+// print non-rotated anti-aliased proportional character
+// character is already in fontChar
+//------------------------------------------------
+static int printProportionalCharAA(int x, int y) {
+	uint8_t ch = 0, v;
+	uint8_t bpp = cfont.bpp;
+	uint8_t vmask = (1 << bpp) - 1;
+	int i, j, bits, char_width;
+
+	char_width = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
+	_aa_update_lut();
+
+	if ((font_buffered_char) && (!font_transparent)) {
+		int len, bufPos;
+
+		// === buffer Glyph data for faster sending ===
+		len = char_width * cfont.y_size;
+		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
+		if (color_line) {
+			// fill with background color
+			for (int n = 0; n < len; n++) {
+				color_line[n] = _bg;
+			}
+			// set character pixels to blended colors
+			bits = 0;
+			for (j=0; j < fontChar.height; j++) {
+				bufPos = ((j + fontChar.adjYOffset) * char_width) + fontChar.xOffset;
+				for (i=0; i < fontChar.width; i++) {
+					if (bits == 0) {
+						ch = cfont.font[fontChar.dataPtr++];
+						bits = 8;
+					}
+					bits -= bpp;
+					v = (ch >> bits) & vmask;
+					if (v) color_line[bufPos + i] = aa_lut[v];
+				}
+			}
+			// send to display in one transaction
+			disp_select();
+			send_data(x, y, x+char_width-1, y+cfont.y_size-1, len, color_line);
+			disp_deselect();
+			free(color_line);
+
+			return char_width;
+		}
+	}
+
+	if (!font_transparent) _fillRect(x, y, char_width+1, cfont.y_size, _bg);
+
+	// draw Glyph; background is unknown in transparent mode, so pixels with
+	// at least half coverage are drawn with foreground color
+	bits = 0;
+	disp_select();
+	for (j=0; j < fontChar.height; j++) {
+		for (i=0; i < fontChar.width; i++) {
+			if (bits == 0) {
+				ch = cfont.font[fontChar.dataPtr++];
+				bits = 8;
+			}
+			bits -= bpp;
+			v = (ch >> bits) & vmask;
+			if (font_transparent) {
+				if (v > (vmask >> 1)) _drawPixel(x+fontChar.xOffset+i, y+j+fontChar.adjYOffset, _fg, 0);
+			}
+			else if (v) _drawPixel(x+fontChar.xOffset+i, y+j+fontChar.adjYOffset, aa_lut[v], 0);
+		}
+	}
+	disp_deselect();
+
+	return char_width;
+}
+
 // print non-rotated proportional character
 // character is already in fontChar
 //----------------------------------------------
@@ -1549,6 +1772,8 @@ static int printProportionalChar(int x, int y) {
 	uint8_t ch = 0;
 	int i, j, char_width;
 
+	if (cfont.bpp > 1) return printProportionalCharAA(x, y);
+
 	char_width = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
 
 	if ((font_buffered_char) && (!font_transparent)) {
@@ -1699,23 +1924,34 @@ static int rotatePropChar(int x, int y, int offset) {
   double radian = font_rotate * DEG_TO_RAD;
   float cos_radian = cos(radian);
   float sin_radian = sin(radian);
+  uint8_t bpp = cfont.bpp;
+  uint8_t vmask = (1 << bpp) - 1;
+  uint8_t v;
+  int bits = 0;
+
+  if (bpp > 1) _aa_update_lut();
 
-  uint8_t mask = 0x80;
   disp_select();
   for (int j=0; j < fontChar.height; j++) {
     for (int i=0; i < fontChar.width; i++) {
-      if (((i + (j*fontChar.width)) % 8) == 0) {
-        mask = 0x80;
+      if (bits == 0) {
         ch = cfont.font[fontChar.dataPtr++];
+        bits = 8;
       }
+      bits -= bpp;
+      v = (ch >> bits) & vmask;
 
       int newX = (int)(x + (((offset + i) * cos_radian) - ((j+fontChar.adjYOffset)*sin_radian)));
       int newY = (int)(y + (((j+fontChar.adjYOffset) * cos_radian) + ((offset + i) * sin_radian)));
 
-      if ((ch & mask) != 0) _drawPixel(newX,newY,_fg, 0);
-      else if (!font_transparent) _drawPixel(newX,newY,_bg, 0);
-
-      mask >>= 1;
+      if (bpp == 1) {
+        if (v) _drawPixel(newX,newY,_fg, 0);
+        else if (!font_transparent) _drawPixel(newX,newY,_bg, 0);
+      }
+      else if (font_transparent) {
+        if (v > (vmask >> 1)) _drawPixel(newX,newY,_fg, 0);
+      }
+      else _drawPixel(newX,newY,aa_lut[v], 0);
     }
   }
   disp_deselect();
@@ -2357,12 +2593,12 @@ static UINT tjd_output (
 				else src += 3; // skip
 			}
 		}
-		wait_trans_finish(1);
+		wait_trans_finish();
 		send_data(dleft, dtop, dright, dbottom, len, dev->linbuf[dev->linbuf_idx]);
 		dev->linbuf_idx = ((dev->linbuf_idx + 1) & 1);
 	}
 	else {
-		wait_trans_finish(1);
+		wait_trans_finish();
 		printf("Data size error: %d jpg: (%d,%d,%d,%d) disp: (%d,%d,%d,%d)\r\n", len, left,top,right,bottom, dleft,dtop,dright,dbottom);
 		return 0;  // stop decompression
 	}
@@ -2729,7 +2965,7 @@ int TFT_bmp_image(int x, int y, uint8_t scale, char *fname, uint8_t *imgbuf, int
 			}
 		}
 
-		wait_trans_finish(1);
+		wait_trans_finish();
 		send_data(disp_xstart, disp_yend, disp_xend, disp_yend, img_xlen, (color_t *)line_buf[lb_idx]);
 		lb_idx = (lb_idx + 1) & 1;  // change buffer
 
@@ -26,6 +26,7 @@ typedef struct {
     uint16_t	size;
 	uint8_t 	max_x_size;
     uint8_t     bitmap;
+    uint8_t     bpp;			// bits per glyph pixel; 1, or 2/4 for anti-aliased proportional fonts
 	color_t     color;
 } Font;
 
@@ -125,6 +126,7 @@ extern const color_t TFT_PINK;
 #define DEF_SMALL_FONT	8
 #define FONT_7SEG		9
 #define USER_FONT		10  // font will be read from file
+#define DEJAVU12AA_FONT	11  // 4-bpp anti-aliased, made from DEJAVU24_FONT on first use
 
 
 
@@ -659,6 +661,14 @@ int TFT_read_touch(int *x, int* y, uint8_t raw);
  * which can be used in TFT_setFont() function to select external font
  * Created file have the same name as source file and extension .fnt
  *
+ * Anti-aliased proportional fonts are compiled the same way. They are marked with
+ * 0x41 ('A') in the 3rd header byte and the number of bits per pixel (2 or 4)
+ * in the 4th header byte (both reserved in 1-bpp proportional fonts);
+ * glyph data is packed with that many bits per pixel.
+ * Anti-aliased glyphs are blended from _bg to _fg; with 'font_transparent' set
+ * there is no background to blend with, so pixels with at least half coverage
+ * are drawn in _fg and the rest are skipped.
+ *
  * Params:
  *		fontfile: pointer to c source font file name; must have .c extension
  *			 dbg: if set to 1, prints debug information
@@ -671,6 +681,37 @@ int TFT_read_touch(int *x, int* y, uint8_t raw);
 //------------------------------------------------
 int compile_font_file(char *fontfile, uint8_t dbg);
 
+/*
+ * Compile a 1-bpp proportional font c source file to an anti-aliased .fnt file
+ * Each output pixel is the coverage of a scale x scale block of source pixels,
+ * so the font is 'scale' times smaller than the source
+ *
+ * Params:
+ *		fontfile: pointer to c source font file name; must have .c extension
+ *		   scale: 1~4
+ *			 bpp: 2 or 4 bits per output pixel
+ *			 dbg: if set to 1, prints debug information
+ *
+ * Returns:
+ * 		0 on success
+ * 		err no on error
+ *
+ */
+//------------------------------------------------------------------------------
+int compile_font_file_aa(char *fontfile, uint8_t scale, uint8_t bpp, uint8_t dbg);
+
+/*
+ * Make an anti-aliased copy of a 1-bpp proportional font in RAM
+ * Same scaling as compile_font_file_aa(); the caller frees the copy
+ *
+ * Returns:
+ * 		pointer to the new font, NULL if the font is not 1-bpp proportional,
+ * 		the parameters are out of range or there is no memory
+ *
+ */
+//------------------------------------------------------------------------
+uint8_t *TFT_fontToAA(const uint8_t *font, uint8_t scale, uint8_t bpp);
+
 /*
  * Get all font's characters to buffer
  */
@@ -9,11 +9,13 @@
 */
 
 #include <string.h>
+#include <math.h>
 #include "tftspi.h"
 #include "esp_system.h"
 #include "freertos/task.h"
 #include "esp_heap_caps.h"
 #include "soc/spi_reg.h"
+#include "xtensa/hal.h"
 
 
 // ====================================================
@@ -38,28 +40,52 @@ spi_lobo_device_handle_t ts_spi = NULL;
 // ====================================================
 
 
-static color_t *trans_cline = NULL;
 static uint8_t _dma_sending = 0;
 
-// RGB to GRAYSCALE constants
-// 0.2989  0.5870  0.1140
-#define GS_FACT_R 0.2989
-#define GS_FACT_G 0.4870
-#define GS_FACT_B 0.2140
+// RGB to GRAYSCALE constants, scaled by 1024
+// 0.2989  0.4870  0.2140
+#define GS_FACT_R 306
+#define GS_FACT_G 499
+#define GS_FACT_B 219
+
+// Number of colors in each of the two DMA buffers used to send transformed color data
+#define CT_DMA_BUF_COLORS 256
+
+// Color transform state
+static uint8_t ct_gray = 0;			// convert to gray scale
+static uint8_t ct_lut_active = 0;	// apply channel tables
+static uint8_t ct_invert_only = 0;	// channel tables only invert, use word-at-a-time xor
+static uint8_t ct_lut[3][256];		// r, g, b channel tables
+static color_t *ct_dmabuf[2] = {NULL, NULL};
+static uint8_t ct_dmabuf_idx = 0;
+
+// Solid fills are sent from one small buffer through a circular DMA descriptor ring,
+// the transfer length alone ends the transaction
+#define FILL_BUF_COLORS		128						// multiple of 4 colors, whole words
+#define FILL_RING_DESC		2
+#define FILL_MAX_COLORS		((1 << 24) / 24)		// limited by 24-bit mosi_dlen register
+static color_t fill_buf[FILL_BUF_COLORS] __attribute__((aligned(4)));
+static lldesc_t fill_desc[FILL_RING_DESC];
+static color_t fill_color;
+static uint8_t fill_ready = 0;
+
+// Draw cost counters, bus time is computed when the counters are read
+static tft_draw_stats_t draw_stats;
+#define DRAW_STAT(_trans, _bytes, _pixels) do { \
+	draw_stats.transactions += (_trans); \
+	draw_stats.spi_bytes += (_bytes); \
+	draw_stats.pixels += (_pixels); \
+} while (0)
 
 
 
 // ==== Functions =====================
 
-//------------------------------------------------------
-esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
+//---------------------------------------
+esp_err_t IRAM_ATTR wait_trans_finish()
 {
 	// Wait for SPI bus ready
 	while (disp_spi->host->hw->cmd.usr);
-	if ((free_line) && (trans_cline)) {
-		free(trans_cline);
-		trans_cline = NULL;
-	}
 	if (_dma_sending) {
 	    //Tell common code DMA workaround that our DMA channel is idle. If needed, the code will do a DMA reset.
 	    if (disp_spi->host->dma_chan) spi_lobo_dmaworkaround_idle(disp_spi->host->dma_chan);
@@ -78,14 +104,14 @@ esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
 //-------------------------------
 esp_err_t IRAM_ATTR disp_select()
 {
-	wait_trans_finish(1);
+	wait_trans_finish();
 	return spi_lobo_device_select(disp_spi, 0);
 }
 
 //---------------------------------
 esp_err_t IRAM_ATTR disp_deselect()
 {
-	wait_trans_finish(1);
+	wait_trans_finish();
 	return spi_lobo_device_deselect(disp_spi);
 }
 
@@ -120,6 +146,7 @@ void IRAM_ATTR disp_spi_transfer_cmd(int8_t cmd) {
 
     disp_spi->host->hw->data_buf[0] = (uint32_t)cmd;
     _spi_transfer_start(disp_spi, 8, 0);
+	DRAW_STAT(1, 1, 0);
 }
 
 // Send command with data to display, display must be selected
@@ -133,42 +160,37 @@ void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t le
 
     disp_spi->host->hw->data_buf[0] = (uint32_t)cmd;
     _spi_transfer_start(disp_spi, 8, 0);
+	DRAW_STAT(1, 1, 0);
 
 	if ((len == 0) || (data == NULL)) return;
 
     // Set DC to 1 (data mode);
 	gpio_set_level(PIN_NUM_DC, 1);
 
-	uint8_t idx=0, bidx=0;
-	uint32_t bits=0;
-	uint32_t count=0;
-	uint32_t wd = 0;
-	while (count < len) {
-		// get data byte from buffer
-		wd |= (uint32_t)data[count] << bidx;
-    	count++;
-    	bits += 8;
-		bidx += 8;
-    	if (count == len) {
-    		disp_spi->host->hw->data_buf[idx] = wd;
-    		break;
-    	}
-		if (bidx == 32) {
-			disp_spi->host->hw->data_buf[idx] = wd;
-			idx++;
-			bidx = 0;
-			wd = 0;
+	volatile uint32_t *buf = disp_spi->host->hw->data_buf;
+	uint32_t n, i;
+	while (len) {
+		// Send max 64 bytes (full SPI buffer) at once, packed 4 bytes per word
+		n = (len > 64) ? 64 : len;
+		if (((uint32_t)data & 3) == 0) {
+			for (i=0; i<(n>>2); i++) buf[i] = ((uint32_t *)data)[i];
 		}
-    	if (idx == 16) {
-    		// SPI buffer full, send data
-			_spi_transfer_start(disp_spi, bits, 0);
-    		
-			bits = 0;
-    		idx = 0;
-			bidx = 0;
-    	}
-    }
-    if (bits > 0) _spi_transfer_start(disp_spi, bits, 0);
+		else {
+			for (i=0; i<(n>>2); i++) {
+				buf[i] = (uint32_t)data[i*4] | ((uint32_t)data[i*4+1] << 8) | ((uint32_t)data[i*4+2] << 16) | ((uint32_t)data[i*4+3] << 24);
+			}
+		}
+		if (n & 3) {
+			// last partial word
+			uint32_t wd = 0;
+			for (uint32_t b=0; b<(n & 3); b++) wd |= (uint32_t)data[(i*4)+b] << (b*8);
+			buf[i] = wd;
+		}
+		_spi_transfer_start(disp_spi, n*8, 0);
+		DRAW_STAT(1, n, 0);
+		data += n;
+		len -= n;
+	}
 }
 
 // Set the address window for display write & read commands, display must be selected
@@ -220,21 +242,96 @@ static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16
 	disp_spi->host->hw->cmd.usr = 1; // Start transfer
 	while (disp_spi->host->hw->cmd.usr);
     taskENABLE_INTERRUPTS();
+	DRAW_STAT(4, 10, 0);	// CASET, PASET and their 4 data bytes
 }
 
-// Convert color to gray scale
-//----------------------------------------------
-static color_t IRAM_ATTR color2gs(color_t color)
+// Returns 1 if colors must be transformed before sending
+//-------------------------------------------
+static inline uint8_t IRAM_ATTR _ct_active()
 {
-	color_t _color;
-    float gs_clr = GS_FACT_R * color.r + GS_FACT_G * color.g + GS_FACT_B * color.b;
-    if (gs_clr > 255) gs_clr = 255;
+	return (gray_scale | ct_gray | ct_lut_active);
+}
 
-    _color.r = (uint8_t)gs_clr;
-    _color.g = (uint8_t)gs_clr;
-    _color.b = (uint8_t)gs_clr;
+// Apply the color transform to one color
+//-------------------------------------------------------
+static inline color_t IRAM_ATTR _ct_color(color_t color)
+{
+	if (gray_scale | ct_gray) {
+		uint8_t gs = ((GS_FACT_R * color.r) + (GS_FACT_G * color.g) + (GS_FACT_B * color.b)) >> 10;
+		color.r = gs;
+		color.g = gs;
+		color.b = gs;
+	}
+	if (ct_lut_active) {
+		color.r = ct_lut[0][color.r];
+		color.g = ct_lut[1][color.g];
+		color.b = ct_lut[2][color.b];
+	}
+	return color;
+}
 
-    return _color;
+// Copy 'len' colors from 'src' to 'dst' applying the color transform
+//--------------------------------------------------------------------------------
+static void IRAM_ATTR _ct_convert(color_t *dst, const color_t *src, uint32_t len)
+{
+	if ((ct_invert_only) && (!gray_scale)) {
+		// only invert, 4 bytes at a time if the source is word aligned
+		const uint8_t *s = (const uint8_t *)src;
+		uint8_t *d = (uint8_t *)dst;
+		uint32_t bytes = len * 3;
+		if ((((uint32_t)s | (uint32_t)d) & 3) == 0) {
+			for (; bytes >= 4; bytes -= 4, s += 4, d += 4) {
+				*(uint32_t *)d = ~(*(const uint32_t *)s);
+			}
+		}
+		while (bytes--) *d++ = ~(*s++);
+		return;
+	}
+	for (uint32_t n=0; n<len; n++) {
+		dst[n] = _ct_color(src[n]);
+	}
+}
+
+//=========================================================
+void TFT_setColorTransform(const color_transform_t *ct)
+{
+	wait_trans_finish();
+	if (ct == NULL) {
+		ct_gray = 0;
+		ct_lut_active = 0;
+		ct_invert_only = 0;
+		return;
+	}
+
+	uint8_t tint[3] = {ct->tint.r, ct->tint.g, ct->tint.b};
+	uint8_t gamma = ((ct->gamma > 0) && (ct->gamma != 1.0));
+	uint8_t scale = (ct->brightness != 255) || (tint[0] != 255) || (tint[1] != 255) || (tint[2] != 255);
+
+	// Build the channel tables; floating point is used only here
+	for (int c=0; c<3; c++) {
+		for (int v=0; v<256; v++) {
+			int val = v;
+			if (gamma) val = (int)((powf(v / 255.0, ct->gamma) * 255.0) + 0.5);
+			val = (val * tint[c] * ct->brightness + (255*255/2)) / (255*255);
+			if (val > 255) val = 255;
+			if (ct->invert) val = 255 - val;
+			ct_lut[c][v] = val;
+		}
+	}
+	ct_invert_only = (ct->invert) && (!gamma) && (!scale) && (!ct->grayscale);
+	ct_lut_active = (ct->invert) || gamma || scale;
+	ct_gray = ct->grayscale ? 1 : 0;
+}
+
+//========================================================
+void TFT_getDrawStats(tft_draw_stats_t *st, uint8_t reset)
+{
+	*st = draw_stats;
+	uint32_t clock = (disp_spi) ? spi_lobo_get_speed(disp_spi) : DEFAULT_SPI_CLOCK;
+	if (clock == 0) clock = DEFAULT_SPI_CLOCK;
+	st->bus_us = (uint32_t)((((uint64_t)st->spi_bytes * 8 * 1000000) / clock) +
+	             (((uint64_t)st->transactions * TFT_TRANSACTION_NS) / 1000));
+	if (reset) memset(&draw_stats, 0, sizeof(draw_stats));
 }
 
 // Set display pixel at given coordinates to given color
@@ -246,11 +343,11 @@ void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
 	if (sel) {
 		if (disp_select()) return;
 	}
-	else wait_trans_finish(1);
+	else wait_trans_finish();
 
 	uint32_t wd = 0;
     color_t _color = color;
-	if (gray_scale) _color = color2gs(color);
+	if (_ct_active()) _color = _ct_color(color);
 
     taskDISABLE_INTERRUPTS();
 	disp_spi_transfer_addrwin(x, x+1, y, y+1);
@@ -275,6 +372,7 @@ void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
 	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
 
     taskENABLE_INTERRUPTS();
+	DRAW_STAT(2, 4, 1);
    if (sel) disp_deselect();
 }
 
@@ -290,65 +388,164 @@ static void IRAM_ATTR _dma_send(uint8_t *data, uint32_t size)
     disp_spi->host->hw->user.usr_mosi_highpart=0;
 
 	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (size * 8) - 1;
+	DRAW_STAT(1, size, 0);
 
 	_dma_sending = 1;
 	// Start transfer
 	disp_spi->host->hw->cmd.usr = 1;
 }
 
+// Pack 4 colors (12 bytes) into 3 32-bit words
+#define PACK_COLORS4(w, c) do { \
+	(w)[0] = (uint32_t)(c)[0].r | ((uint32_t)(c)[0].g << 8) | ((uint32_t)(c)[0].b << 16) | ((uint32_t)(c)[1].r << 24); \
+	(w)[1] = (uint32_t)(c)[1].g | ((uint32_t)(c)[1].b << 8) | ((uint32_t)(c)[2].r << 16) | ((uint32_t)(c)[2].g << 24); \
+	(w)[2] = (uint32_t)(c)[2].b | ((uint32_t)(c)[3].r << 8) | ((uint32_t)(c)[3].g << 16) | ((uint32_t)(c)[3].b << 24); \
+} while (0)
+
+// Pack 'len' colors from color buffer into SPI buffer, 4 colors at a time
+// 'ct' is a constant at every call, so the compiler generates separate kernels
+//------------------------------------------------------------------------------------------------------------
+static inline void __attribute__((always_inline)) _pack_colors(const color_t *color, uint32_t len, const uint8_t ct)
+{
+	volatile uint32_t *buf = disp_spi->host->hw->data_buf;
+	color_t c[4];
+	uint32_t w[3];
+
+	for (; len >= 4; len -= 4, color += 4, buf += 3) {
+		if (ct) {
+			c[0] = _ct_color(color[0]);
+			c[1] = _ct_color(color[1]);
+			c[2] = _ct_color(color[2]);
+			c[3] = _ct_color(color[3]);
+			PACK_COLORS4(buf, c);
+		}
+		else PACK_COLORS4(buf, color);
+	}
+	if (len) {
+		// 1~3 colors left
+		memset(c, 0, sizeof(c));
+		for (uint32_t n=0; n<len; n++) c[n] = (ct) ? _ct_color(color[n]) : color[n];
+		PACK_COLORS4(w, c);
+		for (uint32_t n=0; n<(((len*3)+3)/4); n++) buf[n] = w[n];
+	}
+}
+
+// Fill SPI buffer with 'len' repeated colors
+//-----------------------------------------------------------------
+static inline void _pack_color_rep(color_t color, uint32_t len)
+{
+	volatile uint32_t *buf = disp_spi->host->hw->data_buf;
+	color_t c[4] = {color, color, color, color};
+	uint32_t w[3];
+	uint32_t nw = ((len*3)+3)/4;
+
+	// the word pattern repeats every 3 words
+	PACK_COLORS4(w, c);
+	for (uint32_t n=0; n<nw; n+=3) {
+		buf[n] = w[0];
+		if ((n+1) < nw) buf[n+1] = w[1];
+		if ((n+2) < nw) buf[n+2] = w[2];
+	}
+}
+
+// Send max 21 colors (504 bits) from the SPI buffer
 //---------------------------------------------------------------------------
 static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
 {
-	uint32_t cidx = 0;	// color buffer index
-	uint32_t wd = 0;
-	int idx = 0;
-	int bits = 0;
-	int wbits = 0;
+	if (len == 0) return;
+
+	uint8_t ct = _ct_active();
 
     taskDISABLE_INTERRUPTS();
-	color_t _color = color[0];
-	if ((rep) && (gray_scale)) _color = color2gs(color[0]);
+	while (disp_spi->host->hw->cmd.usr);						// Wait for SPI bus ready
+	uint32_t ccount = xthal_get_ccount();
+	if (rep) _pack_color_rep((ct) ? _ct_color(color[0]) : color[0], len);
+	else if (ct) _pack_colors(color, len, 1);
+	else _pack_colors(color, len, 0);
+	draw_stats.pack_cycles += xthal_get_ccount() - ccount;
+
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (len*24)-1;	// set number of bits to be sent
+	disp_spi->host->hw->cmd.usr = 1;							// Start transfer
+    taskENABLE_INTERRUPTS();
+	DRAW_STAT(1, len*3, 0);
+}
 
-	while (len) {
-		// ** Get color data from color buffer **
-		if (rep == 0) {
-			if (gray_scale) _color = color2gs(color[cidx]);
-			else _color = color[cidx];
-		}
+// Send 'len' colors of the same color using the circular descriptor ring
+//--------------------------------------------------------------------
+static void IRAM_ATTR _dma_send_fill(color_t color, uint32_t len)
+{
+	// previous fill may still be sending from the buffer
+	wait_trans_finish();
 
-		wd |= (uint32_t)_color.r << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+	if ((!fill_ready) || (memcmp(&fill_color, &color, sizeof(color_t)) != 0)) {
+		for (int i=0; i<FILL_BUF_COLORS; i++) fill_buf[i] = color;
+		fill_color = color;
+	}
+	if (!fill_ready) {
+		for (int n=0; n<FILL_RING_DESC; n++) {
+			fill_desc[n].size = sizeof(fill_buf);
+			fill_desc[n].length = sizeof(fill_buf);
+			fill_desc[n].buf = (uint8_t *)fill_buf;
+			fill_desc[n].eof = 0;
+			fill_desc[n].sosf = 0;
+			fill_desc[n].owner = 1;
+			fill_desc[n].qe.stqe_next = &fill_desc[(n+1) % FILL_RING_DESC];
 		}
-		wd |= (uint32_t)_color.g << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+		fill_ready = 1;
+	}
+
+    spi_lobo_dmaworkaround_transfer_active(disp_spi->host->dma_chan); //mark channel as active
+    disp_spi->host->hw->user.usr_mosi_highpart=0;
+    disp_spi->host->hw->dma_out_link.addr=(int)(&fill_desc[0]) & 0xFFFFF;
+    disp_spi->host->hw->dma_out_link.start=1;
+
+	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (len * 24) - 1;
+	DRAW_STAT(1, len*3, 0);
+
+	_dma_sending = 1;	// DMA is reset in wait_trans_finish, dropping the prefetched ring data
+	// Start transfer
+	disp_spi->host->hw->cmd.usr = 1;
+}
+
+// Send 'len' colors using DMA, transforming them into two alternating
+// DMA buffers; next buffer is prepared while the previous one is sent
+//--------------------------------------------------------------------
+static void IRAM_ATTR _dma_send_converted(color_t *color, uint32_t len)
+{
+	uint32_t n;
+
+	if (ct_dmabuf[0] == NULL) {
+		ct_dmabuf[0] = heap_caps_malloc(CT_DMA_BUF_COLORS*3, MALLOC_CAP_DMA);
+		ct_dmabuf[1] = heap_caps_malloc(CT_DMA_BUF_COLORS*3, MALLOC_CAP_DMA);
+		if ((ct_dmabuf[0] == NULL) || (ct_dmabuf[1] == NULL)) {
+			free(ct_dmabuf[0]);
+			free(ct_dmabuf[1]);
+			ct_dmabuf[0] = NULL;
+			ct_dmabuf[1] = NULL;
 		}
-		wd |= (uint32_t)_color.b << wbits;
-		wbits += 8;
-		if (wbits == 32) {
-			bits += wbits;
-			wbits = 0;
-			disp_spi->host->hw->data_buf[idx++] = wd;
-			wd = 0;
+	}
+
+	if (ct_dmabuf[0] == NULL) {
+		// No DMA buffers, send in direct mode, max 21 colors (504 bits) at once
+		while (len) {
+			n = (len > 21) ? 21 : len;
+			wait_trans_finish();
+			_direct_send(color, n, 0);
+			color += n;
+			len -= n;
 		}
-    	len--;					// Decrement colors counter
-        if (rep == 0) cidx++;	// if not repeating color, increment color buffer index
-    }
-	if (bits) {
-		while (disp_spi->host->hw->cmd.usr);						// Wait for SPI bus ready
-		disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = bits-1;	// set number of bits to be sent
-        disp_spi->host->hw->cmd.usr = 1;							// Start transfer
+		return;
+	}
+
+	while (len) {
+		n = (len > CT_DMA_BUF_COLORS) ? CT_DMA_BUF_COLORS : len;
+		_ct_convert(ct_dmabuf[ct_dmabuf_idx], color, n);
+		wait_trans_finish();
+		_dma_send((uint8_t *)ct_dmabuf[ct_dmabuf_idx], n*3);
+		ct_dmabuf_idx ^= 1;
+		color += n;
+		len -= n;
 	}
-    taskENABLE_INTERRUPTS();
 }
 
 // ================================================================
@@ -369,6 +566,7 @@ static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t re
 	disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
 	disp_spi->host->hw->cmd.usr = 1;		// Start transfer
 	while (disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+	DRAW_STAT(1, 1, len);
 
 	gpio_set_level(PIN_NUM_DC, 1);								// Set DC to 1 (data mode);
 
@@ -379,57 +577,29 @@ static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t re
 	}
 	else if (rep == 0)  {
 		// ==== use DMA transfer ====
-		// ** Prepare data
-		if (gray_scale) {
-			for (int n=0; n<len; n++) {
-				color[n] = color2gs(color[n]);
-			}
-	    }
-
-	    _dma_send((uint8_t *)color, len*3);
+		// ** Transformed data is sent from separate buffers, source buffer is not modified
+		if (_ct_active()) _dma_send_converted(color, len);
+		else _dma_send((uint8_t *)color, len*3);
 	}
 	else {
 		// ==== Repeat color, more than 512 bits total ====
 
+		// ==== send from the fill ring, one transaction per max 699050 colors ====
 		color_t _color;
-		uint32_t buf_colors;
-		int buf_bytes, to_send;
-
-		/*
-		to_send = len;
-		while (to_send > 0) {
-			wait_trans_finish(0);
-			_direct_send(color, ((to_send > 21) ? 21 : to_send), rep);
-			to_send -= 21;
-		}
-		*/
-
-		buf_colors = ((len > (_width*2)) ? (_width*2) : len);
-		buf_bytes = buf_colors * 3;
-
-		// Prepare color buffer of maximum 2 color lines
-		trans_cline = heap_caps_malloc(buf_bytes, MALLOC_CAP_DMA);
-		if (trans_cline == NULL) return;
+		uint32_t n;
 
 		// Prepare fill color
-		if (gray_scale) _color = color2gs(color[0]);
+		if (_ct_active()) _color = _ct_color(color[0]);
 		else _color = color[0];
 
-		// Fill color buffer with fill color
-		for (uint32_t i=0; i<buf_colors; i++) {
-			trans_cline[i] = _color;
-		}
-
-		// Send 'len' colors
-		to_send = len;
-		while (to_send > 0) {
-			wait_trans_finish(0);
-			_dma_send((uint8_t *)trans_cline, ((to_send > buf_colors) ? buf_bytes : (to_send*3)));
-			to_send -= buf_colors;
+		while (len) {
+			n = (len > FILL_MAX_COLORS) ? FILL_MAX_COLORS : len;
+			_dma_send_fill(_color, n);
+			len -= n;
 		}
 	}
 
-	if (wait) wait_trans_finish(1);
+	if (wait) wait_trans_finish();
 }
 
 // Write 'len' color data to TFT 'window' (x1,y2),(x2,y2)
@@ -675,8 +845,11 @@ uint32_t find_rd_speed()
     color_t *color_line = NULL;
     uint8_t *line_rdbuf = NULL;
     uint8_t gs = gray_scale;
+    uint8_t ctg = ct_gray, ctl = ct_lut_active;
 
     gray_scale = 0;
+    ct_gray = 0;
+    ct_lut_active = 0;
     cur_speed = spi_lobo_get_speed(disp_spi);
 
 	color_line = malloc(_width*3);
@@ -726,6 +899,8 @@ uint32_t find_rd_speed()
 
 exit:
     gray_scale = gs;
+    ct_gray = ctg;
+    ct_lut_active = ctl;
 	if (line_rdbuf) free(line_rdbuf);
 	if (color_line) free(color_line);
 
@@ -251,6 +251,29 @@ typedef struct __attribute__((__packed__)) {
 	uint8_t b;
 } color_t ;
 
+// Color transform applied to all color data sent to the display
+// Order: gray scale -> gamma -> tint -> brightness -> invert
+typedef struct {
+	uint8_t grayscale;	// if not 0 convert colors to gray scale
+	uint8_t invert;		// if not 0 invert colors
+	uint8_t brightness;	// 0~255; 255: no change
+	color_t tint;		// per channel multiplier 0~255; {255,255,255}: no tint
+	float   gamma;		// gamma exponent; 0 or 1.0: no gamma correction
+} color_transform_t;
+
+// Draw cost counted in the display send paths
+// 'bus_us' is modeled from the SPI clock, it does not include the time spent packing the data
+typedef struct {
+	uint32_t pixels;		// colors written to display memory
+	uint32_t spi_bytes;		// bytes sent: commands, address windows and color data
+	uint32_t transactions;	// SPI transactions started
+	uint32_t bus_us;		// modeled bus time in microseconds
+	uint32_t pack_cycles;	// CPU cycles packing colors in direct mode, interrupts are disabled meanwhile
+} tft_draw_stats_t;
+
+// Fixed cost of one SPI transaction (DC line, setup) used in the bus time model
+#define TFT_TRANSACTION_NS	1000
+
 // ==== Display commands constants ====
 #define TFT_INVOFF     0x20
 #define TFT_INVONN     0x21
@@ -650,7 +673,7 @@ static const uint8_t Rcmd3[] = {
 // ==== Public functions =========================================================
 
 // == Low level functions; usually not used directly ==
-esp_err_t wait_trans_finish(uint8_t free_line);
+esp_err_t wait_trans_finish();
 void disp_spi_transfer_cmd(int8_t cmd);
 void disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len);
 void drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel);
@@ -660,6 +683,17 @@ int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set
 color_t readPixel(int16_t x, int16_t y);
 int touch_get_data(uint8_t type);
 
+// Set the color transform applied to all color data sent to the display
+// Source color buffers are never modified, the transform is applied while packing the data
+// 'ct' = NULL disables the transform ('gray_scale' still applies)
+//===========================================================
+void TFT_setColorTransform(const color_transform_t *ct);
+
+// Get the draw cost counted since the last reset
+// If 'reset' is not 0 the counters are cleared after reading
+//===========================================================
+void TFT_getDrawStats(tft_draw_stats_t *st, uint8_t reset);
+
 
 // Deactivate display's CS line
 //========================
@@ -0,0 +1,36 @@
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <stdint.h>
+
+#include "tftspi.h"
+
+/*
+ * Linux host build
+ *
+ * The application, the remote handling and tft.c run unchanged on top of
+ * stubs for FreeRTOS, BTstack and the display SPI bus. Time is virtual,
+ * input comes from a script or a capture through wii_replay, and each
+ * frame can be written out as PNG together with its draw cost.
+ */
+
+// Main loop, after each redraw
+void host_frame(void);
+
+// Scheduler, never returns
+void host_scheduler_run(void);
+uint64_t host_clock_ns(void);
+// Host time spent so far by the running task
+uint64_t host_task_ns(void);
+
+// BTstack timers: deadline of the first one, run it if due
+int host_btstack_next(int64_t *when);
+void host_btstack_run(void);
+// Host time spent so far in timer handlers
+uint64_t host_btstack_ns(void);
+
+// Simulated display
+void tft_sim_frame_stats(tft_draw_stats_t *st);
+int tft_sim_png(const char *path);
+
+#endif /* __HOST_H__ */
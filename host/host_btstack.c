@@ -0,0 +1,310 @@
+/*
+ * BTstack on the host
+ *
+ * Run loop timers are kept in a list sorted by deadline and fired by the
+ * scheduler (host_rtos.c) on the virtual clock. Everything that would
+ * talk to the controller is accepted and does nothing.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack.h"
+#include "esp_timer.h"
+
+#include "host.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+static btstack_timer_source_t *timers = NULL; // sorted by timeout
+static uint64_t timer_ns = 0;                 // host time spent in timer handlers
+
+/***************************************************************************
+ * Run loop
+ ***************************************************************************/
+uint32_t btstack_run_loop_get_time_ms(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts, uint32_t timeout_in_ms) {
+    ts->timeout = btstack_run_loop_get_time_ms() + timeout_in_ms;
+}
+
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *_ts)) {
+    ts->process = process;
+}
+
+int btstack_run_loop_remove_timer(btstack_timer_source_t *ts) {
+    btstack_timer_source_t **p;
+
+    for (p = &timers; *p; p = (btstack_timer_source_t **)&(*p)->item.next) {
+        if (*p == ts) {
+            *p = (btstack_timer_source_t *)ts->item.next;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Same deadline: after the timers already added, as BTstack does
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts) {
+    btstack_timer_source_t **p;
+
+    btstack_run_loop_remove_timer(ts);
+    for (p = &timers; *p; p = (btstack_timer_source_t **)&(*p)->item.next) {
+        if ((int32_t)(ts->timeout - (*p)->timeout) < 0) {
+            break;
+        }
+    }
+    ts->item.next = (btstack_linked_item_t *)*p;
+    *p = ts;
+}
+
+int host_btstack_next(int64_t *when) {
+    if (!timers) {
+        return 0;
+    }
+    *when = (int64_t)timers->timeout * 1000;
+    return 1;
+}
+
+// The first timer only, one that re-arms itself with 0 ms runs again next
+void host_btstack_run(void) {
+    btstack_timer_source_t *ts = timers;
+    uint64_t t;
+
+    if (!ts || (int64_t)ts->timeout * 1000 > esp_timer_get_time()) {
+        return;
+    }
+    timers = (btstack_timer_source_t *)ts->item.next;
+    t = host_clock_ns();
+    ts->process(ts);
+    timer_ns += host_clock_ns() - t;
+}
+
+uint64_t host_btstack_ns(void) { return timer_ns; }
+
+/***************************************************************************
+ * Utilities
+ ***************************************************************************/
+uint16_t little_endian_read_16(const uint8_t *buffer, int position) { return buffer[position] | buffer[position + 1] << 8; }
+
+uint32_t little_endian_read_32(const uint8_t *buffer, int position) {
+    return (uint32_t)buffer[position] | (uint32_t)buffer[position + 1] << 8 | (uint32_t)buffer[position + 2] << 16 |
+           (uint32_t)buffer[position + 3] << 24;
+}
+
+void little_endian_store_16(uint8_t *buffer, uint16_t position, uint16_t value) {
+    buffer[position] = value;
+    buffer[position + 1] = value >> 8;
+}
+
+void little_endian_store_32(uint8_t *buffer, uint16_t position, uint32_t value) {
+    little_endian_store_16(buffer, position, value);
+    little_endian_store_16(buffer, position + 2, value >> 16);
+}
+
+uint16_t big_endian_read_16(const uint8_t *buffer, int position) { return buffer[position] << 8 | buffer[position + 1]; }
+
+void big_endian_store_16(uint8_t *buffer, uint16_t position, uint16_t value) {
+    buffer[position] = value >> 8;
+    buffer[position + 1] = value;
+}
+
+void big_endian_store_32(uint8_t *buffer, uint16_t position, uint32_t value) {
+    big_endian_store_16(buffer, position, value >> 16);
+    big_endian_store_16(buffer, position + 2, value);
+}
+
+void reverse_bd_addr(const bd_addr_t src, bd_addr_t dest) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        dest[i] = src[5 - i];
+    }
+}
+
+const char *bd_addr_to_str(const bd_addr_t addr) {
+    static char buf[18];
+    snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+    return buf;
+}
+
+int bd_addr_cmp(const bd_addr_t a, const bd_addr_t b) { return memcmp(a, b, sizeof(bd_addr_t)); }
+
+void bd_addr_copy(bd_addr_t dest, const bd_addr_t src) { memcpy(dest, src, sizeof(bd_addr_t)); }
+
+void printf_hexdump(const void *data, int size) {
+    const uint8_t *d = data;
+    int i;
+    for (i = 0; i < size; i++) {
+        printf("%02X ", d[i]);
+    }
+    printf("\n");
+}
+
+/***************************************************************************
+ * HCI and GAP
+ ***************************************************************************/
+const hci_cmd_t hci_write_authentication_enable = {OPCODE(OGF_CONTROLLER_BASEBAND, 0x20), "1"};
+const hci_cmd_t hci_write_scan_enable = {OPCODE(OGF_CONTROLLER_BASEBAND, 0x1a), "1"};
+const hci_cmd_t hci_write_link_policy_settings = {OPCODE(OGF_LINK_POLICY, 0x0d), "H2"};
+const hci_cmd_t hci_sniff_mode = {OPCODE(OGF_LINK_POLICY, 0x03), "H2222"};
+const hci_cmd_t hci_exit_sniff_mode = {OPCODE(OGF_LINK_POLICY, 0x04), "H"};
+const hci_cmd_t hci_write_page_timeout = {OPCODE(OGF_CONTROLLER_BASEBAND, 0x18), "2"};
+const hci_cmd_t hci_write_class_of_device = {OPCODE(OGF_CONTROLLER_BASEBAND, 0x24), "3"};
+
+int hci_power_control(int mode) {
+    (void)mode;
+    return 0;
+}
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler) { (void)callback_handler; }
+void hci_set_inquiry_mode(int mode) { (void)mode; }
+void hci_set_link_key_db(const btstack_link_key_db_t *link_key_db) { (void)link_key_db; }
+int hci_send_cmd(const hci_cmd_t *cmd, ...) {
+    (void)cmd;
+    return 0;
+}
+int hci_can_send_command_packet_now(void) { return 1; }
+
+void gap_local_bd_addr(bd_addr_t address_buffer) { memset(address_buffer, 0, sizeof(bd_addr_t)); }
+void gap_set_local_name(const char *local_name) { (void)local_name; }
+void gap_set_class_of_device(uint32_t class_of_device) { (void)class_of_device; }
+void gap_set_default_link_policy_settings(uint16_t default_link_policy_settings) { (void)default_link_policy_settings; }
+void gap_ssp_set_enable(int enable) { (void)enable; }
+void gap_connectable_control(uint8_t enable) { (void)enable; }
+void gap_discoverable_control(uint8_t enable) { (void)enable; }
+int gap_inquiry_start(uint8_t duration_in_1280ms_units) {
+    (void)duration_in_1280ms_units;
+    return 0;
+}
+int gap_inquiry_stop(void) { return 0; }
+int gap_remote_name_request(bd_addr_t addr, uint8_t page_scan_repetition_mode, uint16_t clock_offset) {
+    (void)addr;
+    (void)page_scan_repetition_mode;
+    (void)clock_offset;
+    return 0;
+}
+void gap_pin_code_response(bd_addr_t addr, const char *pin) {
+    (void)addr;
+    (void)pin;
+}
+int gap_disconnect(hci_con_handle_t handle) {
+    (void)handle;
+    return 0;
+}
+void gap_drop_link_key_for_bd_addr(bd_addr_t addr) { (void)addr; }
+
+/***************************************************************************
+ * L2CAP, SDP and RFCOMM
+ ***************************************************************************/
+void l2cap_init(void) {}
+uint8_t l2cap_register_service(btstack_packet_handler_t packet_handler, uint16_t psm, uint16_t mtu, int security_level) {
+    (void)packet_handler;
+    (void)psm;
+    (void)mtu;
+    (void)security_level;
+    return ERROR_CODE_SUCCESS;
+}
+uint8_t l2cap_create_channel(btstack_packet_handler_t packet_handler, bd_addr_t address, uint16_t psm, uint16_t mtu, uint16_t *out_local_cid) {
+    (void)packet_handler;
+    (void)address;
+    (void)psm;
+    (void)mtu;
+    (void)out_local_cid;
+    return BTSTACK_MEMORY_ALLOC_FAILED; // nothing to connect to
+}
+void l2cap_accept_connection(uint16_t local_cid) { (void)local_cid; }
+void l2cap_decline_connection(uint16_t local_cid) { (void)local_cid; }
+void l2cap_disconnect(uint16_t local_cid, uint8_t reason) {
+    (void)local_cid;
+    (void)reason;
+}
+int l2cap_send(uint16_t local_cid, uint8_t *data, uint16_t len) {
+    (void)local_cid;
+    (void)data;
+    (void)len;
+    return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+}
+int l2cap_can_send_packet_now(uint16_t local_cid) {
+    (void)local_cid;
+    return 0;
+}
+uint8_t l2cap_request_can_send_now_event(uint16_t local_cid) {
+    (void)local_cid;
+    return L2CAP_LOCAL_CID_DOES_NOT_EXIST;
+}
+
+int des_iterator_init(des_iterator_t *it, uint8_t *element) {
+    (void)element;
+    memset(it, 0, sizeof(des_iterator_t));
+    return 0;
+}
+int des_iterator_has_more(des_iterator_t *it) {
+    (void)it;
+    return 0;
+}
+void des_iterator_next(des_iterator_t *it) { (void)it; }
+de_type_t des_iterator_get_type(des_iterator_t *it) {
+    (void)it;
+    return DE_NIL;
+}
+uint8_t *des_iterator_get_element(des_iterator_t *it) { return it->element; }
+de_type_t de_get_element_type(const uint8_t *header) {
+    (void)header;
+    return DE_NIL;
+}
+uint32_t de_get_data_size(const uint8_t *header) {
+    (void)header;
+    return 0;
+}
+uint32_t de_get_uuid32(const uint8_t *element) {
+    (void)element;
+    return 0;
+}
+int de_element_get_uint16(const uint8_t *element, uint16_t *value) {
+    (void)element;
+    (void)value;
+    return 0;
+}
+const uint8_t *de_get_string(const uint8_t *element) {
+    (void)element;
+    return NULL;
+}
+
+void sdp_init(void) {}
+uint8_t sdp_register_service(const uint8_t *record) {
+    (void)record;
+    return ERROR_CODE_SUCCESS;
+}
+uint32_t sdp_create_service_record_handle(void) { return 0x10001; }
+uint8_t sdp_client_query_uuid16(btstack_packet_handler_t callback, bd_addr_t remote, uint16_t uuid16) {
+    (void)callback;
+    (void)remote;
+    (void)uuid16;
+    return BTSTACK_MEMORY_ALLOC_FAILED;
+}
+void spp_create_sdp_record(uint8_t *service, uint32_t service_record_handle, int rfcomm_channel, const char *name) {
+    (void)service;
+    (void)service_record_handle;
+    (void)rfcomm_channel;
+    (void)name;
+}
+
+void rfcomm_init(void) {}
+uint8_t rfcomm_register_service(btstack_packet_handler_t handler, uint8_t channel, uint16_t max_frame_size) {
+    (void)handler;
+    (void)channel;
+    (void)max_frame_size;
+    return ERROR_CODE_SUCCESS;
+}
+void rfcomm_accept_connection(uint16_t rfcomm_cid) { (void)rfcomm_cid; }
+int rfcomm_send(uint16_t rfcomm_cid, uint8_t *data, uint16_t len) {
+    (void)rfcomm_cid;
+    (void)data;
+    (void)len;
+    return 0;
+}
+uint8_t rfcomm_request_can_send_now_event(uint16_t rfcomm_cid) {
+    (void)rfcomm_cid;
+    return ERROR_CODE_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/*
+ * ESP-IDF services on the host: heap, empty NVS, mute UART, no JPEG decoder
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "driver/uart.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "rom/tjpgd.h"
+
+/***************************************************************************
+ * Heap
+ ***************************************************************************/
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    return malloc(size);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+/***************************************************************************
+ * NVS
+ ***************************************************************************/
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { return ESP_OK; }
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle) {
+    (void)name;
+    (void)open_mode;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u64(nvs_handle handle, const char *key, uint64_t *out_value) {
+    (void)handle;
+    (void)key;
+    (void)out_value;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u64(nvs_handle handle, const char *key, uint64_t value) {
+    (void)handle;
+    (void)key;
+    (void)value;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length) {
+    (void)handle;
+    (void)key;
+    (void)out_value;
+    (void)length;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length) {
+    (void)handle;
+    (void)key;
+    (void)value;
+    (void)length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+    (void)handle;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle) { (void)handle; }
+
+/***************************************************************************
+ * UART
+ ***************************************************************************/
+esp_err_t uart_param_config(int uart_num, const uart_config_t *uart_config) {
+    (void)uart_num;
+    (void)uart_config;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(int uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num) {
+    (void)uart_num;
+    (void)tx_io_num;
+    (void)rx_io_num;
+    (void)rts_io_num;
+    (void)cts_io_num;
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(int uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, void *uart_queue, int intr_alloc_flags) {
+    (void)uart_num;
+    (void)rx_buffer_size;
+    (void)tx_buffer_size;
+    (void)queue_size;
+    (void)uart_queue;
+    (void)intr_alloc_flags;
+    return ESP_OK;
+}
+
+int uart_write_bytes(int uart_num, const char *src, size_t size) {
+    (void)uart_num;
+    (void)src;
+    return size;
+}
+
+/***************************************************************************
+ * JPEG
+ ***************************************************************************/
+JRESULT jd_prepare(JDEC *jd, UINT (*infunc)(JDEC *, BYTE *, UINT), void *pool, UINT sz_pool, void *dev) {
+    (void)jd;
+    (void)infunc;
+    (void)pool;
+    (void)sz_pool;
+    (void)dev;
+    return JDR_PAR;
+}
+
+JRESULT jd_decomp(JDEC *jd, UINT (*outfunc)(JDEC *, void *, JRECT *), BYTE scale) {
+    (void)jd;
+    (void)outfunc;
+    (void)scale;
+    return JDR_PAR;
+}
@@ -0,0 +1,357 @@
+/*
+ * Host build entry point
+ *
+ * Runs the application on the simulated display with scripted input or
+ * a capture recorded on the device (tools/replay_extract.py --write).
+ * Every frame adds a line to the report (draw cost, bus time and the host
+ * time the application and the BTstack timers took), every Nth frame is
+ * written as PNG.
+ *
+ * Script, one report per line, times in ms from the start of the input:
+ *   <ms> <remote> btn A+DOWN      buttons report 0x30, "none" releases all
+ *   <ms> <remote> report 31 00 08 80 80 99   any input report, bytes after 0xa1
+ * '#' starts a comment.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "btstack.h"
+#include "esp_timer.h"
+
+#include "esp32_wiiremote.h"
+#include "host.h"
+#include "wii_replay.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define TAIL_FRAMES 30  // after the input ended
+#define IDLE_FRAMES 300 // without input
+#define LINE_MAX 512
+
+int btstack_main(int argc, const char *argv[]);
+
+static const struct {
+    const char *name;
+    uint16_t mask;
+} buttons[] = {
+    {"2", BTN_2},         {"1", BTN_1},       {"B", BTN_B},         {"A", BTN_A},       {"MINUS", BTN_MINUS}, {"HOME", BTN_HOME},
+    {"LEFT", BTN_LEFT},   {"RIGHT", BTN_RIGHT}, {"DOWN", BTN_DOWN}, {"UP", BTN_UP},     {"PLUS", BTN_PLUS},
+};
+
+// options
+static const char *out_dir = "host_out";
+static const char *report_path = NULL;
+static uint32_t max_frames = 0;
+static uint32_t png_every = 0;
+
+// input, a capture in the wii_replay format
+static uint8_t *input = NULL;
+static uint32_t input_len = 0;
+static uint32_t input_size = 0;
+static uint8_t input_fast = 0;
+static uint32_t input_tail = 0; // frame the input ended
+static uint64_t input_bt_ns;    // BTstack timer time when the input started
+
+// per frame
+static FILE *report;
+static uint32_t frames = 0;
+static uint64_t app_ns;
+static uint64_t bt_ns;
+static uint64_t bus_sum, app_sum, bt_sum, pixels_sum;
+static uint32_t bus_max, app_max, bt_max;
+
+/***************************************************************************
+ * Input
+ ***************************************************************************/
+static void input_add(uint32_t ms, uint8_t idx, const uint8_t *data, uint8_t len) {
+    uint8_t *p;
+
+    if (input_len + 6 + 1 + len > input_size) {
+        input_size = (input_size + 6 + 1 + len) * 2;
+        input = realloc(input, input_size);
+        if (!input) {
+            fprintf(stderr, "host: no memory for the input\n");
+            exit(1);
+        }
+    }
+    p = &input[input_len];
+    little_endian_store_32(p, 0, ms * 1000);
+    p[4] = idx;
+    p[5] = len + 1;
+    p[6] = 0xa1;
+    memcpy(&p[7], data, len);
+    input_len += 6 + 1 + len;
+}
+
+static int parse_buttons(char *s, uint16_t *btn) {
+    char *tok, *save;
+
+    *btn = 0;
+    if (!strcasecmp(s, "none")) {
+        return 1;
+    }
+    if (!strncasecmp(s, "0x", 2)) {
+        *btn = strtoul(s, NULL, 16);
+        return 1;
+    }
+    for (tok = strtok_r(s, "+", &save); tok; tok = strtok_r(NULL, "+", &save)) {
+        size_t i;
+        for (i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+            if (!strcasecmp(tok, buttons[i].name)) {
+                break;
+            }
+        }
+        if (i == sizeof(buttons) / sizeof(buttons[0])) {
+            return 0;
+        }
+        *btn |= buttons[i].mask;
+    }
+    return 1;
+}
+
+static int script_load(const char *path) {
+    char line[LINE_MAX];
+    uint32_t last = 0;
+    int n = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        fprintf(stderr, "host: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    input_size = 4096;
+    input = malloc(input_size);
+    if (!input) {
+        fclose(f);
+        return 0;
+    }
+    memcpy(input, "WRPL", 4);
+    input[4] = WII_REPLAY_VERSION;
+    input_len = WII_REPLAY_HEADER_LEN;
+
+    while (fgets(line, sizeof(line), f)) {
+        char *save, *tok, *kind;
+        uint8_t data[255];
+        uint8_t len = 0;
+        uint32_t ms;
+        unsigned idx;
+
+        n++;
+        if (strchr(line, '#')) {
+            *strchr(line, '#') = 0;
+        }
+        tok = strtok_r(line, " \t\r\n", &save);
+        if (!tok) {
+            continue;
+        }
+        ms = strtoul(tok, NULL, 10);
+        tok = strtok_r(NULL, " \t\r\n", &save);
+        kind = strtok_r(NULL, " \t\r\n", &save);
+        if (!tok || !kind || (idx = strtoul(tok, NULL, 10)) >= WII_MAX_CONTROLLERS || ms < last) {
+            fprintf(stderr, "host: %s:%d: expected '<ms> <remote> btn|report ...' in time order\n", path, n);
+            fclose(f);
+            return 0;
+        }
+        if (!strcmp(kind, "btn")) {
+            uint16_t btn;
+            tok = strtok_r(NULL, " \t\r\n", &save);
+            if (!tok || !parse_buttons(tok, &btn)) {
+                fprintf(stderr, "host: %s:%d: unknown button\n", path, n);
+                fclose(f);
+                return 0;
+            }
+            data[len++] = 0x30;
+            data[len++] = btn >> 8;
+            data[len++] = btn & 0xff;
+        } else if (!strcmp(kind, "report")) {
+            while ((tok = strtok_r(NULL, " \t\r\n", &save)) && len < sizeof(data) - 1) {
+                data[len++] = strtoul(tok, NULL, 16);
+            }
+        } else {
+            fprintf(stderr, "host: %s:%d: unknown kind '%s'\n", path, n, kind);
+            fclose(f);
+            return 0;
+        }
+        input_add(ms, idx, data, len);
+        last = ms;
+    }
+    fclose(f);
+    return 1;
+}
+
+static int capture_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    long len;
+
+    if (!f) {
+        fprintf(stderr, "host: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    input = malloc(len > 0 ? len : 1);
+    if (!input || fread(input, 1, len, f) != (size_t)len || len < WII_REPLAY_HEADER_LEN || memcmp(input, "WRPL", 4) ||
+        input[4] != WII_REPLAY_VERSION) {
+        fprintf(stderr, "host: %s: not a version %d capture\n", path, WII_REPLAY_VERSION);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    input_len = len;
+    return 1;
+}
+
+static uint32_t input_reports(void) {
+    uint32_t pos = WII_REPLAY_HEADER_LEN, n = 0;
+
+    while (pos + 6 <= input_len && pos + 6 + input[pos + 5] <= input_len) {
+        pos += 6 + input[pos + 5];
+        n++;
+    }
+    return n;
+}
+
+/***************************************************************************
+ * Frames
+ ***************************************************************************/
+static void finish(void) {
+    if (report != stdout) {
+        fclose(report);
+    }
+    printf("host: %u frames, bus avg %u max %u us, app avg %u max %u us, bt avg %u max %u us, %u px per frame\n", frames,
+           (uint32_t)(bus_sum / frames), bus_max, (uint32_t)(app_sum / frames), app_max, (uint32_t)(bt_sum / frames), bt_max,
+           (uint32_t)(pixels_sum / frames));
+    exit(0);
+}
+
+// Draw cost and host time since the previous frame, the time spent here is not counted
+void host_frame(void) {
+    tft_draw_stats_t st;
+    uint64_t task = host_task_ns();
+    uint64_t bt = host_btstack_ns();
+    uint32_t app_us = (task - app_ns) / 1000;
+    uint32_t bt_us = (bt - bt_ns) / 1000;
+    char path[256];
+
+    frames++;
+    tft_sim_frame_stats(&st);
+    fprintf(report, "%u,%u,%u,%u,%u,%u,%u,%u\n", frames, (uint32_t)(esp_timer_get_time() / 1000), st.pixels, st.spi_bytes,
+            st.transactions, st.bus_us, app_us, bt_us);
+    bus_sum += st.bus_us;
+    app_sum += app_us;
+    bt_sum += bt_us;
+    pixels_sum += st.pixels;
+    bus_max = (st.bus_us > bus_max) ? st.bus_us : bus_max;
+    app_max = (app_us > app_max) ? app_us : app_max;
+    bt_max = (bt_us > bt_max) ? bt_us : bt_max;
+
+    if (png_every && frames % png_every == 0) {
+        snprintf(path, sizeof(path), "%s/frame_%05u.png", out_dir, frames);
+        if (!tft_sim_png(path)) {
+            fprintf(stderr, "host: cannot write %s\n", path);
+        }
+    }
+
+    if (frames == 1 && input) {
+        wii_replay_start(input, input_len, input_fast);
+        input_bt_ns = host_btstack_ns();
+    }
+    if (input && !input_tail && !wii_replay_active()) {
+        // the reports are handed out in timers, their host time is the replay's cost
+        uint64_t ns = host_btstack_ns() - input_bt_ns;
+        uint32_t n = input_reports();
+        input_tail = frames;
+        printf("host: replay of %u reports, %u us in BTstack timers, %u reports/s\n", n, (uint32_t)(ns / 1000),
+               ns ? (uint32_t)(n * 1000000000ULL / ns) : 0);
+    }
+    if ((max_frames && frames >= max_frames) ||
+        (!max_frames && (input ? input_tail && frames - input_tail >= TAIL_FRAMES : frames >= IDLE_FRAMES))) {
+        finish();
+    }
+    app_ns = host_task_ns();
+    bt_ns = host_btstack_ns();
+}
+
+/***************************************************************************
+ * Entry point
+ ***************************************************************************/
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [--script FILE | --replay FILE [--fast]] [--frames N] [--png N] [--out DIR] [--report FILE]\n"
+            "  --script FILE  input, see host_main.c\n"
+            "  --replay FILE  input from a capture\n"
+            "  --fast         replay as fast as possible instead of at the recorded pace\n"
+            "  --frames N     stop after N frames (default: %u frames after the input, %u without)\n"
+            "  --png N        write every Nth frame to DIR/frame_NNNNN.png\n"
+            "  --out DIR      output directory (default host_out)\n"
+            "  --report FILE  per frame CSV (default DIR/frames.csv, - for stdout)\n",
+            name, TAIL_FRAMES, IDLE_FRAMES);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    char path[256];
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(opt, "--fast")) {
+            input_fast = 1;
+            continue;
+        }
+        if (input && (!strcmp(opt, "--script") || !strcmp(opt, "--replay"))) {
+            usage(argv[0]); // one input only
+        }
+        if (!strcmp(opt, "--script") && arg) {
+            if (!script_load(arg)) {
+                return 1;
+            }
+        } else if (!strcmp(opt, "--replay") && arg) {
+            if (!capture_load(arg)) {
+                return 1;
+            }
+        } else if (!strcmp(opt, "--frames") && arg) {
+            max_frames = strtoul(arg, NULL, 10);
+        } else if (!strcmp(opt, "--png") && arg) {
+            png_every = strtoul(arg, NULL, 10);
+        } else if (!strcmp(opt, "--out") && arg) {
+            out_dir = arg;
+        } else if (!strcmp(opt, "--report") && arg) {
+            report_path = arg;
+        } else {
+            usage(argv[0]);
+        }
+        i++;
+    }
+
+    if (mkdir(out_dir, 0755) && errno != EEXIST) {
+        fprintf(stderr, "host: %s: %s\n", out_dir, strerror(errno));
+        return 1;
+    }
+    if (report_path && !strcmp(report_path, "-")) {
+        report = stdout;
+    } else {
+        if (!report_path) {
+            snprintf(path, sizeof(path), "%s/frames.csv", out_dir);
+            report_path = path;
+        }
+        report = fopen(report_path, "w");
+        if (!report) {
+            fprintf(stderr, "host: %s: %s\n", report_path, strerror(errno));
+            return 1;
+        }
+    }
+    fprintf(report, "frame,time_ms,pixels,spi_bytes,transactions,bus_us,app_us,bt_us\n");
+
+    btstack_main(0, NULL);
+    host_scheduler_run();
+    return 0;
+}
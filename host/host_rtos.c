@@ -0,0 +1,163 @@
+/*
+ * FreeRTOS and esp_timer on the host
+ *
+ * Tasks are ucontext coroutines on one thread. A task runs until it waits,
+ * then the scheduler picks whatever is due first: a BTstack timer, else
+ * the task with the earliest wake time (higher priority on ties). The
+ * virtual clock jumps to that time, so it only advances while every task
+ * waits and a run is repeatable however long the host takes per frame.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+
+#include "host.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define HOST_MAX_TASKS 8
+#define HOST_STACK_SIZE (256 * 1024) // the target sizes are too small for glibc printf
+#define TICK_US (1000000 / configTICK_RATE_HZ)
+
+typedef struct {
+    ucontext_t ctx;
+    TaskFunction_t fn;
+    void *arg;
+    const char *name;
+    UBaseType_t prio;
+    int64_t wake; // virtual us
+    uint64_t host_ns;
+    uint8_t done;
+} host_task_t;
+
+static host_task_t tasks[HOST_MAX_TASKS];
+static int task_count = 0;
+static host_task_t *current = NULL;
+static ucontext_t sched_ctx;
+static uint64_t switch_ns; // host time the current task was switched in
+
+static int64_t now_us = 0;
+
+/***************************************************************************
+ * Clocks
+ ***************************************************************************/
+int64_t esp_timer_get_time(void) { return now_us; }
+
+uint64_t host_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t host_task_ns(void) { return current ? current->host_ns + (host_clock_ns() - switch_ns) : 0; }
+
+/***************************************************************************
+ * Tasks
+ ***************************************************************************/
+static void task_entry(void) {
+    current->fn(current->arg);
+    current->done = 1; // a FreeRTOS task must not return, here it just ends
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle) {
+    host_task_t *t;
+    (void)stack;
+
+    if (task_count == HOST_MAX_TASKS) {
+        return pdFALSE;
+    }
+    t = &tasks[task_count++];
+    t->fn = fn;
+    t->arg = arg;
+    t->name = name;
+    t->prio = prio;
+    t->wake = now_us;
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = malloc(HOST_STACK_SIZE);
+    t->ctx.uc_stack.ss_size = HOST_STACK_SIZE;
+    t->ctx.uc_link = &sched_ctx;
+    if (!t->ctx.uc_stack.ss_sp) {
+        task_count--;
+        return pdFALSE;
+    }
+    makecontext(&t->ctx, task_entry, 0);
+    if (handle) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(now_us / TICK_US); }
+
+static void task_wait(int64_t wake) {
+    assert(current);
+    current->wake = (wake < now_us) ? now_us : wake;
+    swapcontext(&current->ctx, &sched_ctx);
+}
+
+void vTaskDelay(TickType_t ticks) { task_wait(now_us + (int64_t)ticks * TICK_US); }
+
+void vTaskDelayUntil(TickType_t *prev, TickType_t inc) {
+    *prev += inc;
+    task_wait((int64_t)*prev * TICK_US);
+}
+
+BaseType_t xPortGetCoreID(void) { return 0; }
+
+void uxPortCompareSet(volatile uint32_t *addr, uint32_t compare, uint32_t *set) {
+    uint32_t old = *addr;
+    if (old == compare) {
+        *addr = *set;
+    }
+    *set = old;
+}
+
+/***************************************************************************
+ * Scheduler
+ ***************************************************************************/
+static host_task_t *task_next(void) {
+    host_task_t *next = NULL;
+    int i;
+
+    for (i = 0; i < task_count; i++) {
+        host_task_t *t = &tasks[i];
+        if (t->done) {
+            continue;
+        }
+        if (!next || t->wake < next->wake || (t->wake == next->wake && t->prio > next->prio)) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+void host_scheduler_run(void) {
+    for (;;) {
+        host_task_t *t = task_next();
+        int64_t timer;
+
+        if (host_btstack_next(&timer) && (!t || timer <= t->wake)) {
+            now_us = (timer > now_us) ? timer : now_us;
+            host_btstack_run();
+            continue;
+        }
+        if (!t) {
+            fprintf(stderr, "host: no task and no timer left\n");
+            exit(1);
+        }
+        now_us = (t->wake > now_us) ? t->wake : now_us;
+        current = t;
+        switch_ns = host_clock_ns();
+        swapcontext(&sched_ctx, &t->ctx);
+        t->host_ns += host_clock_ns() - switch_ns;
+        current = NULL;
+    }
+}
@@ -0,0 +1,300 @@
+#ifndef __HOST_BTSTACK_H__
+#define __HOST_BTSTACK_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btstack_config.h"
+
+/*
+ * BTstack for the host build
+ *
+ * The run loop timers are real and driven by the virtual clock
+ * (host_btstack.c). There is no radio: HCI, GAP, L2CAP, SDP and RFCOMM
+ * calls are accepted and do nothing, no event is ever delivered, so the
+ * event getters only have to compile. Remotes appear through replayed
+ * reports (wii_replay).
+ */
+
+#define UNUSED(x) (void)(x)
+
+typedef uint8_t bd_addr_t[6];
+typedef uint8_t link_key_t[16];
+typedef uint16_t hci_con_handle_t;
+
+typedef enum {
+    COMBINATION_KEY = 0,
+    LOCAL_UNIT_KEY,
+    REMOTE_UNIT_KEY,
+    DEBUG_COMBINATION_KEY,
+    UNAUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P192,
+    AUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P192,
+    CHANGED_COMBINATION_KEY,
+    UNAUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P256,
+    AUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P256,
+    INVALID_LINK_KEY = 0xffff,
+} link_key_type_t;
+
+typedef void (*btstack_packet_handler_t)(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+typedef struct btstack_linked_item {
+    struct btstack_linked_item *next;
+} btstack_linked_item_t;
+
+typedef struct {
+    btstack_linked_item_t item;
+    btstack_packet_handler_t callback;
+} btstack_packet_callback_registration_t;
+
+/***************************************************************************
+ * Run loop
+ ***************************************************************************/
+typedef struct btstack_timer_source {
+    btstack_linked_item_t item;
+    uint32_t timeout; // ms of btstack_run_loop_get_time_ms()
+    void (*process)(struct btstack_timer_source *ts);
+    void *context;
+} btstack_timer_source_t;
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts, uint32_t timeout_in_ms);
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *_ts));
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts);
+int btstack_run_loop_remove_timer(btstack_timer_source_t *ts);
+uint32_t btstack_run_loop_get_time_ms(void);
+
+/***************************************************************************
+ * Utilities
+ ***************************************************************************/
+uint16_t little_endian_read_16(const uint8_t *buffer, int position);
+uint32_t little_endian_read_32(const uint8_t *buffer, int position);
+void little_endian_store_16(uint8_t *buffer, uint16_t position, uint16_t value);
+void little_endian_store_32(uint8_t *buffer, uint16_t position, uint32_t value);
+uint16_t big_endian_read_16(const uint8_t *buffer, int position);
+void big_endian_store_16(uint8_t *buffer, uint16_t position, uint16_t value);
+void big_endian_store_32(uint8_t *buffer, uint16_t position, uint32_t value);
+void reverse_bd_addr(const bd_addr_t src, bd_addr_t dest);
+const char *bd_addr_to_str(const bd_addr_t addr);
+int bd_addr_cmp(const bd_addr_t a, const bd_addr_t b);
+void bd_addr_copy(bd_addr_t dest, const bd_addr_t src);
+void printf_hexdump(const void *data, int size);
+
+/***************************************************************************
+ * HCI and GAP
+ ***************************************************************************/
+#define HCI_COMMAND_DATA_PACKET 0x01
+#define HCI_ACL_DATA_PACKET 0x02
+#define HCI_SCO_DATA_PACKET 0x03
+#define HCI_EVENT_PACKET 0x04
+#define L2CAP_DATA_PACKET 0x06
+#define RFCOMM_DATA_PACKET 0x07
+
+#define HCI_POWER_OFF 0
+#define HCI_POWER_ON 1
+#define HCI_STATE_WORKING 2
+
+#define ERROR_CODE_SUCCESS 0x00
+#define BTSTACK_MEMORY_ALLOC_FAILED 0x56
+#define BTSTACK_ACL_BUFFERS_FULL 0x57
+#define L2CAP_LOCAL_CID_DOES_NOT_EXIST 0x63
+
+#define INQUIRY_MODE_RSSI_AND_EIR 2
+#define LEVEL_0 0
+#define LEVEL_2 2
+
+#define OPCODE(ogf, ocf) ((ocf) | ((ogf) << 10))
+#define OGF_LINK_CONTROL 0x01
+#define OGF_LINK_POLICY 0x02
+#define OGF_CONTROLLER_BASEBAND 0x03
+
+typedef struct {
+    uint16_t opcode;
+    const char *format;
+} hci_cmd_t;
+
+extern const hci_cmd_t hci_write_authentication_enable;
+extern const hci_cmd_t hci_write_scan_enable;
+extern const hci_cmd_t hci_write_link_policy_settings;
+extern const hci_cmd_t hci_sniff_mode;
+extern const hci_cmd_t hci_exit_sniff_mode;
+extern const hci_cmd_t hci_write_page_timeout;
+extern const hci_cmd_t hci_write_class_of_device;
+
+typedef struct {
+    void *context;
+} btstack_link_key_iterator_t;
+
+typedef struct {
+    void (*open)(void);
+    void (*set_local_bd_addr)(bd_addr_t bd_addr);
+    void (*close)(void);
+    int (*get_link_key)(bd_addr_t bd_addr, link_key_t link_key, link_key_type_t *type);
+    void (*put_link_key)(bd_addr_t bd_addr, link_key_t link_key, link_key_type_t type);
+    void (*delete_link_key)(bd_addr_t bd_addr);
+    int (*iterator_init)(btstack_link_key_iterator_t *it);
+    int (*iterator_get_next)(btstack_link_key_iterator_t *it, bd_addr_t bd_addr, link_key_t link_key, link_key_type_t *type);
+    void (*iterator_done)(btstack_link_key_iterator_t *it);
+} btstack_link_key_db_t;
+
+int hci_power_control(int mode);
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler);
+void hci_set_inquiry_mode(int mode);
+void hci_set_link_key_db(const btstack_link_key_db_t *link_key_db);
+int hci_send_cmd(const hci_cmd_t *cmd, ...);
+int hci_can_send_command_packet_now(void);
+
+void gap_local_bd_addr(bd_addr_t address_buffer);
+void gap_set_local_name(const char *local_name);
+void gap_set_class_of_device(uint32_t class_of_device);
+void gap_set_default_link_policy_settings(uint16_t default_link_policy_settings);
+void gap_ssp_set_enable(int enable);
+void gap_connectable_control(uint8_t enable);
+void gap_discoverable_control(uint8_t enable);
+int gap_inquiry_start(uint8_t duration_in_1280ms_units);
+int gap_inquiry_stop(void);
+int gap_remote_name_request(bd_addr_t addr, uint8_t page_scan_repetition_mode, uint16_t clock_offset);
+void gap_pin_code_response(bd_addr_t addr, const char *pin);
+int gap_disconnect(hci_con_handle_t handle);
+void gap_drop_link_key_for_bd_addr(bd_addr_t addr);
+
+/***************************************************************************
+ * L2CAP, SDP and RFCOMM
+ ***************************************************************************/
+#define BLUETOOTH_PSM_HID_CONTROL 0x11
+#define BLUETOOTH_PSM_HID_INTERRUPT 0x13
+#define BLUETOOTH_PROTOCOL_L2CAP 0x0100
+#define BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE 0x1124
+#define BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST 0x0004
+#define BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS 0x000D
+#define BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST 0x0206
+
+void l2cap_init(void);
+uint8_t l2cap_register_service(btstack_packet_handler_t packet_handler, uint16_t psm, uint16_t mtu, int security_level);
+uint8_t l2cap_create_channel(btstack_packet_handler_t packet_handler, bd_addr_t address, uint16_t psm, uint16_t mtu, uint16_t *out_local_cid);
+void l2cap_accept_connection(uint16_t local_cid);
+void l2cap_decline_connection(uint16_t local_cid);
+void l2cap_disconnect(uint16_t local_cid, uint8_t reason);
+int l2cap_send(uint16_t local_cid, uint8_t *data, uint16_t len);
+int l2cap_can_send_packet_now(uint16_t local_cid);
+uint8_t l2cap_request_can_send_now_event(uint16_t local_cid);
+
+typedef enum { DE_NIL = 0, DE_UINT, DE_INT, DE_UUID, DE_STRING, DE_BOOL, DE_DES, DE_DEA, DE_URL } de_type_t;
+
+typedef struct {
+    uint8_t *element;
+    uint16_t pos;
+    uint16_t length;
+} des_iterator_t;
+
+int des_iterator_init(des_iterator_t *it, uint8_t *element);
+int des_iterator_has_more(des_iterator_t *it);
+void des_iterator_next(des_iterator_t *it);
+de_type_t des_iterator_get_type(des_iterator_t *it);
+uint8_t *des_iterator_get_element(des_iterator_t *it);
+de_type_t de_get_element_type(const uint8_t *header);
+uint32_t de_get_data_size(const uint8_t *header);
+uint32_t de_get_uuid32(const uint8_t *element);
+int de_element_get_uint16(const uint8_t *element, uint16_t *value);
+const uint8_t *de_get_string(const uint8_t *element);
+
+void sdp_init(void);
+uint8_t sdp_register_service(const uint8_t *record);
+uint32_t sdp_create_service_record_handle(void);
+uint8_t sdp_client_query_uuid16(btstack_packet_handler_t callback, bd_addr_t remote, uint16_t uuid16);
+void spp_create_sdp_record(uint8_t *service, uint32_t service_record_handle, int rfcomm_channel, const char *name);
+
+void rfcomm_init(void);
+uint8_t rfcomm_register_service(btstack_packet_handler_t handler, uint8_t channel, uint16_t max_frame_size);
+void rfcomm_accept_connection(uint16_t rfcomm_cid);
+int rfcomm_send(uint16_t rfcomm_cid, uint8_t *data, uint16_t len);
+uint8_t rfcomm_request_can_send_now_event(uint16_t rfcomm_cid);
+
+/***************************************************************************
+ * Events
+ ***************************************************************************/
+#define HCI_EVENT_CONNECTION_COMPLETE 0x03
+#define HCI_EVENT_CONNECTION_REQUEST 0x04
+#define HCI_EVENT_DISCONNECTION_COMPLETE 0x05
+#define HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE 0x07
+#define HCI_EVENT_COMMAND_COMPLETE 0x0E
+#define HCI_EVENT_MODE_CHANGE 0x14
+#define HCI_EVENT_PIN_CODE_REQUEST 0x16
+#define HCI_EVENT_LINK_KEY_NOTIFICATION 0x18
+#define HCI_EVENT_USER_CONFIRMATION_REQUEST 0x33
+#define BTSTACK_EVENT_STATE 0x60
+#define BTSTACK_EVENT_NR_CONNECTIONS_CHANGED 0x61
+#define L2CAP_EVENT_CHANNEL_OPENED 0x70
+#define L2CAP_EVENT_CHANNEL_CLOSED 0x71
+#define L2CAP_EVENT_INCOMING_CONNECTION 0x72
+#define L2CAP_EVENT_CAN_SEND_NOW 0x78
+#define RFCOMM_EVENT_CHANNEL_OPENED 0x80
+#define RFCOMM_EVENT_CHANNEL_CLOSED 0x81
+#define RFCOMM_EVENT_INCOMING_CONNECTION 0x82
+#define RFCOMM_EVENT_CAN_SEND_NOW 0x89
+#define SDP_EVENT_QUERY_COMPLETE 0x91
+#define SDP_EVENT_QUERY_ATTRIBUTE_VALUE 0x93
+#define GAP_EVENT_INQUIRY_RESULT 0xDB
+#define GAP_EVENT_INQUIRY_COMPLETE 0xDC
+
+#define HCI_EVENT_IS_COMMAND_COMPLETE(event, cmd) ((event)[0] == HCI_EVENT_COMMAND_COMPLETE && little_endian_read_16(event, 3) == (cmd).opcode)
+
+static inline uint8_t hci_event_packet_get_type(const uint8_t *event) { return event[0]; }
+
+#define HOST_EVENT_GET(type, name)                                                                                     \
+    static inline type name(const uint8_t *event) {                                                                    \
+        (void)event;                                                                                                   \
+        return 0;                                                                                                      \
+    }
+#define HOST_EVENT_GET_ADDR(name)                                                                                      \
+    static inline void name(const uint8_t *event, bd_addr_t addr) {                                                    \
+        (void)event;                                                                                                   \
+        memset(addr, 0, sizeof(bd_addr_t));                                                                            \
+    }
+
+HOST_EVENT_GET(uint8_t, btstack_event_state_get_state)
+HOST_EVENT_GET(uint8_t, btstack_event_nr_connections_changed_get_number_connections)
+HOST_EVENT_GET_ADDR(gap_event_inquiry_result_get_bd_addr)
+HOST_EVENT_GET(uint8_t, gap_event_inquiry_result_get_page_scan_repetition_mode)
+HOST_EVENT_GET(uint16_t, gap_event_inquiry_result_get_clock_offset)
+HOST_EVENT_GET(uint32_t, gap_event_inquiry_result_get_class_of_device)
+HOST_EVENT_GET(uint8_t, gap_event_inquiry_result_get_rssi_available)
+HOST_EVENT_GET(uint8_t, gap_event_inquiry_result_get_rssi)
+HOST_EVENT_GET(uint8_t, gap_event_inquiry_result_get_name_available)
+HOST_EVENT_GET(uint8_t, gap_event_inquiry_result_get_name_len)
+HOST_EVENT_GET(const uint8_t *, gap_event_inquiry_result_get_name)
+HOST_EVENT_GET_ADDR(hci_event_pin_code_request_get_bd_addr)
+HOST_EVENT_GET(uint8_t, hci_event_disconnection_complete_get_status)
+HOST_EVENT_GET(hci_con_handle_t, hci_event_disconnection_complete_get_connection_handle)
+HOST_EVENT_GET(uint8_t, hci_event_connection_complete_get_status)
+HOST_EVENT_GET(hci_con_handle_t, hci_event_connection_complete_get_connection_handle)
+HOST_EVENT_GET_ADDR(hci_event_connection_complete_get_bd_addr)
+HOST_EVENT_GET_ADDR(hci_event_connection_request_get_bd_addr)
+HOST_EVENT_GET(uint8_t, hci_event_mode_change_get_status)
+HOST_EVENT_GET(hci_con_handle_t, hci_event_mode_change_get_handle)
+HOST_EVENT_GET(uint8_t, hci_event_mode_change_get_mode)
+HOST_EVENT_GET(uint16_t, hci_event_mode_change_get_interval)
+HOST_EVENT_GET(uint16_t, l2cap_event_incoming_connection_get_psm)
+HOST_EVENT_GET(uint16_t, l2cap_event_incoming_connection_get_local_cid)
+HOST_EVENT_GET(hci_con_handle_t, l2cap_event_incoming_connection_get_handle)
+HOST_EVENT_GET_ADDR(l2cap_event_incoming_connection_get_address)
+HOST_EVENT_GET(uint8_t, l2cap_event_channel_opened_get_status)
+HOST_EVENT_GET_ADDR(l2cap_event_channel_opened_get_address)
+HOST_EVENT_GET(hci_con_handle_t, l2cap_event_channel_opened_get_handle)
+HOST_EVENT_GET(uint16_t, l2cap_event_channel_opened_get_psm)
+HOST_EVENT_GET(uint16_t, l2cap_event_channel_opened_get_local_cid)
+HOST_EVENT_GET(uint16_t, l2cap_event_channel_opened_get_remote_cid)
+HOST_EVENT_GET(uint8_t, l2cap_event_channel_opened_get_incoming)
+HOST_EVENT_GET(uint16_t, l2cap_event_channel_closed_get_local_cid)
+HOST_EVENT_GET(uint16_t, l2cap_event_can_send_now_get_local_cid)
+HOST_EVENT_GET(uint16_t, sdp_event_query_attribute_byte_get_attribute_id)
+HOST_EVENT_GET(uint16_t, sdp_event_query_attribute_byte_get_attribute_length)
+HOST_EVENT_GET(uint16_t, sdp_event_query_attribute_byte_get_data_offset)
+HOST_EVENT_GET(uint8_t, sdp_event_query_attribute_byte_get_data)
+HOST_EVENT_GET(uint8_t, sdp_event_query_complete_get_status)
+HOST_EVENT_GET_ADDR(rfcomm_event_incoming_connection_get_bd_addr)
+HOST_EVENT_GET(uint16_t, rfcomm_event_incoming_connection_get_rfcomm_cid)
+HOST_EVENT_GET(uint8_t, rfcomm_event_channel_opened_get_status)
+HOST_EVENT_GET(uint16_t, rfcomm_event_channel_opened_get_rfcomm_cid)
+HOST_EVENT_GET(uint16_t, rfcomm_event_channel_opened_get_max_frame_size)
+
+#endif /* __HOST_BTSTACK_H__ */
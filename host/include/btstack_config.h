@@ -0,0 +1,6 @@
+#ifndef __HOST_BTSTACK_CONFIG_H__
+#define __HOST_BTSTACK_CONFIG_H__
+
+#define ENABLE_CLASSIC
+
+#endif /* __HOST_BTSTACK_CONFIG_H__ */
@@ -0,0 +1,6 @@
+#ifndef __HOST_GPIO_H__
+#define __HOST_GPIO_H__
+
+#include "esp_err.h"
+
+#endif /* __HOST_GPIO_H__ */
@@ -0,0 +1,34 @@
+#ifndef __HOST_UART_H__
+#define __HOST_UART_H__
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/*
+ * Telemetry UART for the host build; nothing is sent
+ */
+
+#define UART_FIFO_LEN 128
+#define UART_PIN_NO_CHANGE (-1)
+
+typedef enum { UART_DATA_8_BITS = 0x3 } uart_word_length_t;
+typedef enum { UART_PARITY_DISABLE = 0x0 } uart_parity_t;
+typedef enum { UART_STOP_BITS_1 = 0x1 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE = 0x0 } uart_hw_flowcontrol_t;
+
+typedef struct {
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t rx_flow_ctrl_thresh;
+} uart_config_t;
+
+esp_err_t uart_param_config(int uart_num, const uart_config_t *uart_config);
+esp_err_t uart_set_pin(int uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num);
+esp_err_t uart_driver_install(int uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, void *uart_queue, int intr_alloc_flags);
+int uart_write_bytes(int uart_num, const char *src, size_t size);
+
+#endif /* __HOST_UART_H__ */
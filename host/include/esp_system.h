@@ -0,0 +1,9 @@
+#ifndef __HOST_ESP_SYSTEM_H__
+#define __HOST_ESP_SYSTEM_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#endif /* __HOST_ESP_SYSTEM_H__ */
@@ -0,0 +1,18 @@
+#ifndef __HOST_TASK_H__
+#define __HOST_TASK_H__
+
+#include "FreeRTOS.h"
+
+#define tskIDLE_PRIORITY 0
+
+#define taskDISABLE_INTERRUPTS()
+#define taskENABLE_INTERRUPTS()
+
+// The task runs when the scheduler is started, not before xTaskCreate() returns
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle);
+TickType_t xTaskGetTickCount(void);
+// Waiting is the only point where another task or a BTstack timer runs
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *prev, TickType_t inc);
+
+#endif /* __HOST_TASK_H__ */
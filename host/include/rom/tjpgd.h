@@ -0,0 +1,50 @@
+#ifndef __HOST_TJPGD_H__
+#define __HOST_TJPGD_H__
+
+#include <stdint.h>
+
+/*
+ * The JPEG decoder lives in the ESP32 ROM; on the host jd_prepare() fails
+ * and TFT_jpg_image() draws nothing
+ */
+
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+typedef uint16_t WORD;
+
+typedef enum {
+    JDR_OK = 0,
+    JDR_INTR,
+    JDR_INP,
+    JDR_MEM1,
+    JDR_MEM2,
+    JDR_PAR,
+    JDR_FMT1,
+    JDR_FMT2,
+    JDR_FMT3,
+} JRESULT;
+
+typedef struct {
+    WORD left, right, top, bottom;
+} JRECT;
+
+typedef struct JDEC JDEC;
+struct JDEC {
+    UINT dctr;
+    BYTE *dptr;
+    BYTE *inbuf;
+    BYTE dmsk;
+    BYTE scale;
+    BYTE msx, msy;
+    BYTE qtid[3];
+    int16_t dcv[3];
+    WORD nrst;
+    WORD width, height;
+    UINT sz_pool;
+    void *device;
+};
+
+JRESULT jd_prepare(JDEC *jd, UINT (*infunc)(JDEC *, BYTE *, UINT), void *pool, UINT sz_pool, void *dev);
+JRESULT jd_decomp(JDEC *jd, UINT (*outfunc)(JDEC *, void *, JRECT *), BYTE scale);
+
+#endif /* __HOST_TJPGD_H__ */
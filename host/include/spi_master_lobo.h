@@ -0,0 +1,91 @@
+#ifndef __HOST_SPI_MASTER_LOBO_H__
+#define __HOST_SPI_MASTER_LOBO_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * SPI bus of the simulated display (tft_sim.c): devices keep their
+ * configuration and clock, which the draw cost model uses
+ */
+
+typedef enum {
+    TFT_SPI_HOST = 0,
+    TFT_HSPI_HOST = 1,
+    TFT_VSPI_HOST = 2,
+} spi_lobo_host_device_t;
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_lobo_bus_config_t;
+
+#define LB_SPI_DEVICE_TXBIT_LSBFIRST (1 << 0)
+#define LB_SPI_DEVICE_RXBIT_LSBFIRST (1 << 1)
+#define LB_SPI_DEVICE_3WIRE (1 << 2)
+#define LB_SPI_DEVICE_POSITIVE_CS (1 << 3)
+#define LB_SPI_DEVICE_HALFDUPLEX (1 << 4)
+#define LB_SPI_DEVICE_CLK_AS_CS (1 << 5)
+
+typedef struct spi_lobo_transaction_t spi_lobo_transaction_t;
+typedef void (*spi_lobo_transaction_cb_t)(spi_lobo_transaction_t *trans);
+
+typedef struct {
+    uint8_t command_bits;
+    uint8_t address_bits;
+    uint8_t dummy_bits;
+    uint8_t mode;
+    uint8_t duty_cycle_pos;
+    uint8_t cs_ena_pretrans;
+    uint8_t cs_ena_posttrans;
+    int clock_speed_hz;
+    int spics_io_num;
+    int spics_ext_io_num;
+    uint32_t flags;
+    spi_lobo_transaction_cb_t pre_cb;
+    spi_lobo_transaction_cb_t post_cb;
+    uint8_t selected;
+} spi_lobo_device_interface_config_t;
+
+struct spi_lobo_transaction_t {
+    uint32_t flags;
+    uint16_t command;
+    uint64_t address;
+    size_t length;
+    size_t rxlength;
+    void *user;
+    union {
+        const void *tx_buffer;
+        uint8_t tx_data[4];
+    };
+    union {
+        void *rx_buffer;
+        uint8_t rx_data[4];
+    };
+};
+
+typedef struct spi_lobo_device_t {
+    spi_lobo_device_interface_config_t cfg;
+    spi_lobo_bus_config_t bus_config;
+    spi_lobo_host_device_t host_dev;
+} spi_lobo_device_t;
+
+typedef spi_lobo_device_t *spi_lobo_device_handle_t;
+
+esp_err_t spi_lobo_bus_add_device(spi_lobo_host_device_t host, spi_lobo_bus_config_t *bus_config, spi_lobo_device_interface_config_t *dev_config,
+                                  spi_lobo_device_handle_t *handle);
+uint32_t spi_lobo_get_speed(spi_lobo_device_handle_t handle);
+uint32_t spi_lobo_set_speed(spi_lobo_device_handle_t handle, uint32_t speed);
+esp_err_t spi_lobo_device_select(spi_lobo_device_handle_t handle, int force);
+esp_err_t spi_lobo_device_deselect(spi_lobo_device_handle_t handle);
+bool spi_lobo_uses_native_pins(spi_lobo_device_handle_t handle);
+esp_err_t spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans);
+
+#endif /* __HOST_SPI_MASTER_LOBO_H__ */
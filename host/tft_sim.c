@@ -0,0 +1,477 @@
+/*
+ * Simulated display for the host build
+ *
+ * Implements the tftspi.h interface on an RGB framebuffer in screen
+ * coordinates, so tft.c draws unchanged. Each path counts the same SPI
+ * transactions and bytes as tftspi.c, the bus time of a frame is the one
+ * the panel would see; only the packing cycles are 0.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "host.h"
+#include "tftspi.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define GS_FACT_R 306
+#define GS_FACT_G 499
+#define GS_FACT_B 219
+#define CT_DMA_BUF_COLORS 256
+#define FILL_MAX_COLORS ((1 << 24) / 24)
+#define FB_SIZE (DEFAULT_TFT_DISPLAY_WIDTH * DEFAULT_TFT_DISPLAY_HEIGHT)
+
+uint8_t gray_scale = 0;
+uint32_t max_rdclock = 8000000;
+int _width = DEFAULT_TFT_DISPLAY_WIDTH;
+int _height = DEFAULT_TFT_DISPLAY_HEIGHT;
+uint8_t tft_disp_type = DEFAULT_DISP_TYPE;
+spi_lobo_device_handle_t disp_spi = NULL;
+spi_lobo_device_handle_t ts_spi = NULL;
+
+static spi_lobo_device_t disp_dev;
+
+static uint8_t ct_gray = 0;
+static uint8_t ct_lut_active = 0;
+static uint8_t ct_lut[3][256];
+
+static color_t fb[FB_SIZE]; // _width per line
+static int win_x1, win_x2, win_y2;
+static int cur_x, cur_y;
+
+static tft_draw_stats_t draw_stats;
+static tft_draw_stats_t frame_stats; // host_frame(), independent of TFT_getDrawStats() resets
+#define DRAW_STAT(_trans, _bytes, _pixels)                                                                             \
+    do {                                                                                                               \
+        draw_stats.transactions += (_trans);                                                                           \
+        draw_stats.spi_bytes += (_bytes);                                                                              \
+        draw_stats.pixels += (_pixels);                                                                                \
+        frame_stats.transactions += (_trans);                                                                          \
+        frame_stats.spi_bytes += (_bytes);                                                                             \
+        frame_stats.pixels += (_pixels);                                                                               \
+    } while (0)
+
+/***************************************************************************
+ * SPI bus
+ ***************************************************************************/
+esp_err_t spi_lobo_bus_add_device(spi_lobo_host_device_t host, spi_lobo_bus_config_t *bus_config, spi_lobo_device_interface_config_t *dev_config,
+                                  spi_lobo_device_handle_t *handle) {
+    disp_dev.host_dev = host;
+    disp_dev.bus_config = *bus_config;
+    disp_dev.cfg = *dev_config;
+    *handle = &disp_dev;
+    return ESP_OK;
+}
+
+uint32_t spi_lobo_get_speed(spi_lobo_device_handle_t handle) { return handle ? handle->cfg.clock_speed_hz : 0; }
+
+uint32_t spi_lobo_set_speed(spi_lobo_device_handle_t handle, uint32_t speed) {
+    if (!handle) {
+        return 0;
+    }
+    handle->cfg.clock_speed_hz = speed;
+    return speed;
+}
+
+esp_err_t spi_lobo_device_select(spi_lobo_device_handle_t handle, int force) {
+    (void)force;
+    return handle ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t spi_lobo_device_deselect(spi_lobo_device_handle_t handle) { return handle ? ESP_OK : ESP_ERR_INVALID_ARG; }
+
+bool spi_lobo_uses_native_pins(spi_lobo_device_handle_t handle) {
+    (void)handle;
+    return false;
+}
+
+// Only display reads come here, read_data() fills the buffer itself
+esp_err_t spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans) {
+    (void)handle;
+    (void)trans;
+    return ESP_OK;
+}
+
+/***************************************************************************
+ * Framebuffer
+ ***************************************************************************/
+static void fb_window(int x1, int x2, int y1, int y2) {
+    win_x1 = x1;
+    win_x2 = x2;
+    win_y2 = y2;
+    cur_x = x1;
+    cur_y = y1;
+}
+
+static void fb_write(color_t color) {
+    if (cur_x >= 0 && cur_x < _width && cur_y >= 0 && cur_y < _height && cur_y <= win_y2) {
+        fb[cur_y * _width + cur_x] = color;
+    }
+    if (++cur_x > win_x2) {
+        cur_x = win_x1;
+        cur_y++;
+    }
+}
+
+static color_t fb_read(void) {
+    color_t color = {0, 0, 0};
+    if (cur_x >= 0 && cur_x < _width && cur_y >= 0 && cur_y < _height) {
+        color = fb[cur_y * _width + cur_x];
+    }
+    if (++cur_x > win_x2) {
+        cur_x = win_x1;
+        cur_y++;
+    }
+    return color;
+}
+
+/***************************************************************************
+ * Display commands
+ ***************************************************************************/
+esp_err_t wait_trans_finish() {
+    return ESP_OK;
+}
+
+esp_err_t disp_select() { return spi_lobo_device_select(disp_spi, 0); }
+
+esp_err_t disp_deselect() { return spi_lobo_device_deselect(disp_spi); }
+
+void disp_spi_transfer_cmd(int8_t cmd) {
+    (void)cmd;
+    DRAW_STAT(1, 1, 0);
+}
+
+void disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len) {
+    uint32_t n;
+    (void)cmd;
+
+    DRAW_STAT(1, 1, 0);
+    if ((len == 0) || (data == NULL)) {
+        return;
+    }
+    while (len) {
+        n = (len > 64) ? 64 : len;
+        DRAW_STAT(1, n, 0);
+        len -= n;
+    }
+}
+
+static void disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
+    fb_window(x1, x2, y1, y2);
+    DRAW_STAT(4, 10, 0);
+}
+
+/***************************************************************************
+ * Color transform
+ ***************************************************************************/
+static inline uint8_t _ct_active() { return (gray_scale | ct_gray | ct_lut_active); }
+
+static inline color_t _ct_color(color_t color) {
+    if (gray_scale | ct_gray) {
+        uint8_t gs = ((GS_FACT_R * color.r) + (GS_FACT_G * color.g) + (GS_FACT_B * color.b)) >> 10;
+        color.r = gs;
+        color.g = gs;
+        color.b = gs;
+    }
+    if (ct_lut_active) {
+        color.r = ct_lut[0][color.r];
+        color.g = ct_lut[1][color.g];
+        color.b = ct_lut[2][color.b];
+    }
+    return color;
+}
+
+void TFT_setColorTransform(const color_transform_t *ct) {
+    if (ct == NULL) {
+        ct_gray = 0;
+        ct_lut_active = 0;
+        return;
+    }
+
+    uint8_t tint[3] = {ct->tint.r, ct->tint.g, ct->tint.b};
+    uint8_t gamma = ((ct->gamma > 0) && (ct->gamma != 1.0));
+    uint8_t scale = (ct->brightness != 255) || (tint[0] != 255) || (tint[1] != 255) || (tint[2] != 255);
+
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            int val = v;
+            if (gamma) {
+                val = (int)((powf(v / 255.0, ct->gamma) * 255.0) + 0.5);
+            }
+            val = (val * tint[c] * ct->brightness + (255 * 255 / 2)) / (255 * 255);
+            if (val > 255) {
+                val = 255;
+            }
+            if (ct->invert) {
+                val = 255 - val;
+            }
+            ct_lut[c][v] = val;
+        }
+    }
+    ct_lut_active = (ct->invert) || gamma || scale;
+    ct_gray = ct->grayscale ? 1 : 0;
+}
+
+/***************************************************************************
+ * Draw statistics
+ ***************************************************************************/
+static uint32_t bus_us(const tft_draw_stats_t *st) {
+    uint32_t clock = (disp_spi) ? spi_lobo_get_speed(disp_spi) : DEFAULT_SPI_CLOCK;
+    if (clock == 0) {
+        clock = DEFAULT_SPI_CLOCK;
+    }
+    return (uint32_t)((((uint64_t)st->spi_bytes * 8 * 1000000) / clock) + (((uint64_t)st->transactions * TFT_TRANSACTION_NS) / 1000));
+}
+
+void TFT_getDrawStats(tft_draw_stats_t *st, uint8_t reset) {
+    *st = draw_stats;
+    st->bus_us = bus_us(st);
+    if (reset) {
+        memset(&draw_stats, 0, sizeof(draw_stats));
+    }
+}
+
+void tft_sim_frame_stats(tft_draw_stats_t *st) {
+    *st = frame_stats;
+    st->bus_us = bus_us(st);
+    memset(&frame_stats, 0, sizeof(frame_stats));
+}
+
+/***************************************************************************
+ * Pixel data
+ ***************************************************************************/
+void drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel) {
+    if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) {
+        return;
+    }
+    if (sel && disp_select()) {
+        return;
+    }
+    disp_spi_transfer_addrwin(x, x + 1, y, y + 1);
+    fb_write(_ct_active() ? _ct_color(color) : color);
+    DRAW_STAT(2, 4, 1);
+    if (sel) {
+        disp_deselect();
+    }
+}
+
+// RAMWR and the data transactions tftspi.c would use for 'len' colors
+static void _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t rep) {
+    uint32_t n;
+
+    if (len == 0) {
+        return;
+    }
+    if (!(disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) {
+        return;
+    }
+    DRAW_STAT(1, 1, len);
+
+    if ((len * 24) <= 512) {
+        DRAW_STAT(1, len * 3, 0);
+    } else if (rep == 0 && _ct_active()) {
+        for (n = len; n; n -= (n > CT_DMA_BUF_COLORS) ? CT_DMA_BUF_COLORS : n) {
+            DRAW_STAT(1, ((n > CT_DMA_BUF_COLORS) ? CT_DMA_BUF_COLORS : n) * 3, 0);
+        }
+    } else if (rep == 0) {
+        DRAW_STAT(1, len * 3, 0);
+    } else {
+        for (n = len; n; n -= (n > FILL_MAX_COLORS) ? FILL_MAX_COLORS : n) {
+            DRAW_STAT(1, ((n > FILL_MAX_COLORS) ? FILL_MAX_COLORS : n) * 3, 0);
+        }
+    }
+
+    if (rep) {
+        color_t c = _ct_active() ? _ct_color(color[0]) : color[0];
+        for (n = 0; n < len; n++) {
+            fb_write(c);
+        }
+    } else {
+        for (n = 0; n < len; n++) {
+            fb_write(_ct_active() ? _ct_color(color[n]) : color[n]);
+        }
+    }
+}
+
+void TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, uint32_t len) {
+    if (disp_select() != ESP_OK) {
+        return;
+    }
+    disp_spi_transfer_addrwin(x1, x2, y1, y2);
+    _TFT_pushColorRep(&color, len, 1);
+    disp_deselect();
+}
+
+void send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf) {
+    disp_spi_transfer_addrwin(x1, x2, y1, y2);
+    _TFT_pushColorRep(buf, len, 0);
+}
+
+int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp) {
+    (void)set_sp;
+
+    memset(buf, 0, len * sizeof(color_t));
+    if (disp_select() != ESP_OK) {
+        return -2;
+    }
+    disp_spi_transfer_addrwin(x1, x2, y1, y2);
+    disp_spi_transfer_cmd(TFT_RAMRD);
+    for (int i = 0; i < len; i++) {
+        color_t c = fb_read();
+        buf[1 + i * 3] = c.r;
+        buf[2 + i * 3] = c.g;
+        buf[3 + i * 3] = c.b;
+    }
+    disp_deselect();
+    return ESP_OK;
+}
+
+color_t readPixel(int16_t x, int16_t y) {
+    uint8_t color_buf[sizeof(color_t) + 1] = {0};
+
+    read_data(x, y, x + 1, y + 1, 1, color_buf, 1);
+    return (color_t){color_buf[1], color_buf[2], color_buf[3]};
+}
+
+/***************************************************************************
+ * Setup
+ ***************************************************************************/
+// Reads from the framebuffer always succeed, the configured clock is kept
+uint32_t find_rd_speed() { return max_rdclock; }
+
+// The panel keeps its memory; tft.c clears the screen after every rotation
+void _tft_setRotation(uint8_t rot) {
+    uint8_t madctl = 0; // only the transfer is counted
+    int tmp;
+
+    if (((rot & 1) && _width < _height) || (!(rot & 1) && _width > _height)) {
+        tmp = _width;
+        _width = _height;
+        _height = tmp;
+    }
+    memset(fb, 0, sizeof(fb));
+    if (disp_select() == ESP_OK) {
+        disp_spi_transfer_cmd_data(TFT_MADCTL, &madctl, 1);
+        disp_deselect();
+    }
+}
+
+void TFT_PinsInit() {}
+
+void TFT_display_init() {
+    _tft_setRotation(PORTRAIT);
+    TFT_pushColorRep(0, 0, _width - 1, _height - 1, (color_t){0, 0, 0}, (uint32_t)(_height * _width));
+}
+
+int touch_get_data(uint8_t type) {
+    (void)type;
+    return 0;
+}
+
+void stmpe610_Init() {}
+
+int stmpe610_get_touch(uint16_t *x, uint16_t *y, uint16_t *z) {
+    (void)x;
+    (void)y;
+    (void)z;
+    return 0;
+}
+
+uint32_t stmpe610_getID() { return 0; }
+
+/***************************************************************************
+ * PNG
+ ***************************************************************************/
+static uint32_t crc_table[256];
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *d, uint32_t len) {
+    if (!crc_table[1]) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            crc_table[n] = c;
+        }
+    }
+    while (len--) {
+        crc = crc_table[(crc ^ *d++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void put_32(FILE *f, uint32_t v) {
+    uint8_t b[4] = {v >> 24, v >> 16, v >> 8, v};
+    fwrite(b, 1, 4, f);
+}
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+    uint32_t crc = crc32_update(0xffffffff, (const uint8_t *)type, 4);
+    crc = crc32_update(crc, data, len) ^ 0xffffffff;
+    put_32(f, len);
+    fwrite(type, 1, 4, f);
+    fwrite(data, 1, len, f);
+    put_32(f, crc);
+}
+
+// Uncompressed deflate blocks; a 160x128 frame is 60 kB
+int tft_sim_png(const char *path) {
+    static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint32_t line = _width * 3 + 1;
+    uint32_t raw_len = line * _height;
+    uint32_t blocks = (raw_len + 0xfffe) / 0xffff;
+    static uint8_t raw[FB_SIZE * 3 + DEFAULT_TFT_DISPLAY_HEIGHT + DEFAULT_TFT_DISPLAY_WIDTH];
+    static uint8_t idat[2 + sizeof(raw) + 5 * (sizeof(raw) / 0xffff + 1) + 4];
+    uint8_t ihdr[13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, 2, 0, 0, 0};
+    uint32_t a = 1, b = 0, pos = 0, i;
+    FILE *f;
+
+    for (int y = 0; y < _height; y++) {
+        raw[y * line] = 0; // no filter
+        memcpy(&raw[y * line + 1], &fb[y * _width], _width * 3);
+    }
+    idat[pos++] = 0x78;
+    idat[pos++] = 0x01;
+    for (i = 0; i < raw_len; i += 0xffff) {
+        uint32_t n = (raw_len - i > 0xffff) ? 0xffff : raw_len - i;
+        idat[pos++] = (i / 0xffff + 1 == blocks);
+        idat[pos++] = n;
+        idat[pos++] = n >> 8;
+        idat[pos++] = ~n;
+        idat[pos++] = ~n >> 8;
+        memcpy(&idat[pos], &raw[i], n);
+        pos += n;
+    }
+    for (i = 0; i < raw_len; i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    idat[pos++] = b >> 8;
+    idat[pos++] = b;
+    idat[pos++] = a >> 8;
+    idat[pos++] = a;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        return 0;
+    }
+    ihdr[0] = _width >> 24;
+    ihdr[1] = _width >> 16;
+    ihdr[2] = _width >> 8;
+    ihdr[3] = _width;
+    ihdr[4] = _height >> 24;
+    ihdr[5] = _height >> 16;
+    ihdr[6] = _height >> 8;
+    ihdr[7] = _height;
+    fwrite(sig, 1, sizeof(sig), f);
+    png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(f, "IDAT", idat, pos);
+    png_chunk(f, "IEND", NULL, 0);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Startup benchmarks
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "TFT_ST7735_SPI.h"
+#include "bench.h"
+#include "wii_motion.h"
+#include "wii_speaker.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define TEXT_RUNS 20
+#define PACK_COLORS 21 // largest direct mode transfer
+#define PACK_RUNS 2000
+#define FILL_RUNS 50
+#define MOTION_ZERO 7950     // gyro zero of the synthetic remote, raw counts
+#define MOTION_YAW_RATE 1800 // 90 deg/s in slow mode
+#define MOTION_DT_US 10000   // 100 reports per second
+#define MOTION_RUNS 1000
+#define ADPCM_RATE 3000 // samples per second
+#define ADPCM_TONE 440  // Hz
+#define ADPCM_LEVEL 8000
+#define CPU_MHZ CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+
+static const char text[] = "Wii Remote 0123456789";
+
+static void bench_text(void);
+static void bench_pack(void);
+static void bench_fill(void);
+static void bench_motion(void);
+static void bench_adpcm(void);
+
+/***************************************************************************
+ * Text
+ ***************************************************************************/
+static void text_run(const char *name) {
+    tft_draw_stats_t st;
+    uint32_t glyphs = TEXT_RUNS * strlen(text);
+    int64_t t;
+    int i;
+
+    TFT_getDrawStats(&st, 1);
+    t = esp_timer_get_time();
+    for (i = 0; i < TEXT_RUNS; i++) {
+        TFT_print((char *)text, 0, (i % 4) * cfont.y_size);
+    }
+    t = esp_timer_get_time() - t;
+    TFT_getDrawStats(&st, 1);
+    printf("Bench text %s: %u us per glyph, %u px per glyph, bus %u us per glyph\n", name, (uint32_t)(t / glyphs),
+           st.pixels / glyphs, st.bus_us / glyphs);
+}
+
+static void bench_text(void) {
+    uint8_t *aa;
+
+    _fg = TFT_WHITE;
+    _bg = TFT_BLACK;
+    TFT_setFont(DEJAVU18_FONT, NULL);
+    text_run("1 bpp");
+    aa = TFT_fontToAA(cfont.font, 1, 4);
+    if (aa) {
+        cfont.font = aa; // same metrics, only the glyph data differs
+        cfont.bpp = 4;
+        text_run("4 bpp");
+        free(aa);
+    }
+    TFT_setFont(DEJAVU12AA_FONT, NULL);
+    text_run("DejaVu12 AA");
+    TFT_setFont(DEFAULT_FONT, NULL);
+}
+
+/***************************************************************************
+ * Direct mode packing
+ ***************************************************************************/
+static void pack_run(const char *name, const color_t *colors, uint8_t rep) {
+    tft_draw_stats_t st;
+    uint32_t px = PACK_RUNS * PACK_COLORS;
+    int64_t t;
+    int i;
+
+    TFT_getDrawStats(&st, 1);
+    t = esp_timer_get_time();
+    if (rep) {
+        for (i = 0; i < PACK_RUNS; i++) {
+            TFT_pushColorRep(0, i % _height, PACK_COLORS - 1, i % _height, colors[0], PACK_COLORS);
+        }
+    } else {
+        disp_select();
+        for (i = 0; i < PACK_RUNS; i++) {
+            send_data(0, i % _height, PACK_COLORS - 1, i % _height, PACK_COLORS, (color_t *)colors);
+        }
+        disp_deselect();
+    }
+    t = esp_timer_get_time() - t;
+    TFT_getDrawStats(&st, 1);
+    printf("Bench pack %s: %u.%02u cycles per pixel with interrupts off, %u ns per pixel, bus %u ns per pixel\n", name,
+           st.pack_cycles / px, st.pack_cycles % px * 100 / px, (uint32_t)(t * 1000 / px), (uint32_t)((uint64_t)st.bus_us * 1000 / px));
+}
+
+static void bench_pack(void) {
+    color_t colors[PACK_COLORS];
+    color_transform_t gray = {.grayscale = 1, .brightness = 255, .tint = {255, 255, 255}};
+    int i;
+
+    for (i = 0; i < PACK_COLORS; i++) {
+        colors[i] = (color_t){i * 12, 255 - i * 12, i * 6};
+    }
+    pack_run("colors", colors, 0);
+    pack_run("repeated", colors, 1);
+    TFT_setColorTransform(&gray);
+    pack_run("grayscale", colors, 0);
+    TFT_setColorTransform(NULL);
+}
+
+/***************************************************************************
+ * Solid fills
+ ***************************************************************************/
+static void bench_fill(void) {
+    static const color_t colors[2] = {{255, 0, 0}, {0, 0, 255}};
+    tft_draw_stats_t st;
+    uint32_t px = FILL_RUNS * _width * _height;
+    int64_t t;
+    int i;
+
+    TFT_getDrawStats(&st, 1);
+    t = esp_timer_get_time();
+    for (i = 0; i < FILL_RUNS; i++) {
+        TFT_fillScreen(colors[i & 1]); // returns when sent; the color changes, so the fill buffer is rewritten each time
+    }
+    t = esp_timer_get_time() - t;
+    TFT_getDrawStats(&st, 1);
+    printf("Bench fill: %u us per screen, %u kpx/s, bus %u us per screen, %u transactions per screen\n", (uint32_t)(t / FILL_RUNS),
+           (uint32_t)(px * 1000LL / t), st.bus_us / FILL_RUNS, st.transactions / FILL_RUNS);
+}
+
+/***************************************************************************
+ * MotionPlus filter
+ ***************************************************************************/
+// MotionPlus bytes of a report, all axes in slow mode
+static void motion_report(uint16_t yaw, uint16_t roll, uint16_t pitch, uint8_t *ext) {
+    ext[0] = yaw & 0xff;
+    ext[1] = roll & 0xff;
+    ext[2] = pitch & 0xff;
+    ext[3] = (yaw >> 8) << 2 | 0x03;
+    ext[4] = (roll >> 8) << 2 | 0x02;
+    ext[5] = (pitch >> 8) << 2 | 0x02;
+}
+
+// The remote lies flat until the gyro zero is measured, then turns at 90 deg/s for 1 s
+static void bench_motion(void) {
+    static wii_motion_state_t st;
+    wii_accel_t accel = {.gz = WII_ACCEL_ONE_G};
+    uint8_t ext[6];
+    int64_t time = 0;
+    int64_t t;
+    int i;
+
+    wii_motion_init(&st);
+    motion_report(MOTION_ZERO, MOTION_ZERO, MOTION_ZERO, ext);
+    for (i = 0; i < 50; i++) {
+        wii_motion_update(&st, ext, &accel, time += MOTION_DT_US);
+    }
+    motion_report(MOTION_ZERO + MOTION_YAW_RATE, MOTION_ZERO, MOTION_ZERO, ext);
+    for (i = 0; i < 1000000 / MOTION_DT_US; i++) {
+        wii_motion_update(&st, ext, &accel, time += MOTION_DT_US);
+    }
+    double yaw = 2 * atan2(st.q[3], st.q[0]) * 180 / M_PI;
+    double norm = sqrt((double)st.q[0] * st.q[0] + (double)st.q[1] * st.q[1] + (double)st.q[2] * st.q[2] + (double)st.q[3] * st.q[3]);
+
+    t = esp_timer_get_time();
+    for (i = 0; i < MOTION_RUNS; i++) {
+        wii_motion_update(&st, ext, &accel, time += MOTION_DT_US);
+    }
+    t = esp_timer_get_time() - t;
+    printf("Bench motion: yaw %.2f deg after 90 deg, |q| %.5f, %u cycles per update\n", yaw, norm / (1 << 30),
+           (uint32_t)(t * CPU_MHZ / MOTION_RUNS));
+}
+
+/***************************************************************************
+ * Speaker ADPCM
+ ***************************************************************************/
+// 1 s of a sine tone through the encoder and back through the speaker's decoder
+static void bench_adpcm(void) {
+    int16_t *pcm = malloc(ADPCM_RATE * sizeof(int16_t));
+    int16_t *out = malloc(ADPCM_RATE * sizeof(int16_t));
+    uint8_t *adpcm = malloc(ADPCM_RATE / 2);
+    wii_adpcm_t st;
+    double signal = 0, noise = 0;
+    int64_t enc, dec;
+    int i;
+
+    if (!pcm || !out || !adpcm) {
+        free(pcm);
+        free(out);
+        free(adpcm);
+        return;
+    }
+    for (i = 0; i < ADPCM_RATE; i++) {
+        pcm[i] = ADPCM_LEVEL * sin(2 * M_PI * ADPCM_TONE * i / ADPCM_RATE);
+    }
+    wii_adpcm_init(&st);
+    enc = esp_timer_get_time();
+    wii_adpcm_encode(&st, pcm, adpcm, ADPCM_RATE);
+    enc = esp_timer_get_time() - enc;
+    wii_adpcm_init(&st);
+    dec = esp_timer_get_time();
+    wii_adpcm_decode(&st, adpcm, out, ADPCM_RATE);
+    dec = esp_timer_get_time() - dec;
+    for (i = 0; i < ADPCM_RATE; i++) {
+        signal += (double)pcm[i] * pcm[i];
+        noise += (double)(pcm[i] - out[i]) * (pcm[i] - out[i]);
+    }
+    printf("Bench adpcm: %d Hz tone at %d Hz, SNR %.1f dB, encode %u cycles per sample, decode %u cycles per sample\n", ADPCM_TONE,
+           ADPCM_RATE, 10 * log10(signal / noise), (uint32_t)(enc * CPU_MHZ / ADPCM_RATE), (uint32_t)(dec * CPU_MHZ / ADPCM_RATE));
+    free(pcm);
+    free(out);
+    free(adpcm);
+}
+
+/***************************************************************************
+ * Entry point
+ ***************************************************************************/
+void bench_run(void) {
+    bench_text();
+    bench_pack();
+    bench_fill();
+    bench_motion();
+    bench_adpcm();
+    TFT_fillScreen(TFT_BLACK);
+}
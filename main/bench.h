@@ -0,0 +1,14 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/*
+ * Startup benchmarks
+ *
+ * Enabled by APP_BENCHMARK in main_loop.c, run once after the display is
+ * initialized and before any remote connects. Times are esp_timer
+ * microseconds, cycles are derived from them at the configured CPU clock.
+ */
+
+void bench_run(void);
+
+#endif /* __BENCH_H__ */
@@ -8,3 +8,6 @@
 #
 CFLAGS += -Wno-format
 
+# Deferred log filters, see wii_log.h
+# CFLAGS += -DWII_LOG_LEVEL=4 -DWII_LOG_MODULES=0x3
+
@@ -41,6 +41,7 @@
  * esp32_wiiremote.c
  */
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 
 #include "btstack.h"
@@ -49,16 +50,28 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
+#include "esp32_wiiremote.h"
+#include "wii_accel.h"
+#include "wii_action.h"
+#include "wii_link_key_db.h"
+#include "wii_log.h"
+#include "wii_motion.h"
+#include "wii_ir.h"
+#include "wii_ext.h"
+#include "wii_rumble.h"
+#include "wii_speaker.h"
+#include "wii_replay.h"
+#include "wii_snoop.h"
+#include "wii_telemetry.h"
+
 /***************************************************************************
  * Definitions and variables
  ***************************************************************************/
-// L2CAP
-static uint16_t l2cap_hid_control_cid;
-static uint16_t l2cap_hid_interrupt_cid;
-
 // HCI
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
@@ -71,30 +84,250 @@ static uint16_t hid_interrupt_psm;
 static uint8_t attribute_value[MAX_ATTRIBUTE_VALUE_SIZE];
 static const unsigned int attribute_value_buffer_size = MAX_ATTRIBUTE_VALUE_SIZE;
 
-// GAP
-#define MAX_DEVICES 1
-enum DEVICE_STATE { REMOTE_NAME_REQUEST, REMOTE_NAME_INQUIRED, REMOTE_NAME_FETCHED };
-struct device {
+// SDP results cached in NVS per device; the descriptor is stored with its actual length
+typedef struct {
+  uint16_t control_psm;
+  uint16_t interrupt_psm;
+  uint16_t descriptor_len;
+  uint8_t descriptor[MAX_ATTRIBUTE_VALUE_SIZE];
+} hid_cache_t;
+#define HID_CACHE_HEADER_SIZE (offsetof(hid_cache_t, descriptor))
+static uint8_t hid_cache_used = 0; // PSMs were taken from the cache, not from SDP
+
+// GAP; connection candidates are saved remotes and Nintendo devices found by inquiry
+#define MAX_CANDIDATES 8
+#define RSSI_UNKNOWN -127
+struct candidate {
   bd_addr_t address;
-  uint8_t pageScanRepetitionMode;
-  uint16_t clockOffset;
-  enum DEVICE_STATE state;
+  int8_t rssi;
+  uint8_t saved;
+  uint8_t fails;        // failed attempts in a row
+  uint32_t next_try_ms; // not tried before this time
 };
-#define INQUIRY_INTERVAL 15
-struct device devices[MAX_DEVICES];
-int deviceCount = 0;
+#define INQUIRY_LENGTH 4 // x 1.28s
+static struct candidate candidates[MAX_CANDIDATES];
+static int candidateCount = 0;
 enum STATE { INIT, ACTIVE };
 enum STATE state = INIT;
 
 // NVS
 static const char *nvs_namespace = "wiiremote";
-static const char *nvs_key = "addr";
-
-// WiiRemote
-static bd_addr_t wii_addr;
-static uint8_t wii_ready = 0;
-static uint16_t wii_btn;
-static uint8_t wii_led = 0;
+static const char *nvs_key = "addr"; // + controller index, without one before multiple remotes
+#define NVS_ADDR_KEY_LEN 8 // "addr" + index + NUL
+#define NVS_ADDR_BLOB_KEY_LEN 14 // prefix + 12 hex digits of bd_addr + NUL
+
+// Report statistics; buttons only reports (0x30) come on changes unless continuous reporting is requested
+#define REPORT_STATS_PRINT_MS 10000 // 0: no periodic print
+#define REPORT_CONTINUOUS 0
+#define REPORT_MODE 0x31        // buttons and accelerometer
+#define REPORT_MODE_IR 0x33     // buttons, accelerometer and extended IR
+#define REPORT_MODE_EXT 0x35    // buttons, accelerometer and 16 extension bytes
+#define REPORT_MODE_IR_EXT 0x37 // buttons, accelerometer, basic IR and 6 extension bytes
+#define BTN_MASK 0x1f9f  // other bits of the button bytes carry accelerometer LSBs
+static btstack_timer_source_t report_stats_timer;
+
+// Link policy; times in baseband slots (0.625 ms)
+#define LINK_IDLE_TIMEOUT_MS 10000 // without input until the link goes to sniff
+#define LINK_CHECK_MS 500
+#define LINK_POLICY_LOW_LATENCY 0x0001 // role switch only
+#define LINK_POLICY_IDLE 0x0005        // role switch and sniff
+#define LINK_FLUSH_TIMEOUT_SLOTS 16    // drop output reports older than 10 ms
+#define LINK_QOS_SERVICE_GUARANTEED 0x02
+#define LINK_QOS_LATENCY_US 5000 // asks for a poll interval <= 5 ms
+#define LINK_SNIFF_MIN_SLOTS 32  // 20 ms
+#define LINK_SNIFF_MAX_SLOTS 80  // 50 ms
+#define LINK_SNIFF_ATTEMPT 4
+#define LINK_SNIFF_TIMEOUT 1
+#define LINK_OP_POLICY 0x01
+#define LINK_OP_EXIT_SNIFF 0x02
+#define LINK_OP_FLUSH 0x04
+#define LINK_OP_QOS 0x08
+#define LINK_OP_SNIFF 0x10
+#define LINK_MODE_ACTIVE 0
+#define LINK_MODE_SNIFF 2
+static btstack_timer_source_t link_timer;
+
+// Published state: a reader retrying this often yields, the writer may be preempted by it
+#define STATE_READ_SPINS 16
+
+// Rumble
+#define RUMBLE_NO_REQUEST 0xff
+static btstack_timer_source_t rumble_timer;
+
+// Input actions; the map is compiled on the BTstack thread when the app sets one
+#define ACTION_POLL_MS 10 // long press and repeat deadlines, map requests
+static btstack_timer_source_t action_timer;
+static wii_action_map_t action_map;
+static const wii_binding_t *volatile action_request;
+static volatile uint8_t action_requested = 0;
+
+// Speaker
+enum SPK_STATE { SPK_OFF, SPK_INIT, SPK_ON };
+enum SPK_REQUEST { SPK_REQ_NONE, SPK_REQ_START, SPK_REQ_STOP };
+#define SPEAKER_TICK_MS 5
+#define SPEAKER_IDLE_MS 50      // request polling while no stream runs
+#define SPEAKER_MAX_BURST 2     // reports per tick when catching up
+#define SPEAKER_MAX_BEHIND 8    // reports; beyond that they are skipped
+#define SPEAKER_CLOCK 6000000   // rate register = clock / sample rate
+#define SPEAKER_FORMAT_ADPCM 0x00
+#define SPK_REG_ENABLE 0xa20009
+#define SPK_REG_CONFIG 0xa20001
+#define SPK_REG_PLAY 0xa20008
+static btstack_timer_source_t speaker_timer;
+static wii_speaker_t *speakers[WII_MAX_CONTROLLERS]; // allocated on first use, kept
+
+// Commands not in every BTstack version
+static const hci_cmd_t link_cmd_write_automatic_flush_timeout = {OPCODE(OGF_CONTROLLER_BASEBAND, 0x28), "H2"};
+static const hci_cmd_t link_cmd_qos_setup = {OPCODE(OGF_LINK_POLICY, 0x07), "H114444"};
+
+// Connection manager
+#define CONNECTION_BACKOFF_MIN_MS 250
+#define CONNECTION_BACKOFF_MAX_MS 16000
+#define CONNECTION_BACKOFF_CONNECTED_MAX_MS 60000 // while playing, search rarely
+#define CONNECTION_ATTEMPT_TIMEOUT_MS 20000
+#define CONNECTION_INQUIRY_TIMEOUT_MS (INQUIRY_LENGTH * 1280 + 2000)
+// MotionPlus activation
+enum MP_STATE { MP_NONE, MP_INIT, MP_ACTIVATE, MP_ACTIVE, MP_ABSENT };
+#define MP_REG_INIT 0xa600f0
+#define MP_REG_ACTIVATE 0xa600fe
+#define MP_MODE_STANDALONE 0x04
+
+// IR camera
+enum IR_STATE { IR_NONE, IR_INIT, IR_ACTIVE, IR_FAILED };
+#define IR_MODE_BASIC 0x01    // 10 bytes, fits report 0x37 beside MotionPlus
+#define IR_MODE_EXTENDED 0x03 // 12 bytes with dot sizes, report 0x33
+#define IR_REG_MODE 0xb00033
+static const struct {
+  uint32_t addr;
+  uint8_t len;
+  uint8_t data[9];
+} ir_init_writes[] = {
+    {0xb00030, 1, {0x08}},                                                 // enable register writes
+    {0xb00000, 9, {0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0xaa, 0x00, 0x64}}, // sensitivity block 1
+    {0xb0001a, 2, {0x63, 0x03}},                                           // sensitivity block 2
+    {IR_REG_MODE, 1, {0}},                                                 // mode, filled in by ir_start()
+    {0xb00030, 1, {0x08}},
+};
+#define IR_INIT_WRITES (sizeof(ir_init_writes) / sizeof(ir_init_writes[0]))
+
+// Extension controllers
+enum EXT_STATE { EXT_NONE, EXT_INIT, EXT_READ_ID, EXT_ACTIVE, EXT_FAILED };
+#define EXT_REG_INIT1 0xa400f0
+#define EXT_REG_INIT2 0xa400fb
+#define EXT_REG_ID 0xa400fa
+#define EXT_READ_TIMEOUT_MS 500 // the ID read is sent again if not answered by then
+#define EXT_READ_RETRIES 2
+
+// Register writes (0x16); acks (0x22) come back in order and match the oldest write in flight
+#define WRITE_QUEUE_LEN 16
+#define WRITE_WINDOW 4  // writes in flight
+#define WRITE_RETRIES 2 // per write, before its sequence fails
+#define WRITE_ACK_TIMEOUT_MS 500 // a missing ack counts as an error ack
+#define WRITE_ACK_CHECK_MS 100
+#define WRITE_ACK_TIMEOUT 0xff   // error passed on for a missing ack
+typedef void (*reg_write_done_t)(int idx, uint8_t error);
+
+// Output reports L2CAP cannot take right away wait here for L2CAP_EVENT_CAN_SEND_NOW
+#define OUT_QUEUE_LEN 8
+#define OUT_REPORT_MAX 23 // 0xa2, id, 21 bytes of register write or speaker data
+typedef struct {
+  uint32_t addr;
+  uint8_t len;
+  uint8_t data[16];
+  uint8_t tries;
+  reg_write_done_t done; // set on the last write of a sequence
+} reg_write_t;
+static btstack_timer_source_t write_timer;
+
+enum CONNECTION_STATE { CONN_IDLE, CONN_WAIT, CONN_PAGING, CONN_INQUIRY } connection_state = CONN_IDLE;
+static btstack_timer_source_t connection_timer;
+static uint32_t connection_backoff_ms = CONNECTION_BACKOFF_MIN_MS;
+static uint8_t inquiry_due = 0; // page saved remotes first
+static uint8_t inquiry_found = 0;
+static int conn_cand = -1; // candidate of the outgoing connection attempt
+
+// WiiRemote controllers; a slot is in use from connection attempt until disconnection
+typedef struct {
+  uint8_t in_use;
+  uint8_t ready;
+  uint8_t replay; // fed from a capture, nothing is sent
+  bd_addr_t addr;
+  uint16_t control_cid;
+  uint16_t interrupt_cid;
+  uint16_t btn;
+  volatile uint8_t led; // set by the app
+  uint8_t led_sent;      // sent by the BTstack thread
+  hci_con_handle_t handle;
+  // connection phase timestamps (us), 0 if the phase was skipped
+  int64_t t_start;
+  int64_t t_page;
+  int64_t t_sdp_start;
+  int64_t t_sdp_end;
+  int64_t t_l2cap_start;
+  uint8_t first_report_pending;
+  wii_connect_timing_t timing;
+  wii_report_stats_t stats;
+  int64_t last_report;
+  wii_accel_state_t accel;
+  uint8_t mp_state;
+  wii_motion_state_t motion;
+  uint8_t ir_state;
+  uint8_t ir_mode;
+  wii_ir_state_t ir;
+  uint8_t ext_present; // from the last status report
+  uint8_t ext_state;
+  uint8_t ext_tries;    // ID reads sent again
+  int64_t ext_deadline; // the ID read is answered by then
+  wii_ext_t ext;
+  wii_rumble_state_t rumble;
+  volatile uint32_t rumble_request; // pattern set by the app, RUMBLE_NO_REQUEST when taken
+  wii_action_state_t action;
+  // published state, written by the BTstack thread only; odd pub_seq while a copy is under way.
+  // Kept together, controller_release() clears around them
+  volatile uint32_t pub_seq;
+  wii_state_t pub;
+  uint8_t spk_state;
+  volatile uint32_t spk_request; // set by the app, taken with controller_take_request()
+  uint16_t spk_rate;
+  uint8_t spk_volume;
+  int64_t spk_t0;    // stream start
+  uint32_t spk_sent; // reports since spk_t0, including skipped ones
+  // register writes, oldest first
+  reg_write_t writes[WRITE_QUEUE_LEN];
+  uint8_t write_head;
+  uint8_t write_count;
+  uint8_t write_sent;  // from the head, awaiting their ack
+  uint8_t write_stale; // acks of writes that are sent again after a retry
+  int64_t write_deadline; // the next ack is due by then, 0 if none is awaited
+  // output reports waiting for L2CAP, oldest first
+  uint8_t out[OUT_QUEUE_LEN][OUT_REPORT_MAX];
+  uint8_t out_len[OUT_QUEUE_LEN];
+  uint8_t out_head;
+  uint8_t out_count;
+  // link policy
+  uint8_t link_profile;          // WII_LINK_LOW_LATENCY or WII_LINK_IDLE in effect
+  volatile uint8_t link_request; // set by the app, WII_LINK_AUTO for automatic
+  uint8_t link_mode;             // from mode change events
+  uint8_t link_ops;              // LINK_OP_ commands still to send
+  uint8_t link_tuned;            // flush timeout and QoS were sent
+  int64_t last_input;
+} wii_controller_t;
+static wii_controller_t controllers[WII_MAX_CONTROLLERS];
+static int conn_idx = -1; // controller of the outgoing connection attempt
+
+// Saved addresses, one per controller index so that remotes keep their player number
+static bd_addr_t saved_addr[WII_MAX_CONTROLLERS];
+static uint8_t saved_valid[WII_MAX_CONTROLLERS];
+static uint8_t saved_loaded = 0;
+
+// L2CAP cid -> controller index, open addressing
+#define CID_MAP_SIZE 16 // power of 2, more than two channels per controller
+#define CID_MAP_EMPTY -1
+#define CID_MAP_DELETED -2
+static struct {
+  uint16_t cid;
+  int8_t idx;
+} cid_map[CID_MAP_SIZE];
 
 /***************************************************************************
  * Prototypes
@@ -104,28 +337,98 @@ static void main_loop_task(void *pvParameter);
 
 static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 static void sdp_query_result_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
-static void hid_report_handler(const uint8_t *report, uint16_t report_len);
-
-static void gap_scan_start(void);
-static int gap_has_more_remote_name_requests(void);
-static void gap_continue_remote_names(void);
-static void gap_do_next_remote_name_request(void);
-static int gap_getDeviceIndexForAddress(bd_addr_t addr);
+static void hid_report_handler(int idx, const uint8_t *report, uint16_t report_len, int64_t now);
+static uint8_t hid_send(int idx, uint8_t *report, uint16_t len);
+static void hid_send_queued(int idx);
+static void hid_set_report_mode(int idx);
+static void hid_request_status(int idx);
+static void hid_read(int idx, uint8_t space, uint32_t addr, uint16_t len);
+static void hid_write_register(int idx, uint32_t addr, const uint8_t *data, uint8_t len);
+static uint8_t reg_write(int idx, uint32_t addr, const uint8_t *data, uint8_t len, reg_write_done_t done);
+static void reg_write_run(int idx);
+static void reg_write_pop(int idx);
+static void reg_write_ack(int idx, uint8_t error);
+static void write_timer_handler(btstack_timer_source_t *ts);
+static void motion_start(int idx);
+static void motion_write_done(int idx, uint8_t error);
+static void ir_start(int idx);
+static void ir_check_mode(int idx);
+static void ir_write_done(int idx, uint8_t error);
+static void ext_status(int idx, uint8_t present);
+static void ext_start(int idx);
+static void ext_init_done(int idx, uint8_t error);
+static void ext_read_id(int idx);
+static void ext_read_timeout(int idx, int64_t now);
+static void ext_read_done(int idx, const uint8_t *report, uint16_t report_len);
+static void ext_data(int idx, const uint8_t *data);
+static uint8_t ext_bytes_wanted(int idx);
+static void accel_start(int idx);
+static void accel_read_done(int idx, const uint8_t *report, uint16_t report_len);
+static void report_stats_update(int idx, int64_t now);
+static void report_stats_print(int idx);
+static void report_stats_timer_handler(btstack_timer_source_t *ts);
+
+static void link_set_profile(int idx, uint8_t profile);
+static void link_run(void);
+static void link_timer_handler(btstack_timer_source_t *ts);
+static void rumble_timer_handler(btstack_timer_source_t *ts);
+static void action_input(int idx, int64_t now);
+static void action_timer_handler(btstack_timer_source_t *ts);
+static void state_publish(int idx, int64_t now);
+static void state_clear(int idx);
+static uint32_t state_read(int idx, void *dst, size_t offset, size_t len);
+static void speaker_start(int idx);
+static void speaker_init_done(int idx, uint8_t error);
+static void speaker_stop(int idx);
+static void speaker_pump(int idx);
+static void speaker_timer_handler(btstack_timer_source_t *ts);
+static void replay_report(uint8_t idx, const uint8_t *report, uint16_t len, int64_t time);
+static void replay_done(void);
+
+static void cid_map_init(void);
+static void cid_map_add(uint16_t cid, int idx);
+static void cid_map_remove(uint16_t cid);
+static inline int cid_map_find(uint16_t cid);
+
+static int controller_find(bd_addr_t addr);
+static int controller_alloc(bd_addr_t addr);
+static void controller_release(int idx);
+static void controller_ready(int idx);
+static int controller_free_slots(void);
+static uint32_t controller_take_request(volatile uint32_t *request, uint32_t none);
+
+static int candidate_find(bd_addr_t addr);
+static int candidate_add(bd_addr_t addr, int8_t rssi, uint8_t saved);
+static void candidate_load_saved(void);
+static int candidate_best(void);
 
 static esp_err_t nvs_init();
 static uint64_t nvs_read_u64(const char *namespace, const char *key);
 static uint64_t nvs_write_u64(const char *namespace, const char *key, uint64_t val);
+static esp_err_t nvs_read_blob(const char *namespace, const char *key, void *buf, size_t *len);
+static esp_err_t nvs_write_blob(const char *namespace, const char *key, const void *buf, size_t len);
+
+static void nvs_addr_key(char prefix, bd_addr_t addr, char *key);
+static esp_err_t hid_cache_load(bd_addr_t addr);
+static void hid_cache_save(bd_addr_t addr);
+static void hid_sdp_query(void);
 
 static void connection_start(void);
-static esp_err_t connection_try_saved(void);
-static esp_err_t connection_try_listed(void);
-static void connection_lost(void);
+static void connection_schedule(uint32_t ms);
+static void connection_timer_handler(btstack_timer_source_t *ts);
+static void connection_step(void);
+static void connection_try(int cand);
+static void connection_inquiry_complete(void);
+static void connection_succeeded(void);
+static void connection_failed(void);
+static void connection_lost(int idx);
 
 // Main loop
 void setup(void);
-void loop(uint16_t btn, uint16_t pressed, uint16_t released);
-void wii_connected(void);
-void wii_disconnected(void);
+void loop(uint8_t idx, uint16_t btn, uint16_t pressed, uint16_t released);
+void frame(void);
+void wii_connected(uint8_t idx);
+void wii_disconnected(uint8_t idx);
 
 /***************************************************************************
  * Entry point
@@ -134,9 +437,27 @@ int btstack_main(int argc, const char *argv[]) {
   (void)argc;
   (void)argv;
 
+  wii_log_init();
+  wii_snoop_init();
+  cid_map_init();
+  wii_replay_init(replay_report, replay_done);
+
   // Initialize L2CAP
   l2cap_init();
 
+  // Controller state stream over UART and SPP
+  wii_telemetry_init();
+
+  // Accept HID channels opened by a bonded remote
+  l2cap_register_service(packet_handler, BLUETOOTH_PSM_HID_CONTROL, 48, LEVEL_0);
+  l2cap_register_service(packet_handler, BLUETOOTH_PSM_HID_INTERRUPT, 48, LEVEL_0);
+
+  // Keep link keys in NVS, the remote authenticates with it when reconnecting by itself
+  hci_set_link_key_db(wii_link_key_db_nvs_instance());
+
+  // Page scan, so that the remote can connect to us
+  gap_connectable_control(1);
+
   // enabled EIR
   hci_set_inquiry_mode(INQUIRY_MODE_RSSI_AND_EIR);
 
@@ -144,9 +465,35 @@ int btstack_main(int argc, const char *argv[]) {
   hci_event_callback_registration.callback = &packet_handler;
   hci_add_event_handler(&hci_event_callback_registration);
 
-  // Disable stdout buffering
+  // Disable stdout buffering, hot paths log through wii_log
   setbuf(stdout, NULL);
 
+  btstack_run_loop_set_timer_handler(&link_timer, &link_timer_handler);
+  btstack_run_loop_set_timer(&link_timer, LINK_CHECK_MS);
+  btstack_run_loop_add_timer(&link_timer);
+
+  btstack_run_loop_set_timer_handler(&rumble_timer, &rumble_timer_handler);
+  btstack_run_loop_set_timer(&rumble_timer, WII_RUMBLE_TICK_MS);
+  btstack_run_loop_add_timer(&rumble_timer);
+
+  btstack_run_loop_set_timer_handler(&action_timer, &action_timer_handler);
+  btstack_run_loop_set_timer(&action_timer, ACTION_POLL_MS);
+  btstack_run_loop_add_timer(&action_timer);
+
+  btstack_run_loop_set_timer_handler(&write_timer, &write_timer_handler);
+  btstack_run_loop_set_timer(&write_timer, WRITE_ACK_CHECK_MS);
+  btstack_run_loop_add_timer(&write_timer);
+
+  btstack_run_loop_set_timer_handler(&speaker_timer, &speaker_timer_handler);
+  btstack_run_loop_set_timer(&speaker_timer, SPEAKER_IDLE_MS);
+  btstack_run_loop_add_timer(&speaker_timer);
+
+#if REPORT_STATS_PRINT_MS
+  btstack_run_loop_set_timer_handler(&report_stats_timer, &report_stats_timer_handler);
+  btstack_run_loop_set_timer(&report_stats_timer, REPORT_STATS_PRINT_MS);
+  btstack_run_loop_add_timer(&report_stats_timer);
+#endif
+
   // Turn on the device
   hci_power_control(HCI_POWER_ON);
 
@@ -158,25 +505,31 @@ int btstack_main(int argc, const char *argv[]) {
 /***************************************************************************
  * LOOP
  ***************************************************************************/
-static uint16_t btn_last = 0;
-static uint16_t btn_pressed;
-static uint16_t btn_released;
+static uint16_t btn_last[WII_MAX_CONTROLLERS];
 static void main_loop_task(void *pvParameter) {
+  uint16_t btn, btn_pressed, btn_released;
+  int i;
+
   setup();
   for (;;) {
-    btn_pressed = (~btn_last) & wii_btn;
-    btn_released = btn_last & (~wii_btn);
-    btn_last = wii_btn;
-    loop(wii_btn, btn_pressed, btn_released);
+    for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+      if (!controllers[i].ready) {
+        btn_last[i] = 0;
+        continue;
+      }
+      btn = wii_getButton(i);
+      btn_pressed = (~btn_last[i]) & btn;
+      btn_released = btn_last[i] & (~btn);
+      btn_last[i] = btn;
+      loop(i, btn, btn_pressed, btn_released);
+    }
+    frame();
   }
 }
 
 /***************************************************************************
  * BT functions
  ***************************************************************************/
-static uint16_t rfcomm_channel_id;
-static char lineBuffer[30];
-
 // Packet Handler
 static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
   /* LISTING_PAUSE */
@@ -188,6 +541,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
   bd_addr_t addr;
   int i;
   int index;
+  int idx;
 
   /* LISTING_RESUME */
   switch (packet_type) {
@@ -196,6 +550,8 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
   // HCI EVENT
   // ********************************************************************************
   case HCI_EVENT_PACKET:
+    wii_snoop_hci_event(packet, size);
+    link_run(); // a command slot may have become free
     event = hci_event_packet_get_type(packet);
     switch (event) {
     /* @text When BTSTACK_EVENT_STATE with state HCI_STATE_WORKING
@@ -203,7 +559,6 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
      */
     case BTSTACK_EVENT_STATE:
       if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
-        // gap_scan_start();
         connection_start();
       }
       break;
@@ -213,8 +568,18 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
     // ********************************************************************************
     case BTSTACK_EVENT_NR_CONNECTIONS_CHANGED:
       if (!btstack_event_nr_connections_changed_get_number_connections(packet)) {
-        printf("NR connection becomes 0\n");
-        connection_lost();
+        WII_LOGI(BT, "NR connection becomes 0");
+        // an attempt in progress fails by its own events or timeout
+        index = 0;
+        for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+          if (controllers[i].in_use && i != conn_idx) {
+            controller_release(i);
+            index = 1;
+          }
+        }
+        if (index) {
+          connection_start();
+        }
       }
       break;
 
@@ -222,87 +587,58 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
     // GAP
     // ********************************************************************************
     case GAP_EVENT_INQUIRY_RESULT:
-      if (deviceCount >= MAX_DEVICES) {
-        printf("Device found: %s but deviceCount(%d)>=MAX_DEVICES(%d)\n", bd_addr_to_str(addr), deviceCount, MAX_DEVICES);
-        break; // already full
-      }
       gap_event_inquiry_result_get_bd_addr(packet, addr);
-      index = gap_getDeviceIndexForAddress(addr);
-      if (index >= 0) {
-        printf("Device found: %s but already in our list\n", bd_addr_to_str(addr));
-        break; // already in our list
-      }
-
       if (!(addr[0] == 0xB8 && addr[1] == 0xAE && addr[2] == 0x6E)) {
-        printf("Device found: %s but not a Nintendo\n", bd_addr_to_str(addr));
+        WII_LOGD(BT, "Device found: " WII_LOG_ADDR_FMT " but not a Nintendo", WII_LOG_ADDR(addr));
         break; // not a Nintenoo
       }
 
-      /* Copy a discovered device into devices[] */
-      memcpy(devices[deviceCount].address, addr, 6);
-      devices[deviceCount].pageScanRepetitionMode = gap_event_inquiry_result_get_page_scan_repetition_mode(packet);
-      devices[deviceCount].clockOffset = gap_event_inquiry_result_get_clock_offset(packet);
       // print info
-      printf("Device found: %s ", bd_addr_to_str(addr));
-      printf("with COD: 0x%06x, ", (unsigned int)gap_event_inquiry_result_get_class_of_device(packet));
-      printf("pageScan %d, ", devices[deviceCount].pageScanRepetitionMode);
-      printf("clock offset 0x%04x", devices[deviceCount].clockOffset);
+      int8_t rssi = RSSI_UNKNOWN;
       if (gap_event_inquiry_result_get_rssi_available(packet)) {
-        printf(", rssi %d dBm", (int8_t)gap_event_inquiry_result_get_rssi(packet));
+        rssi = (int8_t)gap_event_inquiry_result_get_rssi(packet);
       }
-      if (gap_event_inquiry_result_get_name_available(packet)) {
-        char name_buffer[240];
-        int name_len = gap_event_inquiry_result_get_name_len(packet);
-        memcpy(name_buffer, gap_event_inquiry_result_get_name(packet), name_len);
-        name_buffer[name_len] = 0;
-        printf(", name '%s'", name_buffer);
-        devices[deviceCount].state = REMOTE_NAME_FETCHED;
-        ;
-      } else {
-        devices[deviceCount].state = REMOTE_NAME_REQUEST;
+      WII_LOGI(BT, "Device found: " WII_LOG_ADDR_FMT " with COD: 0x%06x, rssi %d dBm", WII_LOG_ADDR(addr),
+               gap_event_inquiry_result_get_class_of_device(packet), rssi);
+
+      if (candidate_find(addr) < 0 && controller_find(addr) < 0) {
+        inquiry_found = 1;
       }
-      printf("\n");
-      deviceCount++;
+      candidate_add(addr, rssi, 0);
       break;
 
     case GAP_EVENT_INQUIRY_COMPLETE:
-      for (i = 0; i < deviceCount; i++) {
-        // retry remote name request
-        if (devices[i].state == REMOTE_NAME_INQUIRED) {
-          devices[i].state = REMOTE_NAME_REQUEST;
-        }
-      }
-      gap_continue_remote_names();
+      connection_inquiry_complete();
       break;
 
     // ********************************************************************************
     // HCI
     // ********************************************************************************
-    case HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE:
-      reverse_bd_addr(&packet[3], addr);
-      index = gap_getDeviceIndexForAddress(addr);
-      if (index >= 0) {
-        if (packet[2] == 0) {
-          printf("Name: '%s'\n", &packet[9]);
-          devices[index].state = REMOTE_NAME_FETCHED;
-        } else {
-          printf("Failed to get name: page timeout\n");
-        }
+    case HCI_EVENT_CONNECTION_COMPLETE:
+      hci_event_connection_complete_get_bd_addr(packet, addr);
+      idx = controller_find(addr);
+      if (idx < 0) {
+        break;
+      }
+      if (!controllers[idx].t_page) {
+        controllers[idx].t_page = esp_timer_get_time();
+      }
+      status = hci_event_connection_complete_get_status(packet);
+      if (status && idx == conn_idx) {
+        WII_LOGW(BT, "Page " WII_LOG_ADDR_FMT " failed: 0x%02x", WII_LOG_ADDR(addr), status);
+        connection_failed();
       }
-      gap_continue_remote_names();
       break;
 
     /* LISTING_PAUSE */
     case HCI_EVENT_PIN_CODE_REQUEST:
       // inform about pin code request
-      printf("Pin code request - sending reverse addr as pin\n");
       hci_event_pin_code_request_get_bd_addr(packet, event_addr);
-      printf("BD-ADDR: %s\n", bd_addr_to_str(event_addr));
       bd_addr_t local;
       gap_local_bd_addr(local);
-      printf("LOCAL-ADDR: %s\n", bd_addr_to_str(local));
       reverse_bd_addr(local, addr);
-      printf("PIN: %s\n", bd_addr_to_str(addr));
+      WII_LOGI(BT, "Pin code request from " WII_LOG_ADDR_FMT " - sending reverse addr " WII_LOG_ADDR_FMT " as pin",
+               WII_LOG_ADDR(event_addr), WII_LOG_ADDR(addr));
       char pin[7];
       memcpy(pin, addr, 6);
       pin[6] = 0u;
@@ -311,88 +647,136 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
 
     case HCI_EVENT_USER_CONFIRMATION_REQUEST:
       // inform about user confirmation request
-      printf("SSP User Confirmation Request with numeric value '%" PRIu32 "'\n", little_endian_read_32(packet, 8));
-      printf("SSP User Confirmation Auto accept\n");
+      WII_LOGI(BT, "SSP User Confirmation Request with numeric value '%u', auto accept", little_endian_read_32(packet, 8));
       break;
       /* LISTING_RESUME */
 
+    case HCI_EVENT_MODE_CHANGE:
+      for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+        if (controllers[i].in_use && controllers[i].handle == hci_event_mode_change_get_handle(packet)) {
+          controllers[i].link_mode = hci_event_mode_change_get_mode(packet);
+          WII_LOGI(BT, "Controller %d: %s mode, interval %u slots (status 0x%02x)", i,
+                   (uintptr_t)((controllers[i].link_mode == LINK_MODE_SNIFF) ? "sniff" : "active"),
+                   hci_event_mode_change_get_interval(packet), hci_event_mode_change_get_status(packet));
+        }
+      }
+      break;
+
     case HCI_EVENT_COMMAND_COMPLETE:
       if (HCI_EVENT_IS_COMMAND_COMPLETE(packet, hci_write_authentication_enable)) {
-        printf("HCI_EVENT_COMMAND_COMPLETE: hci_write_authentication_enable\n");
-        printf("Start SDP HID query for remote HID Device.\n");
-        sdp_client_query_uuid16(&sdp_query_result_handler, wii_addr, BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+        WII_LOGD(BT, "HCI_EVENT_COMMAND_COMPLETE: hci_write_authentication_enable");
+        if (conn_idx >= 0) {
+          hid_sdp_query();
+        }
       }
       break;
 
     // ********************************************************************************
     // L2CAP
     // ********************************************************************************
+    case L2CAP_EVENT_CAN_SEND_NOW:
+      idx = cid_map_find(l2cap_event_can_send_now_get_local_cid(packet));
+      if (idx >= 0) {
+        hid_send_queued(idx);
+      }
+      break;
+
+    case L2CAP_EVENT_INCOMING_CONNECTION:
+      l2cap_event_incoming_connection_get_address(packet, event_addr);
+      l2cap_cid = l2cap_event_incoming_connection_get_local_cid(packet);
+      idx = controller_alloc(event_addr);
+      if (idx < 0) {
+        WII_LOGW(BT, "Incoming L2CAP from " WII_LOG_ADDR_FMT " but no free controller, decline", WII_LOG_ADDR(event_addr));
+        l2cap_decline_connection(l2cap_cid);
+        break;
+      }
+      switch (l2cap_event_incoming_connection_get_psm(packet)) {
+      case BLUETOOTH_PSM_HID_CONTROL:
+        WII_LOGI(BT, "Incoming HID Control from " WII_LOG_ADDR_FMT " (controller %d)", WII_LOG_ADDR(event_addr), idx);
+        if (!controllers[idx].t_start) {
+          controllers[idx].t_start = esp_timer_get_time();
+          controllers[idx].t_l2cap_start = controllers[idx].t_start;
+        }
+        controllers[idx].control_cid = l2cap_cid;
+        cid_map_add(l2cap_cid, idx);
+        if (idx == conn_idx) {
+          // remote was faster than our own attempt; its PSMs are not from SDP, nothing to cache
+          hid_cache_used = 0;
+          hid_control_psm = 0;
+          hid_interrupt_psm = 0;
+        }
+        gap_inquiry_stop();
+        l2cap_accept_connection(l2cap_cid);
+        break;
+      case BLUETOOTH_PSM_HID_INTERRUPT:
+        WII_LOGI(BT, "Incoming HID Interrupt from " WII_LOG_ADDR_FMT " (controller %d)", WII_LOG_ADDR(event_addr), idx);
+        controllers[idx].interrupt_cid = l2cap_cid;
+        cid_map_add(l2cap_cid, idx);
+        l2cap_accept_connection(l2cap_cid);
+        break;
+      default:
+        l2cap_decline_connection(l2cap_cid);
+        break;
+      }
+      break;
+
     case L2CAP_EVENT_CHANNEL_OPENED:
       status = packet[2];
+      l2cap_cid = little_endian_read_16(packet, 13);
+      idx = cid_map_find(l2cap_cid);
+      if (idx < 0)
+        break;
       if (status) {
-        printf("L2CAP Connection failed: 0x%02x\n", status);
-        connection_start();
+        WII_LOGW(BT, "L2CAP Connection failed: 0x%02x", status);
+        if (idx == conn_idx && hid_cache_used) {
+          // cached PSMs may be stale, ask the remote
+          cid_map_remove(l2cap_cid);
+          if (l2cap_cid == controllers[idx].interrupt_cid) {
+            l2cap_disconnect(controllers[idx].control_cid, 0);
+            cid_map_remove(controllers[idx].control_cid);
+          }
+          controllers[idx].control_cid = 0;
+          controllers[idx].interrupt_cid = 0;
+          hid_sdp_query();
+          break;
+        }
+        if (idx == conn_idx) {
+          connection_failed();
+        } else {
+          connection_lost(idx);
+        }
         break;
       }
-      l2cap_cid = little_endian_read_16(packet, 13);
-      if (!l2cap_cid)
-        break;
-      if (l2cap_cid == l2cap_hid_control_cid) {
-        status = l2cap_create_channel(packet_handler, wii_addr, hid_interrupt_psm, 48, &l2cap_hid_interrupt_cid);
+      controllers[idx].handle = l2cap_event_channel_opened_get_handle(packet);
+      // remote opens the interrupt channel itself when it connects to us
+      if (l2cap_cid == controllers[idx].control_cid && !l2cap_event_channel_opened_get_incoming(packet)) {
+        status = l2cap_create_channel(packet_handler, controllers[idx].addr, hid_interrupt_psm, 48, &controllers[idx].interrupt_cid);
         if (status) {
-          printf("Connecting to HID Control failed: 0x%02x\n", status);
-          connection_start();
+          WII_LOGW(BT, "Connecting to HID Interrupt failed: 0x%02x", status);
+          connection_failed();
           break;
         }
+        cid_map_add(controllers[idx].interrupt_cid, idx);
       }
-      if (l2cap_cid == l2cap_hid_interrupt_cid) {
-        printf("HID Connection established\n");
-        wii_ready = 1;
-        wii_connected();
-
-        printf("Save connected address %s to NVS ... ", bd_addr_to_str(wii_addr));
-        uint64_t addr;
-        memcpy(&addr, wii_addr, 6);
-        if (nvs_write_u64(nvs_namespace, nvs_key, addr) == ESP_OK) {
-          printf("Done\n");
-        } else {
-          printf("Failed\n");
+      if (l2cap_cid == controllers[idx].interrupt_cid) {
+        WII_LOGI(BT, "HID Connection established (controller %d)", idx);
+        if (idx == conn_idx && !hid_cache_used && hid_control_psm && hid_interrupt_psm) {
+          hid_cache_save(controllers[idx].addr);
+        }
+        controller_ready(idx);
+        if (idx == conn_idx) {
+          connection_succeeded();
         }
       }
       break;
 
-    // ********************************************************************************
-    // RFCOMM
-    // ********************************************************************************
-    case RFCOMM_EVENT_INCOMING_CONNECTION:
-      // data: event (8), len(8), address(48), channel (8), rfcomm_cid (16)
-      rfcomm_event_incoming_connection_get_bd_addr(packet, event_addr);
-      uint8_t rfcomm_channel_nr;
-      rfcomm_channel_nr = rfcomm_event_incoming_connection_get_server_channel(packet);
-      rfcomm_channel_id = rfcomm_event_incoming_connection_get_rfcomm_cid(packet);
-      printf("RFCOMM channel %u requested for %s\n", rfcomm_channel_nr, bd_addr_to_str(event_addr));
-      rfcomm_accept_connection(rfcomm_channel_id);
-      break;
-
-    case RFCOMM_EVENT_CHANNEL_OPENED:
-      // data: event(8), len(8), status (8), address (48), server channel(8), rfcomm_cid(16), max frame size(16)
-      if (rfcomm_event_channel_opened_get_status(packet)) {
-        printf("RFCOMM channel open failed, status %u\n", rfcomm_event_channel_opened_get_status(packet));
-      } else {
-        rfcomm_channel_id = rfcomm_event_channel_opened_get_rfcomm_cid(packet);
-        uint16_t mtu;
-        mtu = rfcomm_event_channel_opened_get_max_frame_size(packet);
-        printf("RFCOMM channel open succeeded. New RFCOMM Channel ID %u, max frame size %u\n", rfcomm_channel_id, mtu);
-      }
-      break;
-    case RFCOMM_EVENT_CAN_SEND_NOW:
-      rfcomm_send(rfcomm_channel_id, (uint8_t *)lineBuffer, strlen(lineBuffer));
-      break;
-
-      /* LISTING_PAUSE */
-    case RFCOMM_EVENT_CHANNEL_CLOSED:
-      printf("RFCOMM channel closed\n");
-      rfcomm_channel_id = 0;
+    case L2CAP_EVENT_CHANNEL_CLOSED:
+      l2cap_cid = l2cap_event_channel_closed_get_local_cid(packet);
+      idx = cid_map_find(l2cap_cid);
+      if (idx < 0)
+        break;
+      WII_LOGI(BT, "L2CAP channel 0x%04x of controller %d closed", l2cap_cid, idx);
+      connection_lost(idx);
       break;
 
     default:
@@ -404,15 +788,18 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
   // L2CAP DATA PACKET
   // ********************************************************************************
   case L2CAP_DATA_PACKET:
-    // for now, just dump incoming data
-    if (channel == l2cap_hid_interrupt_cid) {
-      hid_report_handler(packet, size);
-    } else if (channel == l2cap_hid_control_cid) {
-      printf("HID Control: ");
-      printf_hexdump(packet, size);
-    } else {
+    idx = cid_map_find(channel);
+    if (idx < 0) {
       break;
     }
+    wii_snoop_l2cap(controllers[idx].handle, channel, 1, packet, size);
+    if (channel == controllers[idx].interrupt_cid) {
+      int64_t now = esp_timer_get_time();
+      wii_replay_record(idx, packet, size, now);
+      hid_report_handler(idx, packet, size, now);
+    } else {
+      WII_LOGD(HID, "HID Control(%d): %d bytes, %02X %02X ...", idx, size, packet[0], (size > 1) ? packet[1] : 0);
+    }
 
   default:
     break;
@@ -458,7 +845,7 @@ static void sdp_query_result_handler(uint8_t packet_type, uint16_t channel, uint
               if (!des_iterator_has_more(&prot_it))
                 continue;
               de_element_get_uint16(des_iterator_get_element(&prot_it), &hid_control_psm);
-              printf("HID Control PSM: 0x%04x\n", (int)hid_control_psm);
+              WII_LOGD(BT, "HID Control PSM: 0x%04x", (int)hid_control_psm);
               break;
             default:
               break;
@@ -487,7 +874,7 @@ static void sdp_query_result_handler(uint8_t packet_type, uint16_t channel, uint
                 if (!des_iterator_has_more(&prot_it))
                   continue;
                 de_element_get_uint16(des_iterator_get_element(&prot_it), &hid_interrupt_psm);
-                printf("HID Interrupt PSM: 0x%04x\n", (int)hid_interrupt_psm);
+                WII_LOGD(BT, "HID Interrupt PSM: 0x%04x", (int)hid_interrupt_psm);
                 break;
               default:
                 break;
@@ -507,8 +894,7 @@ static void sdp_query_result_handler(uint8_t packet_type, uint16_t channel, uint
               const uint8_t *descriptor = de_get_string(element);
               hid_descriptor_len = de_get_data_size(element);
               memcpy(hid_descriptor, descriptor, hid_descriptor_len);
-              printf("HID Descriptor:\n");
-              printf_hexdump(hid_descriptor, hid_descriptor_len);
+              WII_LOGD(BT, "HID Descriptor: %d bytes", hid_descriptor_len);
             }
           }
           break;
@@ -523,30 +909,37 @@ static void sdp_query_result_handler(uint8_t packet_type, uint16_t channel, uint
     break;
 
   case SDP_EVENT_QUERY_COMPLETE:
+    if (conn_idx < 0 || controllers[conn_idx].control_cid) {
+      // attempt was given up, or remote has connected by itself meanwhile
+      break;
+    }
+    controllers[conn_idx].t_sdp_end = esp_timer_get_time();
     if (!hid_control_psm) {
-      printf("HID Control PSM missing\n");
-      connection_start();
+      WII_LOGW(BT, "HID Control PSM missing");
+      connection_failed();
       break;
     }
     if (!hid_interrupt_psm) {
-      printf("HID Interrupt PSM missing\n");
-      connection_start();
+      WII_LOGW(BT, "HID Interrupt PSM missing");
+      connection_failed();
       break;
     }
-    printf("Setup HID\n");
-    status = l2cap_create_channel(packet_handler, wii_addr, hid_control_psm, 48, &l2cap_hid_control_cid);
+    WII_LOGD(BT, "Setup HID");
+    controllers[conn_idx].t_l2cap_start = esp_timer_get_time();
+    status = l2cap_create_channel(packet_handler, controllers[conn_idx].addr, hid_control_psm, 48, &controllers[conn_idx].control_cid);
     if (status) {
-      printf("Connecting to HID Control failed: 0x%02x\n", status);
-      connection_start();
+      WII_LOGW(BT, "Connecting to HID Control failed: 0x%02x", status);
+      connection_failed();
       break;
     }
+    cid_map_add(controllers[conn_idx].control_cid, conn_idx);
 
     break;
   }
 }
 
-// HID Report Handler
-static void hid_report_handler(const uint8_t *report, uint16_t report_len) {
+// HID Report Handler; now is the arrival time, the recorded one when replaying
+static void hid_report_handler(int idx, const uint8_t *report, uint16_t report_len, int64_t now) {
   // check if HID Input Report
   if (report_len < 1)
     return;
@@ -554,188 +947,860 @@ static void hid_report_handler(const uint8_t *report, uint16_t report_len) {
     return;
   report++;
   report_len--;
-#if 0
-    for (int i = 0; i < report_len; i++) {
-        printf("%02X ", report[i]);
+  WII_LOGD(HID, "Report(%d) %02X: %02X %02X %02X", idx, report[0], (report_len > 1) ? report[1] : 0,
+           (report_len > 2) ? report[2] : 0, (report_len > 3) ? report[3] : 0);
+  if (controllers[idx].first_report_pending) {
+    controllers[idx].first_report_pending = 0;
+    controllers[idx].timing.first_report = (now - controllers[idx].t_start) / 1000;
+    WII_LOGI(HID, "First report from controller %d %d ms after connection start", idx, controllers[idx].timing.first_report);
+  }
+  controllers[idx].stats.reports++;
+  if (report[0] >= 0x20 && report[0] < 0x40) {
+    controllers[idx].stats.by_type[report[0] - 0x20]++;
+  }
+  report_stats_update(idx, now);
+
+  // any held or changed button is input activity
+  if (report[0] >= 0x30 && report[0] < 0x40 && report_len >= 3) {
+    uint16_t btn = (report[1] << 8 | report[2]) & BTN_MASK;
+    if (btn || btn != controllers[idx].btn) {
+      controllers[idx].last_input = now;
+      if (controllers[idx].link_profile == WII_LINK_IDLE && controllers[idx].link_request == WII_LINK_AUTO) {
+        link_set_profile(idx, WII_LINK_LOW_LATENCY);
+      }
     }
-    printf("\n");
-#endif
+  }
+
   switch (report[0]) {
+  case 0x20: // Status, data reporting stops until the mode is set again
+    if (report_len >= 4) {
+      ext_status(idx, report[3] & 0x02);
+      hid_set_report_mode(idx);
+    }
+    break;
+  case 0x21: // Read memory data
+    accel_read_done(idx, report, report_len);
+    ext_read_done(idx, report, report_len);
+    break;
+  case 0x22: // Acknowledge output report: BB BB RR EE
+    if (report_len >= 5 && report[3] == 0x16) {
+      reg_write_ack(idx, report[4]);
+    }
+    break;
   case 0x30: // Data reports
-    wii_btn = report[1] << 8 | report[2];
+    controllers[idx].btn = (report[1] << 8 | report[2]) & BTN_MASK;
+    break;
+  case 0x31: // Buttons and accelerometer
+    if (report_len >= 6) {
+      controllers[idx].btn = (report[1] << 8 | report[2]) & BTN_MASK;
+      wii_accel_update(&controllers[idx].accel, &report[1]);
+    }
+    break;
+  case 0x33: // Buttons, accelerometer and 12 IR bytes
+    if (report_len >= 18) {
+      controllers[idx].btn = (report[1] << 8 | report[2]) & BTN_MASK;
+      wii_accel_update(&controllers[idx].accel, &report[1]);
+      if (controllers[idx].ir_state == IR_ACTIVE && controllers[idx].ir_mode == IR_MODE_EXTENDED) {
+        wii_ir_update(&controllers[idx].ir, &report[6], 1, controllers[idx].last_report);
+      }
+    }
+    break;
+  case 0x35: // Buttons, accelerometer and 16 extension bytes
+    if (report_len >= 22) {
+      controllers[idx].btn = (report[1] << 8 | report[2]) & BTN_MASK;
+      wii_accel_update(&controllers[idx].accel, &report[1]);
+      ext_data(idx, &report[6]);
+    }
+    break;
+  case 0x37: // Buttons, accelerometer, 10 IR bytes and 6 extension bytes
+    if (report_len >= 22) {
+      controllers[idx].btn = (report[1] << 8 | report[2]) & BTN_MASK;
+      wii_accel_update(&controllers[idx].accel, &report[1]);
+      if (controllers[idx].ir_state == IR_ACTIVE && controllers[idx].ir_mode == IR_MODE_BASIC) {
+        wii_ir_update(&controllers[idx].ir, &report[6], 0, controllers[idx].last_report);
+      }
+      ext_data(idx, &report[16]);
+    }
     break;
   }
+  if (report[0] >= 0x30 && report[0] < 0x40) {
+    action_input(idx, now);
+  }
+  state_publish(idx, now);
 }
 
-// GAP related functions
-static void gap_scan_start(void) {
-  if (deviceCount < MAX_DEVICES) {
-    printf("Starting inquiry scan..\n");
-    gap_inquiry_start(INQUIRY_INTERVAL);
-  }
+/***************************************************************************
+ * Published state
+ *
+ * Seqlock with the BTstack thread as the only writer. Readers in any task
+ * copy without taking a lock and retry if a publication overlapped the
+ * copy; the writer never waits for them.
+ ***************************************************************************/
+static void state_publish(int idx, int64_t now) {
+  wii_controller_t *c = &controllers[idx];
+  wii_state_t *p = &c->pub;
+
+  c->pub_seq++;
+  __sync_synchronize();
+  p->version = c->pub_seq / 2 + 1;
+  p->time = now;
+  p->valid = (c->mp_state == MP_ACTIVE) ? WII_STATE_MOTION : 0;
+  p->valid |= (c->ir_state == IR_ACTIVE) ? WII_STATE_IR : 0;
+  p->valid |= (c->ext_state == EXT_ACTIVE) ? WII_STATE_EXT : 0;
+  p->btn = c->btn;
+  p->accel = c->accel.out;
+  p->motion = c->motion.out;
+  p->ir = c->ir.out;
+  p->ext = c->ext;
+  __sync_synchronize();
+  c->pub_seq++;
 }
 
-static int gap_has_more_remote_name_requests(void) {
-  int i;
-  for (i = 0; i < deviceCount; i++) {
-    if (devices[i].state == REMOTE_NAME_REQUEST)
-      return 1;
-  }
-  return 0;
+// Clear the published state as one publication; pub_seq goes on, so versions keep growing
+static void state_clear(int idx) {
+  wii_controller_t *c = &controllers[idx];
+
+  c->pub_seq++;
+  __sync_synchronize();
+  memset(&c->pub, 0, sizeof(wii_state_t));
+  __sync_synchronize();
+  c->pub_seq++;
 }
 
-static void gap_continue_remote_names(void) {
-  if (gap_has_more_remote_name_requests()) {
-    gap_do_next_remote_name_request();
-    return;
+// Copy len bytes at offset of the published state; returns its version
+static uint32_t state_read(int idx, void *dst, size_t offset, size_t len) {
+  wii_controller_t *c = &controllers[idx];
+  uint32_t seq;
+  int spins = 0;
+
+  for (;;) {
+    seq = c->pub_seq;
+    if (!(seq & 1)) {
+      __sync_synchronize();
+      memcpy(dst, (const uint8_t *)&c->pub + offset, len);
+      __sync_synchronize();
+      if (c->pub_seq == seq) {
+        return seq / 2;
+      }
+    }
+    if (++spins == STATE_READ_SPINS) {
+      spins = 0;
+      vTaskDelay(1);
+    }
   }
+}
 
-  // All remote names are received. Start connection.
-  printf("All rmote names are gathered, inquiry is completed.\n");
-  connection_start();
+// Inter-arrival time of the report just received
+static void report_stats_update(int idx, int64_t now) {
+  wii_controller_t *c = &controllers[idx];
+  wii_report_stats_t *st = &c->stats;
+  uint32_t bin;
+
+  if (c->last_report) {
+    uint32_t dt = now - c->last_report;
+    if (!st->intervals || dt < st->interval_min_us) {
+      st->interval_min_us = dt;
+    }
+    if (dt > st->interval_max_us) {
+      st->interval_max_us = dt;
+    }
+    st->interval_sum_us += dt;
+    st->intervals++;
+    bin = dt / WII_STATS_HIST_BIN_US;
+    st->hist[(bin < WII_STATS_HIST_BINS) ? bin : WII_STATS_HIST_BINS - 1]++;
+    if (dt >= WII_STATS_GAP_US) {
+      st->gaps++;
+      st->last_gap = now;
+      if (dt > st->gap_max_us) {
+        st->gap_max_us = dt;
+      }
+    }
+  }
+  c->last_report = now;
 }
 
-static void gap_do_next_remote_name_request(void) {
+static void report_stats_print(int idx) {
+  wii_report_stats_t *st = &controllers[idx].stats;
   int i;
-  for (i = 0; i < deviceCount; i++) {
-    // remote name request
-    if (devices[i].state == REMOTE_NAME_REQUEST) {
-      devices[i].state = REMOTE_NAME_INQUIRED;
-      printf("Get remote name of %s...\n", bd_addr_to_str(devices[i].address));
-      gap_remote_name_request(devices[i].address, devices[i].pageScanRepetitionMode, devices[i].clockOffset | 0x8000);
-      return;
-    }
+
+  WII_LOGI(HID, "Controller %d: %u reports (0x30: %u) in %u ms", idx, st->reports, st->by_type[0x10],
+           (uint32_t)((esp_timer_get_time() - st->since) / 1000));
+  if (!st->intervals) {
+    return;
+  }
+  WII_LOGI(HID, "Controller %d: interval min %u avg %u max %u us, %u gaps (max %u ms)", idx, st->interval_min_us,
+           (uint32_t)(st->interval_sum_us / st->intervals), st->interval_max_us, st->gaps, st->gap_max_us / 1000);
+  for (i = 0; i < WII_STATS_HIST_BINS; i += 4) {
+    WII_LOGD(HID, "Controller %d: %2u ms- %u %u %u %u", idx, i * WII_STATS_HIST_BIN_US / 1000, st->hist[i], st->hist[i + 1],
+             st->hist[i + 2], st->hist[i + 3]);
   }
 }
 
-static int gap_getDeviceIndexForAddress(bd_addr_t addr) {
-  int j;
-  for (j = 0; j < deviceCount; j++) {
-    if (bd_addr_cmp(addr, devices[j].address) == 0) {
-      return j;
+static void report_stats_timer_handler(btstack_timer_source_t *ts) {
+  int i;
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    if (controllers[i].ready) {
+      report_stats_print(i);
     }
   }
-  return -1;
+  btstack_run_loop_set_timer(ts, REPORT_STATS_PRINT_MS);
+  btstack_run_loop_add_timer(ts);
 }
 
 /***************************************************************************
- * Connection establishment functions.
+ * Link policy
+ *
+ * A profile change queues HCI commands per controller, link_run() sends
+ * them one at a time whenever the command slot is free. Report stats are
+ * printed and restarted on every change, so they show each profile alone.
  ***************************************************************************/
-enum CONNECTION_STATE { IDLE, TRY_SAVED, TRY_LISTED } connection_state = IDLE;
+static void link_set_profile(int idx, uint8_t profile) {
+  wii_controller_t *c = &controllers[idx];
 
-static esp_err_t connection_try_saved(void) {
-  // Read last saved addr.
-  uint64_t stored_addr = nvs_read_u64(nvs_namespace, nvs_key);
-  if (stored_addr == 0) {
-    return ESP_FAIL;
+  if (c->link_profile == profile) {
+    return;
   }
-  memcpy(wii_addr, &stored_addr, 6);
-  printf("Try saved address.\n");
-  printf("Stored address = %s\n", bd_addr_to_str(wii_addr));
-  printf("Start SDP HID query for remote HID Device.\n");
-  sdp_client_query_uuid16(&sdp_query_result_handler, wii_addr, BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
-  return ESP_OK;
+  if (c->link_profile) {
+    report_stats_print(idx);
+  }
+  WII_LOGI(BT, "Controller %d: %s link", idx, (uintptr_t)((profile == WII_LINK_IDLE) ? "idle" : "low latency"));
+  c->link_profile = profile;
+  if (profile == WII_LINK_IDLE) {
+    c->link_ops = LINK_OP_POLICY | LINK_OP_SNIFF;
+  } else {
+    c->link_ops = LINK_OP_POLICY | LINK_OP_EXIT_SNIFF;
+    if (!c->link_tuned) {
+      c->link_ops |= LINK_OP_FLUSH | LINK_OP_QOS;
+      c->link_tuned = 1;
+    }
+  }
+  wii_resetReportStats(idx);
+  link_run();
 }
 
-static esp_err_t connection_try_listed(void) {
-  if (deviceCount == 0) {
-    return ESP_FAIL;
+// Send the next pending link command, if any
+static void link_run(void) {
+  int i;
+  uint8_t op;
+
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    wii_controller_t *c = &controllers[i];
+    if (!c->ready) {
+      continue;
+    }
+    while (c->link_ops) {
+      if (!hci_can_send_command_packet_now()) {
+        return;
+      }
+      op = c->link_ops & -c->link_ops; // lowest bit
+      c->link_ops &= ~op;
+      switch (op) {
+      case LINK_OP_POLICY:
+        hci_send_cmd(&hci_write_link_policy_settings, c->handle,
+                     (c->link_profile == WII_LINK_IDLE) ? LINK_POLICY_IDLE : LINK_POLICY_LOW_LATENCY);
+        return;
+      case LINK_OP_EXIT_SNIFF:
+        if (c->link_mode == LINK_MODE_SNIFF) {
+          hci_send_cmd(&hci_exit_sniff_mode, c->handle);
+          return;
+        }
+        break;
+      case LINK_OP_FLUSH:
+        hci_send_cmd(&link_cmd_write_automatic_flush_timeout, c->handle, LINK_FLUSH_TIMEOUT_SLOTS);
+        return;
+      case LINK_OP_QOS:
+        // token rate, peak bandwidth: 100 reports of 23 bytes per second
+        hci_send_cmd(&link_cmd_qos_setup, c->handle, 0, LINK_QOS_SERVICE_GUARANTEED, 2300, 2300, LINK_QOS_LATENCY_US,
+                     LINK_QOS_LATENCY_US);
+        return;
+      case LINK_OP_SNIFF:
+        if (c->link_mode != LINK_MODE_SNIFF) {
+          hci_send_cmd(&hci_sniff_mode, c->handle, LINK_SNIFF_MAX_SLOTS, LINK_SNIFF_MIN_SLOTS, LINK_SNIFF_ATTEMPT,
+                       LINK_SNIFF_TIMEOUT);
+          return;
+        }
+        break;
+      }
+    }
   }
-  printf("Try addresses in device list.\n");
-  printf("Write authentication enable\n");
-  hci_send_cmd(&hci_write_authentication_enable, 1);
-  return ESP_OK;
 }
 
-static void connection_start(void) {
-  printf("Connection start(%d):\n", connection_state);
-  if (wii_ready) {
-    printf("However, already connected. Do nothing.\n");
+static void link_timer_handler(btstack_timer_source_t *ts) {
+  int i;
+  int64_t now = esp_timer_get_time();
+
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    wii_controller_t *c = &controllers[i];
+    if (!c->ready || c->replay) {
+      continue;
+    }
+    if (c->link_request != WII_LINK_AUTO) {
+      link_set_profile(i, c->link_request);
+    } else if (c->link_profile == WII_LINK_LOW_LATENCY && c->spk_state == SPK_OFF && now - c->last_input > LINK_IDLE_TIMEOUT_MS * 1000LL) {
+      link_set_profile(i, WII_LINK_IDLE);
+    }
   }
+  link_run();
+  btstack_run_loop_set_timer(ts, LINK_CHECK_MS);
+  btstack_run_loop_add_timer(ts);
+}
 
-  if (connection_state == IDLE) {
-    connection_state = TRY_SAVED;
-    if (connection_try_saved() == ESP_OK) {
-      return;
+// GAP related functions
+static int candidate_find(bd_addr_t addr) {
+  int i;
+  for (i = 0; i < candidateCount; i++) {
+    if (bd_addr_cmp(addr, candidates[i].address) == 0) {
+      return i;
     }
   }
+  return -1;
+}
 
-  if (connection_state == TRY_SAVED) {
-    connection_state = TRY_LISTED;
-    if (connection_try_listed() == ESP_OK) {
-      return;
+// Add or update a candidate; when the list is full the weakest unsaved one is replaced
+static int candidate_add(bd_addr_t addr, int8_t rssi, uint8_t saved) {
+  int i;
+  int c = candidate_find(addr);
+
+  if (c < 0) {
+    if (candidateCount < MAX_CANDIDATES) {
+      c = candidateCount++;
+    } else {
+      for (i = 0; i < MAX_CANDIDATES; i++) {
+        if (!candidates[i].saved && candidates[i].rssi < rssi && (c < 0 || candidates[i].rssi < candidates[c].rssi)) {
+          c = i;
+        }
+      }
+      if (c < 0) {
+        return -1;
+      }
     }
+    memset(&candidates[c], 0, sizeof(struct candidate));
+    memcpy(candidates[c].address, addr, 6);
+    candidates[c].rssi = RSSI_UNKNOWN;
   }
+  if (rssi != RSSI_UNKNOWN) {
+    candidates[c].rssi = rssi;
+  }
+  candidates[c].saved |= saved;
+  return c;
+}
 
-  connection_state = IDLE;
-  printf("No connection candidates, giving up.\n");
-  gap_scan_start();
+static void candidate_load_saved(void) {
+  int i;
+  char key[NVS_ADDR_KEY_LEN];
+
+  // Read saved addrs once
+  if (saved_loaded) {
+    return;
+  }
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    snprintf(key, sizeof(key), "%s%d", nvs_key, i);
+    uint64_t stored_addr = nvs_read_u64(nvs_namespace, key);
+    if (i == 0 && stored_addr == 0) {
+      // Single remote firmware saved its address without an index; move it to slot 0
+      stored_addr = nvs_read_u64(nvs_namespace, nvs_key);
+      if (stored_addr != 0 && nvs_write_u64(nvs_namespace, key, stored_addr) == ESP_OK) {
+        WII_LOGI(NVS, "Moved stored address to %d", i);
+      }
+    }
+    memcpy(saved_addr[i], &stored_addr, 6);
+    saved_valid[i] = (stored_addr != 0);
+    if (saved_valid[i]) {
+      WII_LOGI(NVS, "Stored address %d = " WII_LOG_ADDR_FMT, i, WII_LOG_ADDR(saved_addr[i]));
+      candidate_add(saved_addr[i], RSSI_UNKNOWN, 1);
+    }
+  }
+  saved_loaded = 1;
 }
 
-static void connection_lost(void) {
-  if (wii_ready) {
-    wii_ready = 0;
-    wii_disconnected();
+// Strongest candidate which is not connected and not backing off; saved ones win ties
+static int candidate_best(void) {
+  int i;
+  int best = -1;
+  uint32_t now = btstack_run_loop_get_time_ms();
+
+  for (i = 0; i < candidateCount; i++) {
+    struct candidate *c = &candidates[i];
+    if (controller_find(c->address) >= 0 || (int32_t)(now - c->next_try_ms) < 0) {
+      continue;
+    }
+    if (best < 0 || c->rssi > candidates[best].rssi || (c->rssi == candidates[best].rssi && c->saved > candidates[best].saved)) {
+      best = i;
+    }
   }
-  connection_start();
+  return best;
 }
 
 /***************************************************************************
- * NVS functions
+ * Controller table
  ***************************************************************************/
-static esp_err_t nvs_init() {
-  // Initialize NVS
-  esp_err_t err = nvs_flash_init();
-  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-    printf("NVS: No free pages or new version found, try erase.\n");
-    // NVS partition was truncated and needs to be erased
-    // Retry nvs_flash_init
-    err = nvs_flash_erase();
-    if (err != ESP_OK) {
-      printf("NVS: Erase failed.\n");
-      return err;
-    }
-    err = nvs_flash_init();
+static void cid_map_init(void) {
+  int i;
+  for (i = 0; i < CID_MAP_SIZE; i++) {
+    cid_map[i].cid = 0;
+    cid_map[i].idx = CID_MAP_EMPTY;
   }
-  if (err != ESP_OK) {
-    printf("NVS: Init failed.\n");
+}
+
+static void cid_map_add(uint16_t cid, int idx) {
+  int i, n;
+  for (n = 0, i = cid & (CID_MAP_SIZE - 1); n < CID_MAP_SIZE; n++, i = (i + 1) & (CID_MAP_SIZE - 1)) {
+    if (cid_map[i].idx < 0) {
+      cid_map[i].cid = cid;
+      cid_map[i].idx = idx;
+      return;
+    }
   }
+}
 
-  return err;
+static void cid_map_remove(uint16_t cid) {
+  int i, n;
+  if (cid == 0) {
+    return;
+  }
+  for (n = 0, i = cid & (CID_MAP_SIZE - 1); n < CID_MAP_SIZE && cid_map[i].idx != CID_MAP_EMPTY; n++, i = (i + 1) & (CID_MAP_SIZE - 1)) {
+    if (cid_map[i].idx >= 0 && cid_map[i].cid == cid) {
+      cid_map[i].idx = CID_MAP_DELETED;
+      return;
+    }
+  }
 }
 
-static uint64_t nvs_read_u64(const char *namespace, const char *key) {
-  // Init
-  nvs_init();
+static inline int cid_map_find(uint16_t cid) {
+  int i, n;
+  for (n = 0, i = cid & (CID_MAP_SIZE - 1); n < CID_MAP_SIZE && cid_map[i].idx != CID_MAP_EMPTY; n++, i = (i + 1) & (CID_MAP_SIZE - 1)) {
+    if (cid_map[i].idx >= 0 && cid_map[i].cid == cid) {
+      return cid_map[i].idx;
+    }
+  }
+  return -1;
+}
 
-  // Open
-  nvs_handle handle;
-  esp_err_t err = nvs_open(namespace, NVS_READWRITE, &handle);
-  if (err != ESP_OK) {
-    printf("NVS: Open failed.\n");
-    return 0;
+static int controller_find(bd_addr_t addr) {
+  int i;
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    if (controllers[i].in_use && bd_addr_cmp(controllers[i].addr, addr) == 0) {
+      return i;
+    }
   }
-  printf("NVS: Open success.\n");
+  return -1;
+}
 
-  // Read
-  printf("NVS: Reading.... ");
-  uint64_t val = 0;
-  err = nvs_get_u64(handle, key, &val);
-  switch (err) {
-  case ESP_OK:
-    printf("Done\n");
+// Slot for addr: its own, the one it was saved in, one without saved remote, or any free one
+static int controller_alloc(bd_addr_t addr) {
+  int i;
+  int idx = controller_find(addr);
 
-    break;
-  case ESP_ERR_NVS_NOT_FOUND:
-    printf("No value for (%s.%s).\n", namespace, key);
-    break;
-  default:
-    printf("Error (%s) reading!\n", esp_err_to_name(err));
+  if (idx < 0) {
+    for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+      if (!controllers[i].in_use && saved_valid[i] && bd_addr_cmp(saved_addr[i], addr) == 0) {
+        idx = i;
+        break;
+      }
+    }
+  }
+  for (i = 0; idx < 0 && i < WII_MAX_CONTROLLERS; i++) {
+    if (!controllers[i].in_use && !saved_valid[i]) {
+      idx = i;
+    }
   }
+  for (i = 0; idx < 0 && i < WII_MAX_CONTROLLERS; i++) {
+    if (!controllers[i].in_use) {
+      idx = i;
+    }
+  }
+  if (idx >= 0 && !controllers[idx].in_use) {
+    memset(&controllers[idx], 0, sizeof(wii_controller_t));
+    controllers[idx].in_use = 1;
+    memcpy(controllers[idx].addr, addr, 6);
+  }
+  return idx;
+}
 
-  nvs_close(handle);
+static void controller_release(int idx) {
+  wii_controller_t *c = &controllers[idx];
 
-  return val;
+  cid_map_remove(c->control_cid);
+  cid_map_remove(c->interrupt_cid);
+  if (c->ready) {
+    c->ready = 0;
+    wii_disconnected(idx);
+  }
+  state_clear(idx);
+  // everything but the published state, which state_clear() handled
+  memset(c, 0, offsetof(wii_controller_t, pub_seq));
+  memset((uint8_t *)c + offsetof(wii_controller_t, pub) + sizeof(wii_state_t), 0,
+         sizeof(wii_controller_t) - offsetof(wii_controller_t, pub) - sizeof(wii_state_t));
+  if (idx == conn_idx) {
+    conn_idx = -1;
+  }
+}
+
+static void controller_ready(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  char key[NVS_ADDR_KEY_LEN];
+  uint64_t addr = 0;
+  int64_t now = esp_timer_get_time();
+
+  c->ready = 1;
+  c->first_report_pending = 1;
+  wii_resetReportStats(idx);
+  c->last_input = now;
+  c->rumble_request = RUMBLE_NO_REQUEST;
+  wii_action_reset(&c->action, idx);
+  link_set_profile(idx, WII_LINK_LOW_LATENCY);
+  accel_start(idx);
+  motion_start(idx);
+  hid_request_status(idx); // extension plugged in before the connection
+  hid_set_report_mode(idx);
+
+  c->timing.incoming = (idx != conn_idx);
+  c->timing.page = c->t_page ? (c->t_page - c->t_start) / 1000 : 0;
+  c->timing.sdp = c->t_sdp_end ? (c->t_sdp_end - c->t_sdp_start) / 1000 : 0;
+  c->timing.l2cap = (now - c->t_l2cap_start) / 1000;
+  c->timing.total = (now - c->t_start) / 1000;
+  WII_LOGI(BT, "Controller %d %s: page %d ms, SDP %d ms, L2CAP %d ms, total %d ms", idx,
+           (uintptr_t)(c->timing.incoming ? "connected to us" : "connected"),
+         c->timing.page, c->timing.sdp, c->timing.l2cap, c->timing.total);
+
+  // player LED
+  wii_setLed(idx, 1 << idx);
+  wii_connected(idx);
+
+  if (saved_valid[idx] && bd_addr_cmp(saved_addr[idx], c->addr) == 0) {
+    return;
+  }
+  memcpy(&addr, c->addr, 6);
+  snprintf(key, sizeof(key), "%s%d", nvs_key, idx);
+  if (nvs_write_u64(nvs_namespace, key, addr) == ESP_OK) {
+    memcpy(saved_addr[idx], c->addr, 6);
+    saved_valid[idx] = 1;
+    candidate_add(c->addr, RSSI_UNKNOWN, 1);
+    WII_LOGI(NVS, "Saved address " WII_LOG_ADDR_FMT " as %d", WII_LOG_ADDR(c->addr), idx);
+  } else {
+    WII_LOGW(NVS, "Saving address " WII_LOG_ADDR_FMT " failed", WII_LOG_ADDR(c->addr));
+  }
+}
+
+static int controller_free_slots(void) {
+  int i, n = 0;
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    if (!controllers[i].in_use) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Take a request an app task set and leave 'none'; one set meanwhile stays for the next take
+static uint32_t controller_take_request(volatile uint32_t *request, uint32_t none) {
+  uint32_t old, set;
+  do {
+    old = *request;
+    set = none;
+    uxPortCompareSet(request, old, &set);
+  } while (set != old);
+  return old;
+}
+
+/***************************************************************************
+ * Connection establishment functions.
+ *
+ * Timer driven: one step at a time either pages the best candidate or runs
+ * an inquiry, the two are interleaved. Failed steps back off exponentially.
+ ***************************************************************************/
+static uint32_t backoff_max_ms(void) {
+  return (controller_free_slots() < WII_MAX_CONTROLLERS) ? CONNECTION_BACKOFF_CONNECTED_MAX_MS : CONNECTION_BACKOFF_MAX_MS;
+}
+
+static uint32_t candidate_backoff_ms(uint8_t fails) {
+  uint32_t ms = CONNECTION_BACKOFF_MIN_MS << ((fails < 8) ? fails : 8);
+  return (ms > CONNECTION_BACKOFF_MAX_MS) ? CONNECTION_BACKOFF_MAX_MS : ms;
+}
+
+static void connection_set_timer(uint32_t ms) {
+  btstack_run_loop_remove_timer(&connection_timer);
+  btstack_run_loop_set_timer_handler(&connection_timer, &connection_timer_handler);
+  btstack_run_loop_set_timer(&connection_timer, ms);
+  btstack_run_loop_add_timer(&connection_timer);
+}
+
+static void connection_schedule(uint32_t ms) {
+  connection_state = CONN_WAIT;
+  connection_set_timer(ms);
+}
+
+// Next step waits longer each time nothing was connected
+static void connection_backoff(void) {
+  connection_schedule(connection_backoff_ms);
+  connection_backoff_ms *= 2;
+  if (connection_backoff_ms > backoff_max_ms()) {
+    connection_backoff_ms = backoff_max_ms();
+  }
+}
+
+static void connection_timer_handler(btstack_timer_source_t *ts) {
+  UNUSED(ts);
+  switch (connection_state) {
+  case CONN_PAGING:
+    WII_LOGW(BT, "Connection attempt timed out");
+    connection_failed();
+    break;
+  case CONN_INQUIRY:
+    WII_LOGW(BT, "Inquiry timed out");
+    gap_inquiry_stop();
+    connection_inquiry_complete();
+    break;
+  case CONN_WAIT:
+    connection_step();
+    break;
+  default:
+    break;
+  }
+}
+
+// BT is up or a remote was lost: search again without delay
+static void connection_start(void) {
+  WII_LOGD(BT, "Connection start(%d):", connection_state);
+  connection_backoff_ms = CONNECTION_BACKOFF_MIN_MS;
+  if (connection_state == CONN_IDLE || connection_state == CONN_WAIT) {
+    connection_schedule(0);
+  }
+}
+
+static void connection_step(void) {
+  int c;
+
+  connection_state = CONN_IDLE;
+  if (controller_free_slots() == 0) {
+    WII_LOGI(BT, "All controllers connected.");
+    return;
+  }
+
+  candidate_load_saved();
+  c = candidate_best();
+  if (c < 0 || inquiry_due) {
+    inquiry_due = 0;
+    inquiry_found = 0;
+    WII_LOGI(BT, "Starting inquiry scan..");
+    connection_state = CONN_INQUIRY;
+    gap_inquiry_start(INQUIRY_LENGTH);
+    connection_set_timer(CONNECTION_INQUIRY_TIMEOUT_MS);
+    return;
+  }
+  inquiry_due = 1;
+  connection_try(c);
+}
+
+static void connection_try(int cand) {
+  struct candidate *c = &candidates[cand];
+
+  conn_idx = controller_alloc(c->address);
+  if (conn_idx < 0) {
+    connection_backoff();
+    return;
+  }
+  conn_cand = cand;
+  controllers[conn_idx].t_start = esp_timer_get_time();
+  connection_state = CONN_PAGING;
+  connection_set_timer(CONNECTION_ATTEMPT_TIMEOUT_MS);
+  WII_LOGI(BT, "Try %s address " WII_LOG_ADDR_FMT ", rssi %d", (uintptr_t)(c->saved ? "saved" : "found"), WII_LOG_ADDR(c->address),
+           c->rssi);
+
+  if (!c->saved) {
+    WII_LOGD(BT, "Write authentication enable");
+    hci_send_cmd(&hci_write_authentication_enable, 1);
+    return;
+  }
+
+  if (hid_cache_load(c->address) == ESP_OK) {
+    WII_LOGI(BT, "Use cached HID PSMs, open HID Control");
+    hid_cache_used = 1;
+    controllers[conn_idx].t_l2cap_start = esp_timer_get_time();
+    if (l2cap_create_channel(packet_handler, controllers[conn_idx].addr, hid_control_psm, 48, &controllers[conn_idx].control_cid) == 0) {
+      cid_map_add(controllers[conn_idx].control_cid, conn_idx);
+      return;
+    }
+    controllers[conn_idx].control_cid = 0;
+  }
+  hid_sdp_query();
+}
+
+static void connection_inquiry_complete(void) {
+  if (connection_state != CONN_INQUIRY) {
+    return;
+  }
+  if (inquiry_found) {
+    connection_backoff_ms = CONNECTION_BACKOFF_MIN_MS;
+    connection_schedule(0);
+  } else {
+    connection_backoff();
+  }
+}
+
+static void connection_succeeded(void) {
+  if (conn_cand >= 0) {
+    candidates[conn_cand].fails = 0;
+    candidates[conn_cand].next_try_ms = 0;
+  }
+  conn_cand = -1;
+  conn_idx = -1;
+  connection_backoff_ms = CONNECTION_BACKOFF_MIN_MS;
+  connection_backoff(); // look for more remotes
+}
+
+// Outgoing attempt failed, the candidate backs off
+static void connection_failed(void) {
+  if (connection_state != CONN_PAGING) {
+    return; // already timed out
+  }
+  if (conn_idx >= 0) {
+    if (controllers[conn_idx].control_cid) {
+      l2cap_disconnect(controllers[conn_idx].control_cid, 0);
+    }
+    controller_release(conn_idx);
+  }
+  if (conn_cand >= 0) {
+    struct candidate *c = &candidates[conn_cand];
+    c->fails++;
+    c->next_try_ms = btstack_run_loop_get_time_ms() + candidate_backoff_ms(c->fails);
+    conn_cand = -1;
+  }
+  connection_backoff();
+}
+
+static void connection_lost(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  uint16_t control_cid = c->control_cid;
+  uint16_t interrupt_cid = c->interrupt_cid;
+
+  if (idx == conn_idx) {
+    connection_failed();
+    return;
+  }
+  // forget the channels first, so their close events are ignored
+  controller_release(idx);
+  if (interrupt_cid) {
+    l2cap_disconnect(interrupt_cid, 0);
+  }
+  if (control_cid) {
+    l2cap_disconnect(control_cid, 0);
+  }
+  connection_start();
+}
+
+/***************************************************************************
+ * SDP result cache
+ ***************************************************************************/
+static void hid_sdp_query(void) {
+  controllers[conn_idx].t_sdp_start = esp_timer_get_time();
+  hid_cache_used = 0;
+  hid_control_psm = 0;
+  hid_interrupt_psm = 0;
+  WII_LOGI(BT, "Start SDP HID query for remote HID Device.");
+  sdp_client_query_uuid16(&sdp_query_result_handler, controllers[conn_idx].addr, BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+}
+
+// Key of a per-remote blob, prefix 'h': HID cache, 'a': accelerometer calibration
+static void nvs_addr_key(char prefix, bd_addr_t addr, char *key) {
+  int i;
+  key[0] = prefix;
+  for (i = 0; i < 6; i++) {
+    sprintf(&key[1 + i * 2], "%02x", addr[i]);
+  }
+}
+
+static esp_err_t hid_cache_load(bd_addr_t addr) {
+  static hid_cache_t cache;
+  char key[NVS_ADDR_BLOB_KEY_LEN];
+  size_t len = sizeof(cache);
+
+  nvs_addr_key('h', addr, key);
+  if (nvs_read_blob(nvs_namespace, key, &cache, &len) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (len < HID_CACHE_HEADER_SIZE || cache.descriptor_len > MAX_ATTRIBUTE_VALUE_SIZE || len != HID_CACHE_HEADER_SIZE + cache.descriptor_len ||
+      !cache.control_psm || !cache.interrupt_psm) {
+    WII_LOGW(BT, "HID cache for " WII_LOG_ADDR_FMT " is broken", WII_LOG_ADDR(addr));
+    return ESP_FAIL;
+  }
+  hid_control_psm = cache.control_psm;
+  hid_interrupt_psm = cache.interrupt_psm;
+  hid_descriptor_len = cache.descriptor_len;
+  memcpy(hid_descriptor, cache.descriptor, hid_descriptor_len);
+  WII_LOGD(BT, "HID cache: Control PSM 0x%04x, Interrupt PSM 0x%04x, descriptor %d bytes", hid_control_psm, hid_interrupt_psm, hid_descriptor_len);
+  return ESP_OK;
+}
+
+static void hid_cache_save(bd_addr_t addr) {
+  static hid_cache_t cache;
+  char key[NVS_ADDR_BLOB_KEY_LEN];
+
+  cache.control_psm = hid_control_psm;
+  cache.interrupt_psm = hid_interrupt_psm;
+  cache.descriptor_len = hid_descriptor_len;
+  memcpy(cache.descriptor, hid_descriptor, hid_descriptor_len);
+  nvs_addr_key('h', addr, key);
+  if (nvs_write_blob(nvs_namespace, key, &cache, HID_CACHE_HEADER_SIZE + hid_descriptor_len) == ESP_OK) {
+    WII_LOGI(NVS, "Saved HID cache for " WII_LOG_ADDR_FMT, WII_LOG_ADDR(addr));
+  } else {
+    WII_LOGW(NVS, "Saving HID cache for " WII_LOG_ADDR_FMT " failed", WII_LOG_ADDR(addr));
+  }
+}
+
+/***************************************************************************
+ * NVS functions
+ ***************************************************************************/
+static esp_err_t nvs_init() {
+  // Initialize NVS
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    printf("NVS: No free pages or new version found, try erase.\n");
+    // NVS partition was truncated and needs to be erased
+    // Retry nvs_flash_init
+    err = nvs_flash_erase();
+    if (err != ESP_OK) {
+      printf("NVS: Erase failed.\n");
+      return err;
+    }
+    err = nvs_flash_init();
+  }
+  if (err != ESP_OK) {
+    printf("NVS: Init failed.\n");
+  }
+
+  return err;
+}
+
+static uint64_t nvs_read_u64(const char *namespace, const char *key) {
+  // Init
+  nvs_init();
+
+  // Open
+  nvs_handle handle;
+  esp_err_t err = nvs_open(namespace, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    WII_LOGE(NVS, "Open failed.");
+    return 0;
+  }
+
+  // Read
+  uint64_t val = 0;
+  err = nvs_get_u64(handle, key, &val);
+  switch (err) {
+  case ESP_OK:
+    WII_LOGD(NVS, "Read done");
+    break;
+  case ESP_ERR_NVS_NOT_FOUND:
+    WII_LOGD(NVS, "No value");
+    break;
+  default:
+    WII_LOGE(NVS, "Error (%s) reading!", (uintptr_t)esp_err_to_name(err));
+  }
+
+  nvs_close(handle);
+
+  return val;
 }
 
 static uint64_t nvs_write_u64(const char *namespace, const char *key, uint64_t val) {
@@ -746,19 +1811,20 @@ static uint64_t nvs_write_u64(const char *namespace, const char *key, uint64_t v
   nvs_handle handle;
   esp_err_t err = nvs_open(namespace, NVS_READWRITE, &handle);
   if (err != ESP_OK) {
-    printf("NVS: Open failed.\n");
+    WII_LOGE(NVS, "Open failed.");
     return 0;
   }
-  printf("NVS: Open success.\n");
 
   // Write
-  printf("Updating %s.%s=%X ... ", namespace, key, val);
   err = nvs_set_u64(handle, key, val);
-  printf((err != ESP_OK) ? "Failed!\n" : "Done\n");
+  if (err != ESP_OK) {
+    WII_LOGE(NVS, "Update failed (%s)", (uintptr_t)esp_err_to_name(err));
+  }
 
-  printf("Committing updates in NVS ... ");
   err = nvs_commit(handle);
-  printf((err != ESP_OK) ? "Failed!\n" : "Done\n");
+  if (err != ESP_OK) {
+    WII_LOGE(NVS, "Commit failed (%s)", (uintptr_t)esp_err_to_name(err));
+  }
 
   // Close
   nvs_close(handle);
@@ -766,19 +1832,951 @@ static uint64_t nvs_write_u64(const char *namespace, const char *key, uint64_t v
   return err;
 }
 
+static esp_err_t nvs_read_blob(const char *namespace, const char *key, void *buf, size_t *len) {
+  // Init
+  nvs_init();
+
+  // Open
+  nvs_handle handle;
+  esp_err_t err = nvs_open(namespace, NVS_READONLY, &handle);
+  if (err != ESP_OK) {
+    WII_LOGE(NVS, "Open failed.");
+    return err;
+  }
+
+  // Read
+  err = nvs_get_blob(handle, key, buf, len);
+  switch (err) {
+  case ESP_OK:
+    break;
+  case ESP_ERR_NVS_NOT_FOUND:
+    WII_LOGD(NVS, "No value");
+    break;
+  default:
+    WII_LOGE(NVS, "Error (%s) reading!", (uintptr_t)esp_err_to_name(err));
+  }
+
+  nvs_close(handle);
+
+  return err;
+}
+
+static esp_err_t nvs_write_blob(const char *namespace, const char *key, const void *buf, size_t len) {
+  // Init
+  nvs_init();
+
+  // Open
+  nvs_handle handle;
+  esp_err_t err = nvs_open(namespace, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    WII_LOGE(NVS, "Open failed.");
+    return err;
+  }
+
+  // Write
+  err = nvs_set_blob(handle, key, buf, len);
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+
+  // Close
+  nvs_close(handle);
+
+  return err;
+}
+
+/***************************************************************************
+ * Rumble and LEDs
+ *
+ * Patterns are picked up and stepped here, on the BTstack thread. Only
+ * a change of the motor state that no other report carries in time costs
+ * an extra 0x10 report, within WII_RUMBLE_MAX_REPORTS_PER_S. LED changes
+ * set by the app go out from here too.
+ ***************************************************************************/
+static void rumble_timer_handler(btstack_timer_source_t *ts) {
+  uint32_t pattern;
+  int i;
+
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    wii_controller_t *c = &controllers[i];
+    if (!c->ready) {
+      continue;
+    }
+    pattern = controller_take_request(&c->rumble_request, RUMBLE_NO_REQUEST);
+    if (pattern != RUMBLE_NO_REQUEST) {
+      wii_rumble_start(&c->rumble, pattern);
+    }
+    uint8_t led = c->led;
+    if (led != c->led_sent) {
+      uint8_t report[] = {0xa2, 0x11, 0x00};
+      report[2] = led << 4;
+      if (hid_send(i, report, sizeof(report)) == ERROR_CODE_SUCCESS) {
+        c->led_sent = led; // otherwise the next tick tries again
+      }
+    }
+    if (wii_rumble_tick(&c->rumble)) {
+      uint8_t report[] = {0xa2, 0x10, 0x00};
+      hid_send(i, report, sizeof(report));
+    }
+  }
+  btstack_run_loop_set_timer(ts, WII_RUMBLE_TICK_MS);
+  btstack_run_loop_add_timer(ts);
+}
+
+/***************************************************************************
+ * Input actions
+ *
+ * Button changes are matched on the BTstack thread as the reports come in,
+ * so actions carry the report time whatever the frame rate of the app is.
+ * Deadlines are checked before each report and every ACTION_POLL_MS.
+ ***************************************************************************/
+static void action_input(int idx, int64_t now) {
+  wii_controller_t *c = &controllers[idx];
+  wii_action_poll(&action_map, &c->action, now);
+  wii_action_input(&action_map, &c->action, c->btn, now);
+}
+
+static void action_timer_handler(btstack_timer_source_t *ts) {
+  int64_t now = esp_timer_get_time();
+  int i;
+
+  if (action_requested) {
+    action_requested = 0;
+    WII_LOGI(HID, "Action map: %d bindings", wii_action_compile(&action_map, action_request));
+    for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+      wii_action_reset(&controllers[i].action, i);
+    }
+  }
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    if (controllers[i].ready && controllers[i].action.pending) {
+      wii_action_poll(&action_map, &controllers[i].action, now);
+    }
+  }
+  btstack_run_loop_set_timer(ts, ACTION_POLL_MS);
+  btstack_run_loop_add_timer(ts);
+}
+
+/***************************************************************************
+ * Speaker
+ *
+ * Enable and mute, then the configuration writes as one sequence, then
+ * unmute. Reports are paced against the stream start, rate / 40 per
+ * second, and only go out while L2CAP can take them right away and no
+ * other output report is queued, so audio never delays them. The link stays in
+ * low latency mode while a stream runs.
+ ***************************************************************************/
+static void speaker_start(int idx) {
+  static const uint8_t enable = 0x01;
+  static const uint8_t play = 0x01;
+  static const uint8_t config_start = 0x08;
+  wii_controller_t *c = &controllers[idx];
+  uint8_t on[] = {0xa2, 0x14, 0x04};
+  uint8_t mute[] = {0xa2, 0x19, 0x04};
+  uint16_t div = SPEAKER_CLOCK / c->spk_rate;
+  uint8_t config[] = {0x00, SPEAKER_FORMAT_ADPCM, div & 0xff, div >> 8, c->spk_volume, 0x00, 0x00};
+
+  wii_adpcm_init(&speakers[idx]->adpcm); // the ring was reset by wii_speakerStart(), it may hold samples already
+  c->spk_state = SPK_INIT;
+  link_set_profile(idx, WII_LINK_LOW_LATENCY);
+  hid_send(idx, on, sizeof(on));
+  hid_send(idx, mute, sizeof(mute));
+  reg_write(idx, SPK_REG_ENABLE, &enable, 1, NULL);
+  reg_write(idx, SPK_REG_CONFIG, &config_start, 1, NULL);
+  reg_write(idx, SPK_REG_CONFIG, config, sizeof(config), NULL);
+  reg_write(idx, SPK_REG_PLAY, &play, 1, speaker_init_done);
+}
+
+static void speaker_init_done(int idx, uint8_t error) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t unmute[] = {0xa2, 0x19, 0x00};
+
+  if (c->spk_state != SPK_INIT) {
+    return;
+  }
+  if (error) {
+    WII_LOGW(HID, "Controller %d: speaker setup failed (0x%02x)", idx, error);
+    speaker_stop(idx);
+    return;
+  }
+  hid_send(idx, unmute, sizeof(unmute));
+  c->spk_state = SPK_ON;
+  c->spk_t0 = esp_timer_get_time();
+  c->spk_sent = 0;
+  WII_LOGI(HID, "Controller %d: speaker on, %u Hz", idx, c->spk_rate);
+}
+
+static void speaker_stop(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  wii_speaker_stats_t *st = &speakers[idx]->stats;
+  uint8_t mute[] = {0xa2, 0x19, 0x04};
+  uint8_t off[] = {0xa2, 0x14, 0x00};
+
+  if (c->spk_state == SPK_OFF) {
+    return;
+  }
+  hid_send(idx, mute, sizeof(mute));
+  hid_send(idx, off, sizeof(off));
+  c->spk_state = SPK_OFF;
+  WII_LOGI(HID, "Controller %d: speaker off, %u reports, %u underruns, %u late, %u samples dropped", idx, st->reports,
+           st->underruns, st->late, st->dropped);
+}
+
+static void speaker_pump(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  int64_t elapsed = esp_timer_get_time() - c->spk_t0;
+  uint32_t due = elapsed * c->spk_rate / (WII_SPEAKER_REPORT_SAMPLES * 1000000LL) + 1;
+  int burst;
+
+  if (due - c->spk_sent > SPEAKER_MAX_BEHIND) {
+    wii_speaker_skip(speakers[idx], due - c->spk_sent - 1);
+    c->spk_sent = due - 1;
+  }
+  for (burst = 0; burst < SPEAKER_MAX_BURST && c->spk_sent < due; burst++) {
+    uint8_t report[3 + WII_SPEAKER_REPORT_BYTES] = {0xa2, 0x18, WII_SPEAKER_REPORT_BYTES << 3};
+    if (c->out_count || !l2cap_can_send_packet_now(c->interrupt_cid)) {
+      break;
+    }
+    wii_speaker_encode(speakers[idx], &report[3]);
+    hid_send(idx, report, sizeof(report));
+    c->spk_sent++;
+  }
+}
+
+static void speaker_timer_handler(btstack_timer_source_t *ts) {
+  uint8_t active = 0;
+  uint32_t request;
+  int i;
+
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    wii_controller_t *c = &controllers[i];
+    if (!c->ready) {
+      continue;
+    }
+    request = controller_take_request(&c->spk_request, SPK_REQ_NONE);
+    if (request == SPK_REQ_START) {
+      speaker_stop(i);
+      speaker_start(i);
+    } else if (request == SPK_REQ_STOP) {
+      speaker_stop(i);
+    }
+    if (c->spk_state == SPK_ON) {
+      speaker_pump(i);
+    }
+    active |= (c->spk_state != SPK_OFF);
+  }
+  btstack_run_loop_set_timer(ts, active ? SPEAKER_TICK_MS : SPEAKER_IDLE_MS);
+  btstack_run_loop_add_timer(ts);
+}
+
+/***************************************************************************
+ * Replay
+ *
+ * A captured controller takes its recorded slot if no remote is there.
+ * It starts like a fresh connection minus the radio: output reports are
+ * swallowed by hid_send(), the recorded acks, reads and status reports
+ * drive MotionPlus, IR and extension setup as they did live.
+ ***************************************************************************/
+static void replay_report(uint8_t idx, const uint8_t *report, uint16_t len, int64_t time) {
+  wii_controller_t *c;
+  wii_accel_calib_t calib;
+
+  if (idx >= WII_MAX_CONTROLLERS) {
+    return;
+  }
+  c = &controllers[idx];
+  if (c->in_use && !c->replay) {
+    return;
+  }
+  if (!c->in_use) {
+    c->in_use = 1;
+    c->replay = 1;
+    c->ready = 1;
+    c->rumble_request = RUMBLE_NO_REQUEST;
+    wii_action_reset(&c->action, idx);
+    wii_resetReportStats(idx);
+    wii_accel_calib_default(&calib);
+    wii_accel_init(&c->accel, &calib);
+    motion_start(idx);
+    wii_connected(idx);
+  }
+  hid_report_handler(idx, report, len, time);
+}
+
+static void replay_done(void) {
+  int i;
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    if (controllers[i].replay) {
+      controller_release(i);
+    }
+  }
+}
+
 /***************************************************************************
  * WiiRemote functions
  ***************************************************************************/
-uint8_t wii_isReady() { return wii_ready; }
-uint16_t wii_getButton() { return wii_btn; }
-uint16_t wii_getLed() { return wii_led; }
+uint8_t wii_isReady(uint8_t idx) { return (idx < WII_MAX_CONTROLLERS) ? controllers[idx].ready : 0; }
+
+// Safe from any task; the snapshot is consistent, all fields come from the same report
+uint8_t wii_getState(uint8_t idx, wii_state_t *state) {
+  if (idx >= WII_MAX_CONTROLLERS || !controllers[idx].ready) {
+    return 0;
+  }
+  state_read(idx, state, 0, sizeof(wii_state_t));
+  return 1;
+}
+
+uint16_t wii_getButton(uint8_t idx) {
+  uint16_t btn = 0;
+  if (idx < WII_MAX_CONTROLLERS) {
+    state_read(idx, &btn, offsetof(wii_state_t, btn), sizeof(btn));
+  }
+  return btn;
+}
+
+uint8_t wii_getAccel(uint8_t idx, wii_accel_t *accel) {
+  if (idx >= WII_MAX_CONTROLLERS || !controllers[idx].ready) {
+    return 0;
+  }
+  state_read(idx, accel, offsetof(wii_state_t, accel), sizeof(wii_accel_t));
+  return 1;
+}
+
+uint8_t wii_getMotion(uint8_t idx, wii_motion_t *motion) {
+  wii_state_t st;
+  if (!wii_getState(idx, &st) || !(st.valid & WII_STATE_MOTION)) {
+    return 0;
+  }
+  *motion = st.motion;
+  return 1;
+}
+
+uint8_t wii_getIR(uint8_t idx, wii_ir_t *ir) {
+  wii_state_t st;
+  if (!wii_getState(idx, &st) || !(st.valid & WII_STATE_IR)) {
+    return 0;
+  }
+  *ir = st.ir;
+  return 1;
+}
+
+uint8_t wii_getExtension(uint8_t idx, wii_ext_t *ext) {
+  wii_state_t st;
+  if (!wii_getState(idx, &st) || !(st.valid & WII_STATE_EXT)) {
+    return 0;
+  }
+  *ext = st.ext;
+  return 1;
+}
+
+// Q8 coefficients: lowpass 256 passes everything, highpass 0 turns it off
+void wii_setAccelFilter(uint8_t idx, uint16_t lowpass, uint16_t highpass) {
+  if (idx < WII_MAX_CONTROLLERS) {
+    wii_accel_set_filter(&controllers[idx].accel, lowpass, highpass);
+  }
+}
+
+uint16_t wii_getLed(uint8_t idx) { return (idx < WII_MAX_CONTROLLERS) ? controllers[idx].led : 0; }
+
+uint8_t wii_getConnectTiming(uint8_t idx, wii_connect_timing_t *timing) {
+  if (idx >= WII_MAX_CONTROLLERS || !controllers[idx].ready) {
+    return 0;
+  }
+  *timing = controllers[idx].timing;
+  return 1;
+}
+
+// Copied without locking, a report arriving meanwhile may leave the copy slightly inconsistent
+uint8_t wii_getReportStats(uint8_t idx, wii_report_stats_t *stats) {
+  if (idx >= WII_MAX_CONTROLLERS || !controllers[idx].ready) {
+    return 0;
+  }
+  *stats = controllers[idx].stats;
+  return 1;
+}
+
+void wii_resetReportStats(uint8_t idx) {
+  if (idx >= WII_MAX_CONTROLLERS) {
+    return;
+  }
+  memset(&controllers[idx].stats, 0, sizeof(wii_report_stats_t));
+  controllers[idx].stats.since = esp_timer_get_time();
+  controllers[idx].last_report = 0;
+}
+
+// Applied by the BTstack thread within LINK_CHECK_MS
+void wii_setLinkProfile(uint8_t idx, uint8_t profile) {
+  if (idx < WII_MAX_CONTROLLERS && profile <= WII_LINK_IDLE) {
+    controllers[idx].link_request = profile;
+  }
+}
+
+uint8_t wii_getLinkProfile(uint8_t idx) { return (idx < WII_MAX_CONTROLLERS) ? controllers[idx].link_profile : 0; }
+
+// Compiled by the BTstack thread within ACTION_POLL_MS; the list must stay valid while in use
+void wii_setActionMap(const wii_binding_t *bindings) {
+  action_request = bindings;
+  action_requested = 1;
+}
+
+uint8_t wii_getAction(wii_action_t *action) { return wii_action_pop(action); }
+
+// Started by the BTstack thread within WII_RUMBLE_TICK_MS, replacing a running pattern
+void wii_playRumble(uint8_t idx, uint8_t pattern) {
+  if (idx < WII_MAX_CONTROLLERS && pattern < WII_RUMBLE_PATTERNS) {
+    controllers[idx].rumble_request = pattern;
+  }
+}
+
+// Sent by the BTstack thread within WII_RUMBLE_TICK_MS
+void wii_setLed(uint8_t idx, uint16_t led) {
+  if (idx >= WII_MAX_CONTROLLERS) {
+    return;
+  }
+  controllers[idx].led = led;
+}
+
+// Rate in Hz, clamped to WII_SPEAKER_RATE_MIN..MAX; returns 0 if there is no memory for the ring
+uint8_t wii_speakerStart(uint8_t idx, uint16_t rate, uint8_t volume) {
+  if (idx >= WII_MAX_CONTROLLERS) {
+    return 0;
+  }
+  if (!speakers[idx]) {
+    wii_speaker_t *spk = heap_caps_malloc(sizeof(wii_speaker_t), MALLOC_CAP_SPIRAM);
+    if (!spk) {
+      spk = heap_caps_malloc(sizeof(wii_speaker_t), MALLOC_CAP_8BIT);
+    }
+    if (!spk) {
+      return 0;
+    }
+    memset(spk, 0, sizeof(wii_speaker_t));
+    speakers[idx] = spk;
+  }
+  // a new stream starts empty, the samples written from now on are kept for it
+  if (controllers[idx].spk_state == SPK_OFF && controllers[idx].spk_request != SPK_REQ_START) {
+    wii_speaker_reset(speakers[idx]);
+  }
+  rate = (rate < WII_SPEAKER_RATE_MIN) ? WII_SPEAKER_RATE_MIN : (rate > WII_SPEAKER_RATE_MAX) ? WII_SPEAKER_RATE_MAX : rate;
+  controllers[idx].spk_rate = rate;
+  controllers[idx].spk_volume = volume;
+  controllers[idx].spk_request = SPK_REQ_START;
+  return 1;
+}
+
+void wii_speakerStop(uint8_t idx) {
+  if (idx < WII_MAX_CONTROLLERS) {
+    controllers[idx].spk_request = SPK_REQ_STOP;
+  }
+}
+
+// Samples accepted; the ring holds WII_SPEAKER_RING
+uint16_t wii_speakerWrite(uint8_t idx, const int16_t *pcm, uint16_t n) {
+  if (idx >= WII_MAX_CONTROLLERS || !speakers[idx]) {
+    return 0;
+  }
+  return wii_speaker_write(speakers[idx], pcm, n);
+}
+
+uint8_t wii_getSpeakerStats(uint8_t idx, wii_speaker_stats_t *stats) {
+  if (idx >= WII_MAX_CONTROLLERS || !speakers[idx]) {
+    return 0;
+  }
+  *stats = speakers[idx]->stats;
+  return 1;
+}
+
+// The first data byte carries the rumble bit as it is when the report goes out
+static uint8_t hid_send_now(int idx, uint8_t *report, uint16_t len) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t bit = c->rumble.bit;
+  uint8_t status;
+
+  if (len >= 3) {
+    report[2] = (report[2] & 0xfe) | bit;
+  }
+  status = l2cap_send(c->interrupt_cid, report, len);
+  if (status != ERROR_CODE_SUCCESS) {
+    return status;
+  }
+  if (len >= 3) {
+    c->rumble.sent = bit;
+  }
+  wii_snoop_l2cap(c->handle, c->interrupt_cid, 0, report, len);
+  return status;
+}
+
+// Output report on the interrupt channel. Reports go out in order: one that L2CAP cannot
+// take now, or that would pass queued ones, waits for L2CAP_EVENT_CAN_SEND_NOW.
+// Returns ERROR_CODE_SUCCESS once the report is sent or queued.
+static uint8_t hid_send(int idx, uint8_t *report, uint16_t len) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t slot;
+
+  if (c->replay) {
+    return ERROR_CODE_SUCCESS;
+  }
+  if (c->out_count == 0 && l2cap_can_send_packet_now(c->interrupt_cid)) {
+    return hid_send_now(idx, report, len);
+  }
+  if (c->out_count == OUT_QUEUE_LEN || len > OUT_REPORT_MAX) {
+    WII_LOGW(HID, "Controller %d: output report 0x%02x dropped", idx, report[1]);
+    return BTSTACK_ACL_BUFFERS_FULL;
+  }
+  slot = (c->out_head + c->out_count) % OUT_QUEUE_LEN;
+  memcpy(c->out[slot], report, len);
+  c->out_len[slot] = len;
+  if (c->out_count++ == 0) {
+    l2cap_request_can_send_now_event(c->interrupt_cid);
+  }
+  return ERROR_CODE_SUCCESS;
+}
+
+// One queued report per L2CAP_EVENT_CAN_SEND_NOW
+static void hid_send_queued(int idx) {
+  wii_controller_t *c = &controllers[idx];
+
+  if (c->out_count == 0) {
+    return;
+  }
+  if (hid_send_now(idx, c->out[c->out_head], c->out_len[c->out_head]) != BTSTACK_ACL_BUFFERS_FULL) {
+    // sent, or the channel is gone
+    c->out_head = (c->out_head + 1) % OUT_QUEUE_LEN;
+    c->out_count--;
+  }
+  if (c->out_count) {
+    l2cap_request_can_send_now_event(c->interrupt_cid);
+  }
+}
+
+static void hid_set_report_mode(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t mode = REPORT_MODE;
+  if (ext_bytes_wanted(idx)) {
+    mode = (c->ir_state == IR_ACTIVE && c->ir_mode == IR_MODE_BASIC) ? REPORT_MODE_IR_EXT : REPORT_MODE_EXT;
+  } else if (c->ir_state == IR_ACTIVE && c->ir_mode == IR_MODE_EXTENDED) {
+    mode = REPORT_MODE_IR;
+  }
+  uint8_t report[] = {0xa2, 0x12, REPORT_CONTINUOUS ? 0x04 : 0x00, mode};
+  hid_send(idx, report, sizeof(report));
+}
+
+static void hid_request_status(int idx) {
+  uint8_t report[] = {0xa2, 0x15, 0x00};
+  hid_send(idx, report, sizeof(report));
+}
+
+// 0x17: MM AA AA AA SS SS, answered by 0x21; space 0x00 EEPROM, 0x04 registers
+static void hid_read(int idx, uint8_t space, uint32_t addr, uint16_t len) {
+  uint8_t report[] = {0xa2, 0x17, space, addr >> 16, addr >> 8, addr, len >> 8, len};
+  hid_send(idx, report, sizeof(report));
+}
+
+// 0x16: MM AA AA AA SS DD*16, acknowledged by 0x22
+static void hid_write_register(int idx, uint32_t addr, const uint8_t *data, uint8_t len) {
+  uint8_t report[23] = {0xa2, 0x16, 0x04, addr >> 16, addr >> 8, addr, len};
+  memcpy(&report[7], data, (len < 16) ? len : 16);
+  hid_send(idx, report, sizeof(report));
+}
+
+/***************************************************************************
+ * Register writes
+ *
+ * Writes are queued per controller and up to WRITE_WINDOW of them are on
+ * the link at once, so a setup sequence costs about one round trip per
+ * window instead of one per write. A sequence is the writes up to one
+ * with a done callback, which is called once for the whole sequence.
+ *
+ * A failed write is sent again together with everything after it, so the
+ * order of writes is kept; acks of the writes already in flight are
+ * dropped first. After WRITE_RETRIES the rest of its sequence is dropped.
+ * An ack that does not come within WRITE_ACK_TIMEOUT_MS of the last send
+ * or ack counts as an error ack, so a lost ack or a remote that was busy
+ * resetting goes through the same retries instead of stalling the queue.
+ * Replayed controllers get their acks from the capture and never time out.
+ ***************************************************************************/
+static uint8_t reg_write(int idx, uint32_t addr, const uint8_t *data, uint8_t len, reg_write_done_t done) {
+  wii_controller_t *c = &controllers[idx];
+  reg_write_t *w;
+
+  if (c->write_count == WRITE_QUEUE_LEN || len > sizeof(w->data)) {
+    WII_LOGW(HID, "Controller %d: register write 0x%06x dropped", idx, addr);
+    return 0;
+  }
+  w = &c->writes[(c->write_head + c->write_count) % WRITE_QUEUE_LEN];
+  w->addr = addr;
+  w->len = len;
+  memcpy(w->data, data, len);
+  w->tries = 0;
+  w->done = done;
+  c->write_count++;
+  reg_write_run(idx);
+  return 1;
+}
+
+static void reg_write_run(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t sent = 0;
+
+  while (!c->write_stale && c->write_sent < c->write_count && c->write_sent < WRITE_WINDOW) {
+    reg_write_t *w = &c->writes[(c->write_head + c->write_sent) % WRITE_QUEUE_LEN];
+    hid_write_register(idx, w->addr, w->data, w->len);
+    w->tries++;
+    c->write_sent++;
+    sent = 1;
+  }
+  if (!c->write_sent && !c->write_stale) {
+    c->write_deadline = 0;
+  } else if (sent || !c->write_deadline) {
+    c->write_deadline = esp_timer_get_time() + WRITE_ACK_TIMEOUT_MS * 1000LL;
+  }
+}
+
+static void reg_write_pop(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  c->write_head = (c->write_head + 1) % WRITE_QUEUE_LEN;
+  c->write_count--;
+}
+
+static void reg_write_ack(int idx, uint8_t error) {
+  wii_controller_t *c = &controllers[idx];
+  reg_write_t *w = &c->writes[c->write_head];
+  reg_write_done_t done;
+
+  c->write_deadline = 0; // restarted below if more acks are awaited
+  if (c->write_stale) {
+    if (--c->write_stale == 0) {
+      reg_write_run(idx);
+    } else {
+      c->write_deadline = esp_timer_get_time() + WRITE_ACK_TIMEOUT_MS * 1000LL;
+    }
+    return;
+  }
+  if (!c->write_sent) {
+    return;
+  }
+  if (!error) {
+    done = w->done;
+    reg_write_pop(idx);
+    c->write_sent--;
+    if (done) {
+      done(idx, 0);
+    }
+    reg_write_run(idx);
+    return;
+  }
+
+  // everything after the failed write goes out again
+  c->write_stale = c->write_sent - 1;
+  c->write_sent = 0;
+  if (w->tries <= WRITE_RETRIES) {
+    WII_LOGD(HID, "Controller %d: register write 0x%06x error 0x%02x, retry", idx, w->addr, error);
+    reg_write_run(idx);
+    return;
+  }
+  WII_LOGD(HID, "Controller %d: register write 0x%06x failed (0x%02x)", idx, w->addr, error);
+  do {
+    done = c->writes[c->write_head].done;
+    reg_write_pop(idx);
+  } while (!done && c->write_count);
+  if (done) {
+    done(idx, error);
+  }
+  reg_write_run(idx);
+}
+
+static void write_timer_handler(btstack_timer_source_t *ts) {
+  int64_t now = esp_timer_get_time();
+  int i;
+
+  for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+    wii_controller_t *c = &controllers[i];
+    if (!c->in_use || c->replay) {
+      continue;
+    }
+    ext_read_timeout(i, now);
+    if (!c->write_deadline || now < c->write_deadline) {
+      continue;
+    }
+    WII_LOGD(HID, "Controller %d: register write ack timeout", i);
+    if (c->write_stale) {
+      c->write_stale = 0; // the acks of the writes sent before the retry are lost, go on
+      c->write_deadline = 0;
+      reg_write_run(i);
+    } else {
+      reg_write_ack(i, WRITE_ACK_TIMEOUT);
+    }
+  }
+  btstack_run_loop_set_timer(ts, WRITE_ACK_CHECK_MS);
+  btstack_run_loop_add_timer(ts);
+}
+
+/***************************************************************************
+ * MotionPlus
+ *
+ * Init and activate are separate write sequences, activation only follows
+ * a successful init. An error ack means there is no MotionPlus. Once active it shows up
+ * as extension, the status report that follows switches to mode 0x37.
+ * The IR camera is set up afterwards, its mode depends on the outcome.
+ ***************************************************************************/
+static void motion_start(int idx) {
+  static const uint8_t init = 0x55;
+  controllers[idx].mp_state = MP_INIT;
+  reg_write(idx, MP_REG_INIT, &init, 1, motion_write_done);
+}
 
-void wii_setLed(uint16_t led) {
-  wii_led = led;
-  uint8_t report[] = {0xa2, 0x11, wii_led << 4};
-  if (wii_ready) {
-    if (l2cap_send(l2cap_hid_interrupt_cid, &report[0], sizeof(report)) != ESP_OK) {
-      connection_lost();
+static void motion_write_done(int idx, uint8_t error) {
+  static const uint8_t mode = MP_MODE_STANDALONE;
+  wii_controller_t *c = &controllers[idx];
+
+  switch (c->mp_state) {
+  case MP_INIT:
+    if (error) {
+      WII_LOGI(HID, "Controller %d: no MotionPlus (0x%02x)", idx, error);
+      c->mp_state = MP_ABSENT;
+      ext_status(idx, c->ext_present);
+      ir_start(idx);
+      break;
     }
+    c->mp_state = MP_ACTIVATE;
+    reg_write(idx, MP_REG_ACTIVATE, &mode, 1, motion_write_done);
+    break;
+  case MP_ACTIVATE:
+    if (error) {
+      WII_LOGW(HID, "Controller %d: MotionPlus activation failed (0x%02x)", idx, error);
+      c->mp_state = MP_ABSENT;
+      ext_status(idx, c->ext_present);
+      ir_start(idx);
+      break;
+    }
+    WII_LOGI(HID, "Controller %d: MotionPlus active", idx);
+    wii_motion_init(&c->motion);
+    c->mp_state = MP_ACTIVE;
+    ir_start(idx);
+    break;
+  default:
+    break;
+  }
+}
+
+/***************************************************************************
+ * IR camera
+ *
+ * Pixel clock and camera enable, then ir_init_writes as one write
+ * sequence. Basic mode when extension data shares the report, extended
+ * mode otherwise; the mode follows extensions coming and going.
+ ***************************************************************************/
+static void ir_start(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t clock[] = {0xa2, 0x13, 0x04};
+  uint8_t enable[] = {0xa2, 0x1a, 0x04};
+  int i;
+
+  c->ir_state = IR_INIT;
+  c->ir_mode = ext_bytes_wanted(idx) ? IR_MODE_BASIC : IR_MODE_EXTENDED;
+  wii_ir_init(&c->ir);
+  hid_send(idx, clock, sizeof(clock));
+  hid_send(idx, enable, sizeof(enable));
+  for (i = 0; i < IR_INIT_WRITES; i++) {
+    reg_write_done_t done = (i == IR_INIT_WRITES - 1) ? ir_write_done : NULL;
+    if (ir_init_writes[i].addr == IR_REG_MODE) {
+      reg_write(idx, IR_REG_MODE, &c->ir_mode, 1, done);
+    } else {
+      reg_write(idx, ir_init_writes[i].addr, ir_init_writes[i].data, ir_init_writes[i].len, done);
+    }
+  }
+}
+
+static void ir_write_done(int idx, uint8_t error) {
+  wii_controller_t *c = &controllers[idx];
+
+  if (error) {
+    WII_LOGW(HID, "Controller %d: IR camera setup failed (0x%02x)", idx, error);
+    c->ir_state = IR_FAILED;
+    hid_set_report_mode(idx);
+    return;
+  }
+  WII_LOGI(HID, "Controller %d: IR camera on, %s mode", idx,
+           (uintptr_t)(c->ir_mode == IR_MODE_BASIC ? "basic" : "extended"));
+  c->ir_state = IR_ACTIVE;
+  ir_check_mode(idx);
+  hid_set_report_mode(idx);
+}
+
+// Restart with the other mode if the extension changed meanwhile
+static void ir_check_mode(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  uint8_t mode = ext_bytes_wanted(idx) ? IR_MODE_BASIC : IR_MODE_EXTENDED;
+
+  if (c->ir_state == IR_ACTIVE && c->ir_mode != mode) {
+    ir_start(idx);
+  }
+}
+
+/***************************************************************************
+ * Extension controllers
+ *
+ * The status report tells whether something is plugged in. While
+ * MotionPlus is active it is the extension itself; until its detection is
+ * done the flag is only kept. A new extension is initialised unencrypted
+ * and its ID read, up to EXT_READ_RETRIES more times if the answer does
+ * not come within EXT_READ_TIMEOUT_MS; extension bytes are only requested in the report
+ * mode while a known extension is active. Extensions plugged into the
+ * MotionPlus pass-through are not supported.
+ ***************************************************************************/
+static uint8_t ext_bytes_wanted(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  return c->mp_state == MP_ACTIVE || (c->ext_state == EXT_ACTIVE && c->ext.type != WII_EXT_UNKNOWN);
+}
+
+static void ext_status(int idx, uint8_t present) {
+  wii_controller_t *c = &controllers[idx];
+
+  c->ext_present = present;
+  if (c->mp_state == MP_ACTIVE) {
+    if (!present) {
+      WII_LOGW(HID, "Controller %d: MotionPlus removed", idx);
+      c->mp_state = MP_ABSENT;
+      ir_check_mode(idx);
+    }
+    return;
+  }
+  if (c->mp_state != MP_ABSENT) {
+    return; // motion_write_done() looks again
+  }
+  if (present && c->ext_state == EXT_NONE) {
+    ext_start(idx);
+  } else if (!present && c->ext_state != EXT_NONE) {
+    WII_LOGI(HID, "Controller %d: extension removed", idx);
+    c->ext_state = EXT_NONE;
+    memset(&c->ext, 0, sizeof(wii_ext_t));
+    ir_check_mode(idx);
+  }
+}
+
+static void ext_start(int idx) {
+  static const uint8_t init1 = 0x55;
+  static const uint8_t init2 = 0x00;
+  wii_controller_t *c = &controllers[idx];
+
+  c->ext_state = EXT_INIT;
+  memset(&c->ext, 0, sizeof(wii_ext_t));
+  reg_write(idx, EXT_REG_INIT1, &init1, 1, NULL);
+  reg_write(idx, EXT_REG_INIT2, &init2, 1, ext_init_done);
+}
+
+static void ext_init_done(int idx, uint8_t error) {
+  wii_controller_t *c = &controllers[idx];
+
+  if (c->ext_state != EXT_INIT) {
+    return; // unplugged meanwhile
+  }
+  if (error) {
+    WII_LOGW(HID, "Controller %d: extension init failed (0x%02x)", idx, error);
+    c->ext_state = EXT_FAILED;
+    return;
+  }
+  c->ext_tries = 0;
+  ext_read_id(idx);
+}
+
+static void ext_read_id(int idx) {
+  wii_controller_t *c = &controllers[idx];
+
+  c->ext_state = EXT_READ_ID;
+  c->ext_deadline = esp_timer_get_time() + EXT_READ_TIMEOUT_MS * 1000LL;
+  hid_read(idx, 0x04, EXT_REG_ID, WII_EXT_ID_LEN);
+}
+
+// Checked with the register write acks; a lost read or answer is retried, then given up
+static void ext_read_timeout(int idx, int64_t now) {
+  wii_controller_t *c = &controllers[idx];
+
+  if (c->ext_state != EXT_READ_ID || now < c->ext_deadline) {
+    return;
+  }
+  if (c->ext_tries < EXT_READ_RETRIES) {
+    c->ext_tries++;
+    WII_LOGD(HID, "Controller %d: extension ID read timeout, retry %d", idx, c->ext_tries);
+    ext_read_id(idx);
+    return;
+  }
+  WII_LOGW(HID, "Controller %d: extension ID read timed out", idx);
+  c->ext_state = EXT_FAILED;
+}
+
+static void ext_read_done(int idx, const uint8_t *report, uint16_t report_len) {
+  wii_controller_t *c = &controllers[idx];
+  const uint8_t *id = &report[6];
+
+  if (c->ext_state != EXT_READ_ID || report_len < 6 + WII_EXT_ID_LEN || (report[4] << 8 | report[5]) != (EXT_REG_ID & 0xffff)) {
+    return;
+  }
+  if (report[3] & 0x0f) {
+    WII_LOGW(HID, "Controller %d: extension ID unreadable (0x%02x)", idx, report[3]);
+    c->ext_state = EXT_FAILED;
+    return;
+  }
+  memcpy(c->ext.id, id, WII_EXT_ID_LEN);
+  c->ext.type = wii_ext_identify(id);
+  WII_LOGI(HID, "Controller %d: extension %06x%06x (%s)", idx, id[0] << 16 | id[1] << 8 | id[2], id[3] << 16 | id[4] << 8 | id[5],
+           (uintptr_t)(c->ext.type == WII_EXT_NUNCHUK ? "Nunchuk" : c->ext.type == WII_EXT_CLASSIC ? "Classic Controller" : "unknown"));
+  c->ext_state = EXT_ACTIVE;
+  ir_check_mode(idx);
+  hid_set_report_mode(idx);
+}
+
+// Extension bytes of a data report
+static void ext_data(int idx, const uint8_t *data) {
+  wii_controller_t *c = &controllers[idx];
+
+  if (c->mp_state == MP_ACTIVE) {
+    wii_motion_update(&c->motion, data, &c->accel.out, c->last_report);
+  } else if (c->ext_state == EXT_ACTIVE) {
+    wii_ext_update(&c->ext, data);
+  }
+}
+
+/***************************************************************************
+ * Accelerometer calibration
+ *
+ * Read once from the remote's EEPROM and kept in NVS per remote; until the
+ * read completes typical values are used.
+ ***************************************************************************/
+static void accel_start(int idx) {
+  wii_controller_t *c = &controllers[idx];
+  wii_accel_calib_t calib;
+  char key[NVS_ADDR_BLOB_KEY_LEN];
+  size_t len = sizeof(calib);
+
+  nvs_addr_key('a', c->addr, key);
+  if (nvs_read_blob(nvs_namespace, key, &calib, &len) == ESP_OK && len == sizeof(calib)) {
+    wii_accel_init(&c->accel, &calib);
+    return;
+  }
+  wii_accel_calib_default(&calib);
+  wii_accel_init(&c->accel, &calib);
+
+  hid_read(idx, 0x00, WII_ACCEL_CALIB_ADDR, WII_ACCEL_CALIB_LEN);
+}
+
+// 0x21: BB BB SE AA AA DD*16, S: size - 1, E: error
+static void accel_read_done(int idx, const uint8_t *report, uint16_t report_len) {
+  wii_controller_t *c = &controllers[idx];
+  wii_accel_calib_t calib;
+  char key[NVS_ADDR_BLOB_KEY_LEN];
+
+  if (report_len < 6 + WII_ACCEL_CALIB_LEN || (report[4] << 8 | report[5]) != WII_ACCEL_CALIB_ADDR) {
+    return;
+  }
+  if ((report[3] & 0x0f) || !wii_accel_calib_parse(&report[6], &calib)) {
+    WII_LOGW(HID, "Controller %d: accelerometer calibration unreadable (0x%02x), using defaults", idx, report[3]);
+    return;
+  }
+  WII_LOGI(HID, "Controller %d: accelerometer zero %u/%u/%u", idx, calib.zero[0], calib.zero[1], calib.zero[2]);
+  WII_LOGI(HID, "Controller %d: accelerometer 1g %u/%u/%u", idx, calib.one[0], calib.one[1], calib.one[2]);
+  wii_accel_init(&c->accel, &calib);
+  if (c->replay) {
+    return;
   }
+  nvs_addr_key('a', c->addr, key);
+  nvs_write_blob(nvs_namespace, key, &calib, sizeof(calib));
 }
@@ -18,9 +18,187 @@
 #define BTN_UP 0x0800
 #define BTN_PLUS 0x1000
 
-uint8_t wii_isReady(void);
-uint16_t wii_getButton(void);
-uint16_t wii_getLed(void);
-void wii_setLed(uint16_t led);
+// Number of Wii Remotes connected at the same time; the index is the player number - 1
+#define WII_MAX_CONTROLLERS 4
+
+// Durations of the connection phases in ms, 0 if the phase was skipped
+typedef struct {
+  uint32_t page;         // until ACL connection
+  uint32_t sdp;          // SDP query
+  uint32_t l2cap;        // HID control and interrupt channels
+  uint32_t total;        // from attempt start to ready
+  uint32_t first_report; // from attempt start to first input report
+  uint8_t incoming;      // remote connected to us
+} wii_connect_timing_t;
+
+// Input report timing, counted from the connection or the last reset
+#define WII_STATS_HIST_BINS 16
+#define WII_STATS_HIST_BIN_US 2000 // last bin holds everything above
+#define WII_STATS_GAP_US 50000     // intervals counted as gap
+typedef struct {
+  int64_t since;                        // esp_timer time of the start
+  uint32_t reports;                     // all input reports
+  uint32_t by_type[0x20];               // reports 0x20..0x3f
+  uint32_t intervals;                   // reports - 1
+  uint32_t interval_min_us;
+  uint32_t interval_max_us;
+  uint64_t interval_sum_us;             // avg = sum / intervals
+  uint32_t hist[WII_STATS_HIST_BINS];   // inter-arrival times
+  uint32_t gaps;
+  uint32_t gap_max_us;
+  int64_t last_gap;                     // esp_timer time of the report ending the last gap
+} wii_report_stats_t;
+
+// Accelerometer, filters are Q8 IIR coefficients set by wii_setAccelFilter()
+#define WII_ACCEL_ONE_G 1024
+typedef struct {
+  int16_t x, y, z;    // raw 10 bit samples
+  int16_t gx, gy, gz; // low pass filtered, WII_ACCEL_ONE_G units
+  int16_t hx, hy, hz; // high pass filtered, 0 when disabled
+  int16_t pitch;      // centidegrees, from the low pass output
+  int16_t roll;
+} wii_accel_t;
+
+// MotionPlus orientation
+typedef struct {
+  int32_t q[4];    // quaternion w, x, y, z, Q30 (1 << 30 = 1.0)
+  int32_t rate[3]; // rotation around x, y, z, Q16 rad/s
+} wii_motion_t;
+
+// IR camera pointer; camera pixels 1024 x 768, a dot at x 1023 was not seen
+#define WII_IR_DOTS 4
+#define WII_IR_WIDTH 1024
+#define WII_IR_HEIGHT 768
+typedef struct {
+  struct {
+    int16_t x, y;
+    uint8_t size;  // 0..15 in extended mode, 0 in basic mode
+  } dot[WII_IR_DOTS];
+  uint8_t visible; // sensor bar in view, x/y hold the last position otherwise
+  int16_t x, y;    // filtered pointer, roll compensated and mirrored to the pointing direction
+  int64_t time;    // esp_timer time of the report the pointer came from
+} wii_ir_t;
+
+// Extension controller, decoded per type; sticks and triggers 0..255, sticks centred about 128
+#define WII_EXT_NONE 0
+#define WII_EXT_NUNCHUK 1
+#define WII_EXT_CLASSIC 2
+#define WII_EXT_UNKNOWN 0xff
+// Nunchuk buttons
+#define WII_EXT_BTN_Z 0x0001
+#define WII_EXT_BTN_C 0x0002
+// Classic Controller buttons
+#define WII_EXT_CC_BTN_UP 0x0001
+#define WII_EXT_CC_BTN_LEFT 0x0002
+#define WII_EXT_CC_BTN_ZR 0x0004
+#define WII_EXT_CC_BTN_X 0x0008
+#define WII_EXT_CC_BTN_A 0x0010
+#define WII_EXT_CC_BTN_Y 0x0020
+#define WII_EXT_CC_BTN_B 0x0040
+#define WII_EXT_CC_BTN_ZL 0x0080
+#define WII_EXT_CC_BTN_R 0x0200
+#define WII_EXT_CC_BTN_PLUS 0x0400
+#define WII_EXT_CC_BTN_HOME 0x0800
+#define WII_EXT_CC_BTN_MINUS 0x1000
+#define WII_EXT_CC_BTN_L 0x2000
+#define WII_EXT_CC_BTN_DOWN 0x4000
+#define WII_EXT_CC_BTN_RIGHT 0x8000
+#define WII_EXT_CC_BTN_MASK 0xfeff
+typedef struct {
+  uint8_t type;       // WII_EXT_
+  uint8_t id[6];      // as read from the extension
+  uint8_t lx, ly;     // Nunchuk stick or Classic left stick
+  uint8_t rx, ry;     // Classic right stick
+  uint8_t lt, rt;     // Classic analog triggers
+  uint16_t btn;       // WII_EXT_BTN_ or WII_EXT_CC_BTN_, 1 = pressed
+  int16_t ax, ay, az; // Nunchuk accelerometer, raw 10 bit
+} wii_ext_t;
+
+// Consistent snapshot of a controller, published after each input report; see wii_getState()
+#define WII_STATE_MOTION 0x01 // motion is valid
+#define WII_STATE_IR 0x02     // ir is valid
+#define WII_STATE_EXT 0x04    // ext is valid
+typedef struct {
+  uint32_t version; // publications so far, a gap between two snapshots means missed updates
+  int64_t time;     // esp_timer time of the report
+  uint8_t valid;    // WII_STATE_
+  uint16_t btn;
+  wii_accel_t accel;
+  wii_motion_t motion;
+  wii_ir_t ir;
+  wii_ext_t ext;
+} wii_state_t;
+
+// Rumble patterns for wii_playRumble()
+#define WII_RUMBLE_STOP 0
+#define WII_RUMBLE_CLICK 1
+#define WII_RUMBLE_BUZZ 2
+#define WII_RUMBLE_PULSE 3
+#define WII_RUMBLE_HEARTBEAT 4
+#define WII_RUMBLE_RAMP_UP 5
+#define WII_RUMBLE_RAMP_DOWN 6
+#define WII_RUMBLE_PATTERNS 7
+
+// Speaker stream, 4 bit ADPCM
+#define WII_SPEAKER_RATE_MIN 2000 // Hz
+#define WII_SPEAKER_RATE_MAX 4000
+#define WII_SPEAKER_VOLUME 0x40
+typedef struct {
+  uint32_t reports;   // 0x18 reports sent
+  uint32_t underruns; // reports padded with silence
+  uint32_t dropped;   // samples that did not fit into the ring
+  uint32_t late;      // reports skipped because the link was busy for too long
+} wii_speaker_stats_t;
+
+// Input action bindings for wii_setActionMap(); a binding list ends with kind WII_BIND_END.
+// A binding is complete when all its buttons are down; ms is its time limit or period.
+#define WII_BIND_END 0
+#define WII_BIND_PRESS 1      // complete, in any order
+#define WII_BIND_CHORD 2      // complete within ms of the first of its buttons
+#define WII_BIND_SEQUENCE 3   // seq[] steps one after another, at most ms apart
+#define WII_BIND_LONG_PRESS 4 // held complete for ms
+#define WII_BIND_DOUBLE_TAP 5 // completed twice within ms
+#define WII_BIND_REPEAT 6     // complete, then every ms while held (turbo)
+#define WII_BIND_SEQ_MAX 4
+typedef struct {
+  uint8_t kind;
+  uint8_t action;                 // application defined, reported by wii_getAction()
+  uint16_t buttons;               // BTN_ mask, unused by WII_BIND_SEQUENCE
+  uint16_t ms;
+  uint16_t seq[WII_BIND_SEQ_MAX]; // WII_BIND_SEQUENCE: BTN_ mask of each step, 0 ends
+} wii_binding_t;
+typedef struct {
+  uint8_t idx;
+  uint8_t action;
+  int64_t time; // esp_timer time of the report or deadline that triggered the action
+} wii_action_t;
+
+// Link profiles; AUTO switches to IDLE (sniff) after a while without input and back on input
+#define WII_LINK_AUTO 0
+#define WII_LINK_LOW_LATENCY 1
+#define WII_LINK_IDLE 2
+
+uint8_t wii_isReady(uint8_t idx);
+uint8_t wii_getState(uint8_t idx, wii_state_t *state);
+uint16_t wii_getButton(uint8_t idx);
+uint8_t wii_getAccel(uint8_t idx, wii_accel_t *accel);
+void wii_setAccelFilter(uint8_t idx, uint16_t lowpass, uint16_t highpass);
+uint8_t wii_getMotion(uint8_t idx, wii_motion_t *motion);
+uint8_t wii_getIR(uint8_t idx, wii_ir_t *ir);
+uint8_t wii_getExtension(uint8_t idx, wii_ext_t *ext);
+uint16_t wii_getLed(uint8_t idx);
+void wii_setLed(uint8_t idx, uint16_t led);
+void wii_playRumble(uint8_t idx, uint8_t pattern);
+uint8_t wii_speakerStart(uint8_t idx, uint16_t rate, uint8_t volume);
+void wii_speakerStop(uint8_t idx);
+uint16_t wii_speakerWrite(uint8_t idx, const int16_t *pcm, uint16_t n);
+uint8_t wii_getSpeakerStats(uint8_t idx, wii_speaker_stats_t *stats);
+uint8_t wii_getConnectTiming(uint8_t idx, wii_connect_timing_t *timing);
+uint8_t wii_getReportStats(uint8_t idx, wii_report_stats_t *stats);
+void wii_resetReportStats(uint8_t idx);
+void wii_setActionMap(const wii_binding_t *bindings);
+uint8_t wii_getAction(wii_action_t *action);
+void wii_setLinkProfile(uint8_t idx, uint8_t profile);
+uint8_t wii_getLinkProfile(uint8_t idx);
 
 #endif /* __ESP32_WIIREMOTE_H__ */
\ No newline at end of file
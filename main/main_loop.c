@@ -1,100 +1,169 @@
 /*
  * Application main
  */
+#include "bench.h"
 #include "esp32_wiiremote.h"
+#include "wii_log.h"
+#include "wii_replay.h"
+#include "wii_snoop.h"
 
 #include "TFT_ST7735_SPI.h"
+#include "esp_timer.h"
+#ifdef HOST_BUILD
+#include "host.h"
+#endif
 
 /***************************************************************************
  * Definitions & variables
  ***************************************************************************/
 #define W _width
 #define H _height
-static uint8_t connected = 0;
+static uint8_t connected = 0; // number of connected remotes
 static uint8_t disp_rot = 0;
+static const char *rotation_names[] = {"PORTRAIT", "LANDSCAPE", "PORTRAIT FLIP", "LANDSCAPE FLIP"};
+
+// 1: run the startup benchmarks in bench.c
+#define APP_BENCHMARK 0
 
 /***************************************************************************
  * Prototypes
  ***************************************************************************/
 void redraw(void);
+void frame(void);
 void waitFrame(void);
+static void actions(void);
 
 /***************************************************************************
  * Application routines
  ***************************************************************************/
-static int16_t x = 0;
-static int16_t y = 0;
+static int16_t x[WII_MAX_CONTROLLERS];
+static int16_t y[WII_MAX_CONTROLLERS];
+static const color_t cursorColor[WII_MAX_CONTROLLERS] = {{0, 128, 255}, {255, 64, 64}, {64, 255, 64}, {255, 255, 0}};
+
+// Pointer latency from report arrival to drawing, logged every LATENCY_FRAMES frames
+#define LATENCY_FRAMES 300
+static uint32_t latencyMin = UINT32_MAX;
+static uint32_t latencyMax;
+static uint64_t latencySum;
+static uint32_t latencyCount;
+
+// Display draw cost per frame, logged every DRAW_STATS_FRAMES frames
+#define DRAW_STATS_FRAMES 300
+static uint64_t drawPixelsSum;
+static uint64_t drawBytesSum;
+static uint64_t drawBusSum;
+static uint32_t drawBusMax;
+static uint32_t drawFrames;
+
+// Input actions
+// 1 + 2 also fires the bindings of 1 and 2 alone, on purpose: bindings are matched independently
+// and a chord does not hold back single buttons. The buzz starts last and replaces their patterns.
+enum ACTION { ACT_COUNT, ACT_COUNT_RESET, ACT_CENTER, ACT_CLICK, ACT_HEARTBEAT, ACT_BUZZ, ACT_DUMP, ACT_ROTATE };
+static const wii_binding_t bindings[] = {
+    {.kind = WII_BIND_PRESS, .action = ACT_COUNT, .buttons = BTN_A},
+    {.kind = WII_BIND_PRESS, .action = ACT_COUNT_RESET, .buttons = BTN_MINUS},
+    {.kind = WII_BIND_PRESS, .action = ACT_CENTER, .buttons = BTN_PLUS},
+    {.kind = WII_BIND_REPEAT, .action = ACT_CLICK, .buttons = BTN_1, .ms = 250},
+    {.kind = WII_BIND_PRESS, .action = ACT_HEARTBEAT, .buttons = BTN_2},
+    {.kind = WII_BIND_CHORD, .action = ACT_BUZZ, .buttons = BTN_1 | BTN_2, .ms = 50},
+    {.kind = WII_BIND_LONG_PRESS, .action = ACT_DUMP, .buttons = BTN_HOME, .ms = 1000},
+    {.kind = WII_BIND_PRESS, .action = ACT_ROTATE, .buttons = BTN_B},
+    {.kind = WII_BIND_END},
+};
 
 // Application setup
 void setup() {
+    wii_setActionMap(bindings);
     tft_st7735_spi_init();
-    x = W / 2;
-    y = H / 2;
+#if APP_BENCHMARK
+    bench_run();
+#endif
+    for (int i = 0; i < WII_MAX_CONTROLLERS; i++) {
+        x[i] = W / 2;
+        y[i] = H / 2;
+    }
     redraw();
 }
 
-// Application main loop (once it returns, called again with new button states)
-static uint8_t countEnable = 1;
-static uint8_t cnt = 0;
-static uint8_t led;
-void loop(uint16_t btn, uint16_t pressed, uint16_t released) {
-    /// LED control
-    if (pressed & BTN_A) {
-        countEnable ^= 1;
+// Called for each connected remote every frame with its new button states
+// (the LEDs show the player number, or the counter toggled by A; the D-pad moves the cursor without IR)
+static uint8_t countEnable[WII_MAX_CONTROLLERS];
+static uint8_t cnt[WII_MAX_CONTROLLERS];
+void loop(uint8_t idx, uint16_t btn, uint16_t pressed, uint16_t released) {
+    uint8_t led = 1 << idx;
+    wii_ir_t ir;
+    if (countEnable[idx]) {
+        cnt[idx]++;
+        uint8_t c = cnt[idx] >> 4;
+        led = (c & 0b0001) << 3;
+        led |= (c & 0b0010) << 1;
+        led |= (c & 0b0100) >> 1;
+        led |= (c & 0b1000) >> 3;
     }
-
-    if (pressed & BTN_MINUS) {
-        cnt = 0xff;
+    if (led != wii_getLed(idx)) {
+        wii_setLed(idx, led);
     }
 
-    if (countEnable) {
-        cnt++;
+    // The D-pad moves the cursor while the sensor bar is out of view
+    if (!wii_getIR(idx, &ir) || !ir.visible) {
+        x[idx] += !!(btn & BTN_RIGHT) - !!(btn & BTN_LEFT);
+        y[idx] += !!(btn & BTN_DOWN) - !!(btn & BTN_UP);
     }
+}
 
-    uint8_t c = cnt >> 4;
-    led = (c & 0b0001) << 3;
-    led |= (c & 0b0010) << 1;
-    led |= (c & 0b0100) >> 1;
-    led |= (c & 0b1000) >> 3;
-    wii_setLed(led);
-
-    // Drawing
-    x += !!(btn & BTN_RIGHT) - !!(btn & BTN_LEFT);
-    y += !!(btn & BTN_DOWN) - !!(btn & BTN_UP);
-
-    if (pressed & BTN_PLUS) {
-        x = W / 2;
-        y = H / 2;
-        TFT_setRotation(disp_rot); // Clear
-    }
+// Actions since the last frame, in the order they happened
+// (1 clicks and repeats while held, 1 and 2 together buzz, HOME held dumps the captures)
+static void actions(void) {
+    wii_action_t a;
 
-    if (pressed & BTN_B) {
-        disp_rot = (disp_rot + 1) % 4;
-        TFT_setRotation(disp_rot);
-        switch (disp_rot) {
-        case 0:
-            printf("PORTRAIT");
+    while (wii_getAction(&a)) {
+        uint8_t idx = a.idx;
+        switch (a.action) {
+        case ACT_COUNT:
+            countEnable[idx] ^= 1;
+            break;
+        case ACT_COUNT_RESET:
+            cnt[idx] = 0xff;
+            break;
+        case ACT_CENTER:
+            x[idx] = W / 2;
+            y[idx] = H / 2;
+            TFT_setRotation(disp_rot); // Clear
             break;
-        case 1:
-            printf("LANDSCAPE");
+        case ACT_CLICK:
+            wii_playRumble(idx, WII_RUMBLE_CLICK);
             break;
-        case 2:
-            printf("PORTRAIT FLIP");
+        case ACT_HEARTBEAT:
+            wii_playRumble(idx, WII_RUMBLE_HEARTBEAT);
             break;
-        case 3:
-            printf("LANDSCAPE FLIP");
+        case ACT_BUZZ:
+            wii_playRumble(idx, WII_RUMBLE_BUZZ);
+            break;
+        case ACT_DUMP:
+            wii_snoop_dump();
+            wii_replay_dump();
+            break;
+        case ACT_ROTATE:
+            disp_rot = (disp_rot + 1) % 4;
+            TFT_setRotation(disp_rot);
+            WII_LOGI(APP, "%s", (uintptr_t)rotation_names[disp_rot]);
             break;
         }
-        printf("\n");
     }
+}
 
+// Called once per frame after all remotes were handled
+void frame() {
+    actions();
     redraw();
+#ifdef HOST_BUILD
+    host_frame();
+#endif
 
     waitFrame(); // wait next frame (60fps)
 }
 
 // Display redraw routine
-static color_t col;
 static TickType_t startTime = 0;
 static TickType_t now;
 static int32_t elapsedTimeMS;
@@ -102,16 +171,76 @@ static float fps;
 static int32_t drawCount = -1;
 static char fpsBuf[20];
 static char *ConnectWiiRemote = "Connect Wii Remote";
+
+// The IR pointer is read right before drawing to keep the latency below one frame;
+// _width and _height follow the rotation
+static void pointerUpdate(int i) {
+    wii_ir_t ir;
+    if (!wii_getIR(i, &ir) || !ir.visible) {
+        TFT_drawCircle(x[i], y[i], 10, cursorColor[i]); // last position, moved by the D-pad
+        return;
+    }
+    x[i] = ir.x * W / WII_IR_WIDTH;
+    y[i] = ir.y * H / WII_IR_HEIGHT;
+    TFT_drawCircle(x[i], y[i], 10, cursorColor[i]);
+
+    // a fast replay stamps reports ahead of the clock, those have no latency to measure
+    int64_t age = esp_timer_get_time() - ir.time;
+    if (age < 0) {
+        return;
+    }
+    uint32_t latency = (age > UINT32_MAX) ? UINT32_MAX : (uint32_t)age;
+    latencyMin = (latency < latencyMin) ? latency : latencyMin;
+    latencyMax = (latency > latencyMax) ? latency : latencyMax;
+    latencySum += latency;
+    latencyCount++;
+}
+
+// The counters are read and cleared once per frame, drawing done in loop() counts for the next frame
+static void drawStatsUpdate(void) {
+    tft_draw_stats_t st;
+    TFT_getDrawStats(&st, 1);
+    drawPixelsSum += st.pixels;
+    drawBytesSum += st.spi_bytes;
+    drawBusSum += st.bus_us;
+    drawBusMax = (st.bus_us > drawBusMax) ? st.bus_us : drawBusMax;
+    drawFrames++;
+    if (drawFrames < DRAW_STATS_FRAMES) {
+        return;
+    }
+    WII_LOGI(APP, "Draw per frame: %u px, %u SPI bytes, bus avg %u max %u us", (uint32_t)(drawPixelsSum / drawFrames),
+             (uint32_t)(drawBytesSum / drawFrames), (uint32_t)(drawBusSum / drawFrames), drawBusMax);
+    drawPixelsSum = 0;
+    drawBytesSum = 0;
+    drawBusSum = 0;
+    drawBusMax = 0;
+    drawFrames = 0;
+}
+
+static void latencyLog(void) {
+    if (drawCount % LATENCY_FRAMES || !latencyCount) {
+        return;
+    }
+    WII_LOGI(APP, "Pointer latency min %u avg %u max %u us, frame %u us", latencyMin, (uint32_t)(latencySum / latencyCount), latencyMax,
+             1000000 / 60);
+    latencyMin = UINT32_MAX;
+    latencyMax = 0;
+    latencySum = 0;
+    latencyCount = 0;
+}
+
 void redraw() {
-    col.r = 0;
-    col.g = 128;
-    col.b = 255;
-    TFT_drawCircle(x, y, 10, col);
+    for (int i = 0; i < WII_MAX_CONTROLLERS; i++) {
+        if (wii_isReady(i)) {
+            pointerUpdate(i);
+        }
+    }
     TFT_setFont(DEFAULT_FONT, NULL);
     _fg = TFT_WHITE;
     TFT_print("Wii Remote Test", 0, 0);
 
     drawCount++;
+    latencyLog();
     now = xTaskGetTickCount();
     if (startTime == 0) {
         startTime = now;
@@ -128,6 +257,7 @@ void redraw() {
         TFT_setFont(SMALL_FONT, NULL);
         TFT_print("FPS", 15 * 4, 24);
     }
+    drawStatsUpdate();
 #if 0
     if (!connected) {
         TFT_setFont(DEF_SMALL_FONT, NULL);
@@ -138,19 +268,20 @@ void redraw() {
 }
 
 // Wii Remote event handlers
-void wii_connected() {
-    connected = 1;
-    printf("Wii Remote connected.\n");
+void wii_connected(uint8_t idx) {
+    connected++;
+    countEnable[idx] = 0;
+    WII_LOGI(APP, "Wii Remote %d connected.", idx + 1);
 }
-void wii_disconnected() {
-    connected = 0;
-    printf("Wii Remote disconnected.\n");
+void wii_disconnected(uint8_t idx) {
+    connected--;
+    WII_LOGI(APP, "Wii Remote %d disconnected.", idx + 1);
 }
 
 // Utilities
+static const TickType_t xFrequency = 1000 / 60 / portTICK_PERIOD_MS; // 60 fps
 static TickType_t xLastWakeTime = 0;
 static TickType_t xNow;
-static const TickType_t xFrequency = 1000 / 60 / portTICK_PERIOD_MS; // 60 fps
 void waitFrame() {
     // Always wait at least one frame
     xNow = xTaskGetTickCount();
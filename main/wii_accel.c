@@ -0,0 +1,161 @@
+/*
+ * Accelerometer processing
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wii_accel.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define DEFAULT_ZERO 512
+#define DEFAULT_ONE 616 // typical, about 104 counts per g
+
+// atan(i / 64) in centidegrees
+static const uint16_t atan_lut[65] = {
+    0,    90,   179,  268,  358,  447,  536,  624,  713,  800,  888,  975,  1062,
+    1148, 1234, 1319, 1404, 1488, 1571, 1653, 1735, 1817, 1897, 1977, 2056, 2134,
+    2211, 2287, 2363, 2438, 2511, 2584, 2657, 2728, 2798, 2867, 2936, 3003, 3070,
+    3136, 3201, 3264, 3327, 3390, 3451, 3511, 3571, 3629, 3687, 3744, 3800, 3855,
+    3909, 3963, 4016, 4067, 4119, 4169, 4218, 4267, 4315, 4363, 4409, 4455, 4500,
+};
+
+/***************************************************************************
+ * Math
+ ***************************************************************************/
+// atan(n / d) for 0 <= n <= d <= 65535, d > 0
+static int32_t atan_octant(uint32_t n, uint32_t d) {
+    uint32_t r = (n << 16) / d; // Q16, 0..65536
+    uint32_t i = r >> 10;
+    uint32_t frac = r & 0x3ff;
+    if (i >= 64) {
+        return atan_lut[64];
+    }
+    return atan_lut[i] + (((atan_lut[i + 1] - atan_lut[i]) * frac) >> 10);
+}
+
+int16_t wii_atan2(int32_t y, int32_t x) {
+    uint32_t ax = (x < 0) ? -x : x;
+    uint32_t ay = (y < 0) ? -y : y;
+    int32_t a;
+
+    if (!ax && !ay) {
+        return 0;
+    }
+    a = (ay <= ax) ? atan_octant(ay, ax) : 9000 - atan_octant(ax, ay);
+    if (x < 0) {
+        a = 18000 - a;
+    }
+    return (y < 0) ? -a : a;
+}
+
+static uint32_t isqrt(uint32_t v) {
+    uint32_t r = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+/***************************************************************************
+ * Calibration
+ ***************************************************************************/
+uint8_t wii_accel_calib_parse(const uint8_t *data, wii_accel_calib_t *calib) {
+    uint8_t sum = 0x55;
+    int i;
+
+    for (i = 0; i < WII_ACCEL_CALIB_LEN - 1; i++) {
+        sum += data[i];
+    }
+    if (sum != data[WII_ACCEL_CALIB_LEN - 1]) {
+        return 0;
+    }
+    // 8 upper bits per axis, then a byte with the 2 lower bits of x, y, z
+    for (i = 0; i < 3; i++) {
+        calib->zero[i] = data[i] << 2 | ((data[3] >> (4 - i * 2)) & 3);
+        calib->one[i] = data[4 + i] << 2 | ((data[7] >> (4 - i * 2)) & 3);
+        if (calib->one[i] <= calib->zero[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void wii_accel_calib_default(wii_accel_calib_t *calib) {
+    int i;
+    for (i = 0; i < 3; i++) {
+        calib->zero[i] = DEFAULT_ZERO;
+        calib->one[i] = DEFAULT_ONE;
+    }
+}
+
+/***************************************************************************
+ * Pipeline
+ ***************************************************************************/
+// Filter settings survive, states restart
+void wii_accel_init(wii_accel_state_t *st, const wii_accel_calib_t *calib) {
+    uint16_t lp_alpha = st->lp_alpha ? st->lp_alpha : 256;
+    uint16_t hp_alpha = st->hp_alpha;
+    int i;
+
+    memset(st, 0, sizeof(wii_accel_state_t));
+    st->calib = *calib;
+    for (i = 0; i < 3; i++) {
+        st->scale[i] = (WII_ACCEL_ONE_G << 12) / (calib->one[i] - calib->zero[i]);
+    }
+    st->lp_alpha = lp_alpha;
+    st->hp_alpha = hp_alpha;
+}
+
+void wii_accel_set_filter(wii_accel_state_t *st, uint16_t lp_alpha, uint16_t hp_alpha) {
+    st->lp_alpha = (lp_alpha && lp_alpha <= 256) ? lp_alpha : 256;
+    st->hp_alpha = (hp_alpha <= 256) ? hp_alpha : 0;
+}
+
+void wii_accel_update(wii_accel_state_t *st, const uint8_t *data) {
+    wii_accel_t *o = &st->out;
+    int32_t g[3];
+    int i;
+
+    // x has 10 bits, y and z 9; the lower bits hide in the button bytes
+    o->x = data[2] << 2 | ((data[0] >> 5) & 3);
+    o->y = data[3] << 2 | ((data[1] >> 4) & 2);
+    o->z = data[4] << 2 | ((data[1] >> 5) & 2);
+
+    g[0] = ((o->x - st->calib.zero[0]) * st->scale[0]) >> 12;
+    g[1] = ((o->y - st->calib.zero[1]) * st->scale[1]) >> 12;
+    g[2] = ((o->z - st->calib.zero[2]) * st->scale[2]) >> 12;
+
+    for (i = 0; i < 3; i++) {
+        if (!st->primed) {
+            st->lp[i] = g[i] << 8;
+            st->hp_lp[i] = g[i] << 8;
+        } else {
+            st->lp[i] += ((g[i] << 8) - st->lp[i]) * st->lp_alpha >> 8;
+            st->hp_lp[i] += ((g[i] << 8) - st->hp_lp[i]) * st->hp_alpha >> 8;
+        }
+    }
+    st->primed = 1;
+
+    o->gx = st->lp[0] >> 8;
+    o->gy = st->lp[1] >> 8;
+    o->gz = st->lp[2] >> 8;
+    // high pass = input minus its own low pass
+    o->hx = st->hp_alpha ? g[0] - (st->hp_lp[0] >> 8) : 0;
+    o->hy = st->hp_alpha ? g[1] - (st->hp_lp[1] >> 8) : 0;
+    o->hz = st->hp_alpha ? g[2] - (st->hp_lp[2] >> 8) : 0;
+
+    o->roll = wii_atan2(o->gx, o->gz);
+    o->pitch = wii_atan2(o->gy, isqrt(o->gx * o->gx + o->gz * o->gz));
+}
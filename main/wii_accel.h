@@ -0,0 +1,48 @@
+#ifndef __WII_ACCEL_H__
+#define __WII_ACCEL_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * Accelerometer processing
+ *
+ * Raw 10 bit samples are converted with the remote's calibration to fixed
+ * point g (WII_ACCEL_ONE_G), filtered by first order IIR filters, and
+ * pitch/roll are derived from the low pass output. No heap, no floats.
+ */
+
+#define WII_ACCEL_CALIB_ADDR 0x0016 // in the remote's EEPROM
+#define WII_ACCEL_CALIB_LEN 10
+
+typedef struct {
+    uint16_t zero[3]; // x, y, z at 0 g
+    uint16_t one[3];  // x, y, z at 1 g
+} wii_accel_calib_t;
+
+typedef struct {
+    wii_accel_calib_t calib;
+    int32_t scale[3];   // WII_ACCEL_ONE_G << 12 / (one - zero)
+    uint16_t lp_alpha;  // Q8, 256: no filtering
+    uint16_t hp_alpha;  // Q8, 0: high pass off
+    int32_t lp[3];      // Q8 states
+    int32_t hp_lp[3];
+    uint8_t primed;     // states hold a sample
+    wii_accel_t out;
+} wii_accel_state_t;
+
+// Decode the EEPROM block, returns 0 if the checksum is wrong
+uint8_t wii_accel_calib_parse(const uint8_t *data, wii_accel_calib_t *calib);
+void wii_accel_calib_default(wii_accel_calib_t *calib);
+
+void wii_accel_init(wii_accel_state_t *st, const wii_accel_calib_t *calib);
+void wii_accel_set_filter(wii_accel_state_t *st, uint16_t lp_alpha, uint16_t hp_alpha);
+
+// Process the button and accelerometer bytes of a 0x31 style report (BB BB AA AA AA)
+void wii_accel_update(wii_accel_state_t *st, const uint8_t *data);
+
+// atan2 in centidegrees (-18000..18000)
+int16_t wii_atan2(int32_t y, int32_t x);
+
+#endif /* __WII_ACCEL_H__ */
@@ -0,0 +1,203 @@
+/*
+ * Input action mapping
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wii_action.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+// written by the BTstack thread, read by the application
+static wii_action_t queue[WII_ACTION_QUEUE];
+static volatile uint32_t q_head;
+static volatile uint32_t q_tail;
+static uint32_t q_dropped;
+
+/***************************************************************************
+ * Queue
+ ***************************************************************************/
+static void emit(const wii_action_state_t *st, const wii_action_rule_t *r, int64_t time) {
+    uint32_t head = q_head;
+    if (head - q_tail >= WII_ACTION_QUEUE) {
+        q_dropped++;
+        return;
+    }
+    wii_action_t *a = &queue[head & (WII_ACTION_QUEUE - 1)];
+    a->idx = st->idx;
+    a->action = r->action;
+    a->time = time;
+    q_head = head + 1;
+}
+
+uint8_t wii_action_pop(wii_action_t *action) {
+    uint32_t tail = q_tail;
+    if (tail == q_head) {
+        return 0;
+    }
+    *action = queue[tail & (WII_ACTION_QUEUE - 1)];
+    q_tail = tail + 1;
+    return 1;
+}
+
+uint32_t wii_action_dropped(void) { return q_dropped; }
+
+/***************************************************************************
+ * Compilation
+ ***************************************************************************/
+uint8_t wii_action_compile(wii_action_map_t *map, const wii_binding_t *bindings) {
+    const wii_binding_t *b;
+    int i;
+
+    memset(map, 0, sizeof(wii_action_map_t));
+    for (b = bindings; b && b->kind != WII_BIND_END && map->count < WII_ACTION_MAX_BINDINGS; b++) {
+        wii_action_rule_t *r = &map->rule[map->count];
+        if (b->kind > WII_BIND_REPEAT || (b->kind == WII_BIND_REPEAT && !b->ms)) {
+            continue;
+        }
+        memset(r, 0, sizeof(wii_action_rule_t)); // a binding left out may have been started here
+        r->kind = b->kind;
+        r->action = b->action;
+        r->us = (int32_t)b->ms * 1000;
+        if (b->kind == WII_BIND_SEQUENCE) {
+            for (i = 0; i < WII_BIND_SEQ_MAX && b->seq[i]; i++) {
+                r->seq[i] = b->seq[i];
+                r->buttons |= b->seq[i];
+            }
+            r->steps = i;
+        } else {
+            r->buttons = b->buttons;
+        }
+        if (!r->buttons) {
+            continue;
+        }
+        for (i = 0; i < 16; i++) {
+            if (r->buttons & (1 << i)) {
+                map->by_button[i] |= 1UL << map->count;
+            }
+        }
+        map->count++;
+    }
+    return map->count;
+}
+
+void wii_action_reset(wii_action_state_t *st, uint8_t idx) {
+    memset(st, 0, sizeof(wii_action_state_t));
+    st->idx = idx;
+}
+
+/***************************************************************************
+ * Evaluation
+ ***************************************************************************/
+void wii_action_poll(const wii_action_map_t *map, wii_action_state_t *st, int64_t time) {
+    uint32_t pending = st->pending;
+
+    while (pending) {
+        int n = __builtin_ctz(pending);
+        const wii_action_rule_t *r = &map->rule[n];
+        wii_action_rule_state_t *rs = &st->r[n];
+        pending &= pending - 1;
+
+        if (rs->due > time) {
+            continue;
+        }
+        if (r->kind == WII_BIND_LONG_PRESS) {
+            emit(st, r, rs->due);
+            st->pending &= ~(1UL << n);
+            continue;
+        }
+        while (rs->due <= time) { // repeat, catching up on a late poll
+            emit(st, r, rs->due);
+            rs->due += r->us;
+        }
+    }
+}
+
+// Sequence step on a press of one of its buttons
+static void sequence(const wii_action_state_t *st, const wii_action_rule_t *r, wii_action_rule_state_t *rs, uint16_t btn,
+                     uint16_t pressed, int64_t time) {
+    if (rs->step && time - rs->t0 > r->us) {
+        rs->step = 0;
+    }
+    uint16_t want = r->seq[rs->step];
+    if (pressed & ~want) {
+        rs->step = 0; // wrong button, it may start the sequence again
+        want = r->seq[0];
+        if (pressed & ~want) {
+            return;
+        }
+    }
+    if ((btn & want) != want) {
+        return; // step with several buttons, the rest is still to come
+    }
+    rs->t0 = time;
+    if (++rs->step == r->steps) {
+        rs->step = 0;
+        emit(st, r, time);
+    }
+}
+
+void wii_action_input(const wii_action_map_t *map, wii_action_state_t *st, uint16_t btn, int64_t time) {
+    uint16_t prev = st->btn;
+    uint16_t changed = prev ^ btn;
+    uint32_t rules = 0;
+
+    st->btn = btn;
+    while (changed) {
+        rules |= map->by_button[__builtin_ctz(changed)];
+        changed &= changed - 1;
+    }
+    while (rules) {
+        int n = __builtin_ctz(rules);
+        const wii_action_rule_t *r = &map->rule[n];
+        wii_action_rule_state_t *rs = &st->r[n];
+        uint8_t was = (prev & r->buttons) == r->buttons;
+        uint8_t is = (btn & r->buttons) == r->buttons;
+        rules &= rules - 1;
+
+        switch (r->kind) {
+        case WII_BIND_PRESS:
+            if (is && !was) {
+                emit(st, r, time);
+            }
+            break;
+        case WII_BIND_CHORD:
+            if (!(prev & r->buttons)) {
+                rs->t0 = time;
+            }
+            if (is && !was && time - rs->t0 <= r->us) {
+                emit(st, r, time);
+            }
+            break;
+        case WII_BIND_SEQUENCE:
+            if (btn & ~prev & r->buttons) {
+                sequence(st, r, rs, btn, btn & ~prev & r->buttons, time);
+            }
+            break;
+        case WII_BIND_LONG_PRESS:
+        case WII_BIND_REPEAT:
+            if (is && !was) {
+                if (r->kind == WII_BIND_REPEAT) {
+                    emit(st, r, time);
+                }
+                rs->due = time + r->us;
+                st->pending |= 1UL << n;
+            } else if (!is) {
+                st->pending &= ~(1UL << n);
+            }
+            break;
+        case WII_BIND_DOUBLE_TAP:
+            if (is && !was) {
+                if (rs->step && time - rs->t0 <= r->us) {
+                    rs->step = 0;
+                    emit(st, r, time);
+                } else {
+                    rs->step = 1;
+                    rs->t0 = time;
+                }
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __WII_ACTION_H__
+#define __WII_ACTION_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * Input action mapping
+ *
+ * A binding list is compiled into a table of rules and, per button, a mask
+ * of the rules that look at it. A button change only visits the rules of the
+ * changed buttons; deadlines (long press, repeat) only the rules that have one
+ * pending. Actions go to a single producer, single consumer queue and carry
+ * the time of the report or deadline that triggered them.
+ */
+
+#define WII_ACTION_MAX_BINDINGS 32 // one bit per rule in the masks
+#define WII_ACTION_QUEUE 32        // power of 2
+
+typedef struct {
+    uint8_t kind;
+    uint8_t action;
+    uint8_t steps;    // WII_BIND_SEQUENCE
+    uint16_t buttons; // all buttons the rule looks at
+    int32_t us;
+    uint16_t seq[WII_BIND_SEQ_MAX];
+} wii_action_rule_t;
+
+typedef struct {
+    wii_action_rule_t rule[WII_ACTION_MAX_BINDINGS];
+    uint8_t count;
+    uint32_t by_button[16]; // rules using each button bit
+} wii_action_map_t;
+
+typedef struct {
+    int64_t t0;   // chord start, first tap or last sequence step
+    int64_t due;  // long press or next repeat
+    uint8_t step; // sequence step or taps
+} wii_action_rule_state_t;
+
+// Per controller
+typedef struct {
+    uint8_t idx;
+    uint16_t btn;
+    uint32_t pending; // rules with a deadline
+    wii_action_rule_state_t r[WII_ACTION_MAX_BINDINGS];
+} wii_action_state_t;
+
+// Returns the number of rules; bindings past WII_ACTION_MAX_BINDINGS or with a bad ms are left out
+uint8_t wii_action_compile(wii_action_map_t *map, const wii_binding_t *bindings);
+void wii_action_reset(wii_action_state_t *st, uint8_t idx);
+// Fire deadlines up to time, then before each input
+void wii_action_poll(const wii_action_map_t *map, wii_action_state_t *st, int64_t time);
+void wii_action_input(const wii_action_map_t *map, wii_action_state_t *st, uint16_t btn, int64_t time);
+// Consumer side of the queue
+uint8_t wii_action_pop(wii_action_t *action);
+uint32_t wii_action_dropped(void);
+
+#endif /* __WII_ACTION_H__ */
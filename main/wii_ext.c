@@ -0,0 +1,63 @@
+/*
+ * Extension controllers
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wii_ext.h"
+
+/***************************************************************************
+ * Identification
+ ***************************************************************************/
+// The last two ID bytes tell the type; the first ones vary between revisions
+uint8_t wii_ext_identify(const uint8_t *id) {
+    if (id[2] != 0xa4 || id[3] != 0x20) {
+        return WII_EXT_UNKNOWN;
+    }
+    if (id[4] == 0x00 && id[5] == 0x00) {
+        return WII_EXT_NUNCHUK;
+    }
+    if (id[4] == 0x01 && id[5] == 0x01) {
+        return WII_EXT_CLASSIC;
+    }
+    return WII_EXT_UNKNOWN;
+}
+
+/***************************************************************************
+ * Decoding
+ ***************************************************************************/
+// SX SY AX AY AZ [AZ AY AX low bits, C, Z], buttons active low
+static void nunchuk_update(wii_ext_t *ext, const uint8_t *d) {
+    ext->lx = d[0];
+    ext->ly = d[1];
+    ext->ax = d[2] << 2 | ((d[5] >> 2) & 3);
+    ext->ay = d[3] << 2 | ((d[5] >> 4) & 3);
+    ext->az = d[4] << 2 | ((d[5] >> 6) & 3);
+    ext->btn = (~d[5] & 0x01) ? WII_EXT_BTN_Z : 0;
+    ext->btn |= (~d[5] & 0x02) ? WII_EXT_BTN_C : 0;
+}
+
+// 6 bit left stick, 5 bit right stick and triggers spread over the first 4 bytes,
+// then 16 buttons active low; scaled to 8 bits
+static void classic_update(wii_ext_t *ext, const uint8_t *d) {
+    ext->lx = (d[0] & 0x3f) << 2;
+    ext->ly = (d[1] & 0x3f) << 2;
+    ext->rx = ((d[0] & 0xc0) >> 3 | (d[1] & 0xc0) >> 5 | (d[2] & 0x80) >> 7) << 3;
+    ext->ry = (d[2] & 0x1f) << 3;
+    ext->lt = ((d[2] & 0x60) >> 2 | (d[3] & 0xe0) >> 5) << 3;
+    ext->rt = (d[3] & 0x1f) << 3;
+    ext->btn = ~(d[4] << 8 | d[5]) & WII_EXT_CC_BTN_MASK;
+}
+
+void wii_ext_update(wii_ext_t *ext, const uint8_t *data) {
+    switch (ext->type) {
+    case WII_EXT_NUNCHUK:
+        nunchuk_update(ext, data);
+        break;
+    case WII_EXT_CLASSIC:
+        classic_update(ext, data);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef __WII_EXT_H__
+#define __WII_EXT_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * Extension controllers
+ *
+ * Identification from the 6 ID bytes at 0xa400fa and decoding of the 6
+ * extension bytes of a data report. The extension is initialised the
+ * unencrypted way (0x55 to 0xa400f0, 0x00 to 0xa400fb), so data is plain.
+ */
+
+#define WII_EXT_ID_LEN 6
+
+uint8_t wii_ext_identify(const uint8_t *id);
+void wii_ext_update(wii_ext_t *ext, const uint8_t *data);
+
+#endif /* __WII_EXT_H__ */
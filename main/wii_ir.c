@@ -0,0 +1,184 @@
+/*
+ * IR camera pointer
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wii_ir.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define CENTER_X (WII_IR_WIDTH / 2)
+#define CENTER_Y (WII_IR_HEIGHT / 2)
+#define NO_DOT 1023
+#define MIN_SEPARATION 16 // camera pixels between the two bar dots
+#define MAX_DT_US 100000
+
+/***************************************************************************
+ * Helpers
+ ***************************************************************************/
+static uint32_t isqrt(uint32_t v) {
+    uint32_t r = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+static inline int32_t iabs(int32_t v) { return (v < 0) ? -v : v; }
+
+static inline int32_t clamp(int32_t v, int32_t lo, int32_t hi) { return (v < lo) ? lo : (v > hi) ? hi : v; }
+
+// Smoothing factor of a first order low pass, Q16
+static int32_t alpha_q16(int32_t te_us, int32_t cutoff_mhz) {
+    int32_t tau_us = 159154943 / cutoff_mhz; // 10^9 / (2 pi fc)
+    return (int32_t)(((int64_t)te_us << 16) / (te_us + tau_us));
+}
+
+/***************************************************************************
+ * Decoding
+ ***************************************************************************/
+// basic: two dots in 5 bytes, X1 Y1 [Y1 X1 Y2 X2 high bits] X2 Y2
+static void decode_basic(wii_ir_t *o, const uint8_t *d) {
+    int i;
+    for (i = 0; i < 2; i++, d += 5) {
+        o->dot[i * 2].x = d[0] | (d[2] & 0x30) << 4;
+        o->dot[i * 2].y = d[1] | (d[2] & 0xc0) << 2;
+        o->dot[i * 2 + 1].x = d[3] | (d[2] & 0x03) << 8;
+        o->dot[i * 2 + 1].y = d[4] | (d[2] & 0x0c) << 6;
+        o->dot[i * 2].size = o->dot[i * 2 + 1].size = 0;
+    }
+}
+
+// extended: X Y [Y X high bits, size]
+static void decode_extended(wii_ir_t *o, const uint8_t *d) {
+    int i;
+    for (i = 0; i < WII_IR_DOTS; i++, d += 3) {
+        o->dot[i].x = d[0] | (d[2] & 0x30) << 4;
+        o->dot[i].y = d[1] | (d[2] & 0xc0) << 2;
+        o->dot[i].size = d[2] & 0x0f;
+    }
+}
+
+/***************************************************************************
+ * Pointer
+ ***************************************************************************/
+void wii_ir_init(wii_ir_state_t *st) {
+    memset(st, 0, sizeof(wii_ir_state_t));
+    st->out.x = CENTER_X;
+    st->out.y = CENTER_Y;
+}
+
+// Pick the sensor bar: the most horizontal pair, or the closest to the last separation
+static uint8_t find_pair(wii_ir_state_t *st, int *a, int *b) {
+    const wii_ir_t *o = &st->out;
+    int32_t best = INT32_MAX;
+    int i, j;
+
+    for (i = 0; i < WII_IR_DOTS; i++) {
+        if (o->dot[i].x == NO_DOT) {
+            continue;
+        }
+        for (j = i + 1; j < WII_IR_DOTS; j++) {
+            if (o->dot[j].x == NO_DOT) {
+                continue;
+            }
+            int32_t dx = iabs(o->dot[j].x - o->dot[i].x);
+            int32_t dy = iabs(o->dot[j].y - o->dot[i].y);
+            if (dx + dy < MIN_SEPARATION) {
+                continue;
+            }
+            int32_t cost = st->paired ? iabs(dx - iabs(st->sep_x)) + iabs(dy - iabs(st->sep_y)) : dy * 2 - dx;
+            if (cost < best) {
+                best = cost;
+                *a = i;
+                *b = j;
+            }
+        }
+    }
+    return best != INT32_MAX;
+}
+
+void wii_ir_update(wii_ir_state_t *st, const uint8_t *data, uint8_t extended, int64_t time) {
+    wii_ir_t *o = &st->out;
+    int32_t lx, ly, rx, ry, mx, my;
+    int a, b, i;
+
+    if (extended) {
+        decode_extended(o, data);
+    } else {
+        decode_basic(o, data);
+    }
+    o->time = time;
+
+    if (find_pair(st, &a, &b)) {
+        if (o->dot[a].x > o->dot[b].x) {
+            i = a, a = b, b = i;
+        }
+        lx = o->dot[a].x, ly = o->dot[a].y;
+        rx = o->dot[b].x, ry = o->dot[b].y;
+        st->sep_x = rx - lx;
+        st->sep_y = ry - ly;
+        st->paired = 1;
+    } else if (st->paired) {
+        // one dot: the other one is where the last separation puts it
+        for (a = 0; a < WII_IR_DOTS && o->dot[a].x == NO_DOT; a++) {
+        }
+        if (a == WII_IR_DOTS) {
+            o->visible = 0;
+            return;
+        }
+        int32_t px = CENTER_X - (o->x - CENTER_X); // last midpoint before mirroring, roughly
+        if (o->dot[a].x < px) {
+            lx = o->dot[a].x, ly = o->dot[a].y;
+            rx = lx + st->sep_x, ry = ly + st->sep_y;
+        } else {
+            rx = o->dot[a].x, ry = o->dot[a].y;
+            lx = rx - st->sep_x, ly = ry - st->sep_y;
+        }
+    } else {
+        o->visible = 0;
+        return;
+    }
+
+    // midpoint rotated back by the roll the bar shows, then mirrored to pointing direction
+    int32_t dx = rx - lx, dy = ry - ly;
+    int32_t d = isqrt(dx * dx + dy * dy);
+    int32_t ox = (lx + rx) / 2 - CENTER_X;
+    int32_t oy = (ly + ry) / 2 - CENTER_Y;
+    mx = CENTER_X - (ox * dx + oy * dy) / d;
+    my = CENTER_Y + (oy * dx - ox * dy) / d;
+    mx = clamp(mx, 0, WII_IR_WIDTH - 1) << 4;
+    my = clamp(my, 0, WII_IR_HEIGHT - 1) << 4;
+
+    // one euro filter: the cutoff rises with speed, steady at rest, responsive when moving
+    int32_t te = (int32_t)(time - st->last_time);
+    st->last_time = time;
+    if (!st->primed || !o->visible || te <= 0 || te > MAX_DT_US) {
+        st->fx = mx, st->fy = my;
+        st->dx = st->dy = 0;
+        st->primed = 1;
+    } else {
+        int32_t ad = alpha_q16(te, WII_IR_D_CUTOFF_MHZ);
+        st->dx += (int32_t)(((int64_t)(mx - st->fx) * 1000000 / te - st->dx) * ad >> 16);
+        st->dy += (int32_t)(((int64_t)(my - st->fy) * 1000000 / te - st->dy) * ad >> 16);
+        int32_t speed = (iabs(st->dx) + iabs(st->dy)) >> 4;
+        int32_t a = alpha_q16(te, WII_IR_MIN_CUTOFF_MHZ + WII_IR_BETA * speed);
+        st->fx += (int32_t)((int64_t)(mx - st->fx) * a >> 16);
+        st->fy += (int32_t)((int64_t)(my - st->fy) * a >> 16);
+    }
+    o->x = st->fx >> 4;
+    o->y = st->fy >> 4;
+    o->visible = 1;
+}
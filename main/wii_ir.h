@@ -0,0 +1,34 @@
+#ifndef __WII_IR_H__
+#define __WII_IR_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * IR camera pointer
+ *
+ * Decodes basic (10 byte) and extended (12 byte) IR data, finds the two
+ * sensor bar dots, compensates the remote's roll and smooths the pointer
+ * with a fixed point one euro filter.
+ */
+
+#define WII_IR_MIN_CUTOFF_MHZ 1000 // one euro filter: cutoff at rest
+#define WII_IR_BETA 4              // cutoff increase in mHz per camera px/s
+#define WII_IR_D_CUTOFF_MHZ 1000   // cutoff of the speed estimate
+
+typedef struct {
+    int32_t fx, fy;   // filtered pointer, Q4 camera pixels
+    int32_t dx, dy;   // filtered speed, Q4 camera px/s
+    int16_t sep_x;    // last dot pair vector, left to right
+    int16_t sep_y;
+    uint8_t primed;
+    uint8_t paired;   // sep_x/sep_y are valid
+    int64_t last_time;
+    wii_ir_t out;
+} wii_ir_state_t;
+
+void wii_ir_init(wii_ir_state_t *st);
+void wii_ir_update(wii_ir_state_t *st, const uint8_t *data, uint8_t extended, int64_t time);
+
+#endif /* __WII_IR_H__ */
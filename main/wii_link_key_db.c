@@ -0,0 +1,167 @@
+/*
+ * Link key DB in NVS
+ *
+ * All entries are kept in RAM and written as one blob on every change,
+ * so the BTstack iterator works without NVS enumeration. Lookups update
+ * the use order in RAM only, it is written with the next change.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "wii_link_key_db.h"
+#include "wii_log.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+typedef struct {
+    bd_addr_t addr;
+    uint8_t type; // link_key_type_t, 0xff if the entry is empty
+    link_key_t key;
+    uint32_t seq; // higher is more recently used
+} link_key_entry_t;
+
+static const char *nvs_namespace = "wiiremote";
+static const char *nvs_key = "linkkeys";
+
+static link_key_entry_t entries[WII_LINK_KEY_DB_SIZE];
+static uint32_t seq = 0;
+
+/***************************************************************************
+ * NVS
+ ***************************************************************************/
+static void db_load(void) {
+    nvs_handle handle;
+    size_t len = sizeof(entries);
+    int i;
+
+    memset(entries, 0xff, sizeof(entries));
+    seq = 0;
+
+    nvs_flash_init();
+    if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(handle, nvs_key, entries, &len) != ESP_OK || len != sizeof(entries)) {
+        memset(entries, 0xff, sizeof(entries));
+    }
+    nvs_close(handle);
+
+    for (i = 0; i < WII_LINK_KEY_DB_SIZE; i++) {
+        if (entries[i].type != 0xff && entries[i].seq > seq) {
+            seq = entries[i].seq;
+        }
+    }
+}
+
+static void db_store(void) {
+    nvs_handle handle;
+    esp_err_t err = nvs_open(nvs_namespace, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, nvs_key, entries, sizeof(entries));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        WII_LOGE(NVS, "Link key DB: store failed (%s)", (uintptr_t)esp_err_to_name(err));
+    }
+}
+
+static int db_find(bd_addr_t addr) {
+    int i;
+    for (i = 0; i < WII_LINK_KEY_DB_SIZE; i++) {
+        if (entries[i].type != 0xff && bd_addr_cmp(entries[i].addr, addr) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/***************************************************************************
+ * btstack_link_key_db_t
+ ***************************************************************************/
+static void db_open(void) { db_load(); }
+
+static void db_set_local_bd_addr(bd_addr_t bd_addr) { UNUSED(bd_addr); }
+
+static void db_close(void) {}
+
+static int db_get_link_key(bd_addr_t bd_addr, link_key_t link_key, link_key_type_t *type) {
+    int i = db_find(bd_addr);
+    if (i < 0) {
+        return 0;
+    }
+    memcpy(link_key, entries[i].key, sizeof(link_key_t));
+    *type = (link_key_type_t)entries[i].type;
+    entries[i].seq = ++seq; // a use counts as recent too, in RAM until the next store
+    return 1;
+}
+
+static void db_put_link_key(bd_addr_t bd_addr, link_key_t link_key, link_key_type_t type) {
+    int i = db_find(bd_addr);
+    int j;
+
+    if (i < 0) {
+        // free entry, or the least recently used one
+        i = 0;
+        for (j = 0; j < WII_LINK_KEY_DB_SIZE; j++) {
+            if (entries[j].type == 0xff) {
+                i = j;
+                break;
+            }
+            if (entries[j].seq < entries[i].seq) {
+                i = j;
+            }
+        }
+    }
+    memcpy(entries[i].addr, bd_addr, sizeof(bd_addr_t));
+    memcpy(entries[i].key, link_key, sizeof(link_key_t));
+    entries[i].type = (uint8_t)type;
+    entries[i].seq = ++seq;
+    WII_LOGI(NVS, "Link key DB: stored key for " WII_LOG_ADDR_FMT, WII_LOG_ADDR(bd_addr));
+    db_store();
+}
+
+static void db_delete_link_key(bd_addr_t bd_addr) {
+    int i = db_find(bd_addr);
+    if (i < 0) {
+        return;
+    }
+    memset(&entries[i], 0xff, sizeof(link_key_entry_t));
+    WII_LOGI(NVS, "Link key DB: deleted key for " WII_LOG_ADDR_FMT, WII_LOG_ADDR(bd_addr));
+    db_store();
+}
+
+static int db_iterator_init(btstack_link_key_iterator_t *it) {
+    it->context = (void *)0;
+    return 1;
+}
+
+static int db_iterator_get_next(btstack_link_key_iterator_t *it, bd_addr_t bd_addr, link_key_t link_key, link_key_type_t *type) {
+    int i;
+    for (i = (int)(intptr_t)it->context; i < WII_LINK_KEY_DB_SIZE; i++) {
+        if (entries[i].type != 0xff) {
+            memcpy(bd_addr, entries[i].addr, sizeof(bd_addr_t));
+            memcpy(link_key, entries[i].key, sizeof(link_key_t));
+            *type = (link_key_type_t)entries[i].type;
+            it->context = (void *)(intptr_t)(i + 1);
+            return 1;
+        }
+    }
+    it->context = (void *)(intptr_t)i;
+    return 0;
+}
+
+static void db_iterator_done(btstack_link_key_iterator_t *it) { UNUSED(it); }
+
+static const btstack_link_key_db_t link_key_db_nvs = {
+    &db_open, &db_set_local_bd_addr, &db_close, &db_get_link_key, &db_put_link_key, &db_delete_link_key, &db_iterator_init, &db_iterator_get_next, &db_iterator_done,
+};
+
+const btstack_link_key_db_t *wii_link_key_db_nvs_instance(void) { return &link_key_db_nvs; }
@@ -0,0 +1,12 @@
+#ifndef __WII_LINK_KEY_DB_H__
+#define __WII_LINK_KEY_DB_H__
+
+#include "btstack.h"
+
+// Number of remotes whose link keys are kept, the least recently used one is replaced
+#define WII_LINK_KEY_DB_SIZE 8
+
+// Link key DB stored in NVS, for hci_set_link_key_db()
+const btstack_link_key_db_t *wii_link_key_db_nvs_instance(void);
+
+#endif /* __WII_LINK_KEY_DB_H__ */
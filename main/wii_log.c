@@ -0,0 +1,196 @@
+/*
+ * Deferred logging
+ *
+ * Each core has its own ring. Producers reserve a slot by compare-and-set
+ * on the head, fill it and publish it by writing its sequence number, so
+ * tasks and ISRs can log without locks. The drain task consumes in order
+ * and stops at a slot which is reserved but not yet published.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+
+#include "wii_log.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define WII_LOG_RING_MASK (WII_LOG_RING_SIZE - 1)
+#define WII_LOG_DRAIN_INTERVAL_MS 20
+
+// Record contents are visible before the sequence number or tail that publishes them
+#ifdef HOST_BUILD
+#define MEMW() __sync_synchronize()
+#else
+#define MEMW() __asm__ __volatile__("memw" ::: "memory")
+#endif
+
+typedef struct {
+    volatile uint32_t seq; // head value + 1 once the record is complete
+    const char *fmt;
+    uint32_t time;         // us, wraps after 71 minutes
+    uint8_t level;
+    uint8_t module;
+    uint8_t nargs;
+    uintptr_t args[WII_LOG_MAX_ARGS];
+} log_record_t;
+
+typedef struct {
+    volatile uint32_t head; // next slot to reserve
+    volatile uint32_t tail; // next slot to drain
+    volatile uint32_t dropped;
+    log_record_t slots[WII_LOG_RING_SIZE];
+} log_ring_t;
+
+static log_ring_t rings[portNUM_PROCESSORS];
+static TaskHandle_t drain_task_handle = NULL;
+
+static const char level_chars[] = "-EWID";
+static const char *module_names[WII_LOG_MOD_COUNT] = {"bt", "hid", "nvs", "app"};
+
+/***************************************************************************
+ * Producer
+ ***************************************************************************/
+static uint32_t atomic_add(volatile uint32_t *addr, uint32_t val) {
+    uint32_t old, set;
+    do {
+        old = *addr;
+        set = old + val;
+        uxPortCompareSet(addr, old, &set);
+    } while (set != old);
+    return old;
+}
+
+void wii_log_write(uint8_t level, uint8_t module, const char *fmt, const uintptr_t *args, uint32_t nargs) {
+    log_ring_t *ring = &rings[xPortGetCoreID()];
+    log_record_t *r;
+    uint32_t head, set;
+
+    do {
+        head = ring->head;
+        if (head - ring->tail >= WII_LOG_RING_SIZE) {
+            atomic_add(&ring->dropped, 1);
+            return;
+        }
+        set = head + 1;
+        uxPortCompareSet(&ring->head, head, &set);
+    } while (set != head);
+
+    if (nargs > WII_LOG_MAX_ARGS) {
+        nargs = WII_LOG_MAX_ARGS;
+    }
+    r = &ring->slots[head & WII_LOG_RING_MASK];
+    r->fmt = fmt;
+    r->time = (uint32_t)esp_timer_get_time();
+    r->level = level;
+    r->module = module;
+    r->nargs = nargs;
+    memcpy(r->args, args, nargs * sizeof(uintptr_t));
+    MEMW();
+    r->seq = head + 1;
+}
+
+uint32_t wii_log_dropped(void) {
+    uint32_t dropped = 0;
+    int i;
+    for (i = 0; i < portNUM_PROCESSORS; i++) {
+        dropped += rings[i].dropped;
+    }
+    return dropped;
+}
+
+/***************************************************************************
+ * Drain task
+ ***************************************************************************/
+// Print the message, every conversion gets its argument with the type it expects
+static void print_message(const char *fmt, const uintptr_t *a) {
+    char spec[16];
+    const char *p;
+    uint32_t n = 0;
+
+    while (*fmt) {
+        if (*fmt != '%' || fmt[1] == '%') {
+            putchar(*fmt);
+            fmt += (*fmt == '%') ? 2 : 1;
+            continue;
+        }
+        // %[flags][width][.precision]conversion
+        p = fmt + 1;
+        while (*p && strchr("-+ #0123456789.", *p)) {
+            p++;
+        }
+        if (!*p || p - fmt + 2 > sizeof(spec) || n >= WII_LOG_MAX_ARGS) {
+            fputs(fmt, stdout);
+            return;
+        }
+        memcpy(spec, fmt, p - fmt + 1);
+        spec[p - fmt + 1] = '\0';
+        if (*p == 's') {
+            printf(spec, (const char *)a[n]);
+        } else if (*p == 'p') {
+            printf(spec, (void *)a[n]);
+        } else {
+            printf(spec, (uint32_t)a[n]);
+        }
+        n++;
+        fmt = p + 1;
+    }
+}
+
+static void print_record(const log_record_t *r) {
+    printf("%c (%u) %s: ", level_chars[r->level < sizeof(level_chars) - 1 ? r->level : 0], r->time,
+           (r->module < WII_LOG_MOD_COUNT) ? module_names[r->module] : "?");
+    print_message(r->fmt, r->args);
+    printf("\n");
+}
+
+// Print published records of one ring, returns the number printed
+static int drain_ring(log_ring_t *ring) {
+    log_record_t r;
+    int n = 0;
+
+    while (ring->tail != ring->head) {
+        log_record_t *slot = &ring->slots[ring->tail & WII_LOG_RING_MASK];
+        if (slot->seq != ring->tail + 1) {
+            break; // reserved, still being written
+        }
+        memcpy(&r, slot, sizeof(log_record_t));
+        memset(&r.args[r.nargs], 0, (WII_LOG_MAX_ARGS - r.nargs) * sizeof(uintptr_t));
+        MEMW();
+        ring->tail++; // slot may be reused from here on
+        print_record(&r);
+        n++;
+    }
+    return n;
+}
+
+static void drain_task(void *arg) {
+    uint32_t reported_drops = 0;
+    int i;
+    (void)arg;
+
+    while (1) {
+        for (i = 0; i < portNUM_PROCESSORS; i++) {
+            drain_ring(&rings[i]);
+        }
+        uint32_t drops = wii_log_dropped();
+        if (drops != reported_drops) {
+            printf("W log: %u records dropped\n", drops - reported_drops);
+            reported_drops = drops;
+        }
+        vTaskDelay(WII_LOG_DRAIN_INTERVAL_MS / portTICK_PERIOD_MS);
+    }
+}
+
+void wii_log_init(void) {
+    if (drain_task_handle) {
+        return;
+    }
+    // below the BTstack and main loop tasks, UART time is spent when nothing else runs
+    xTaskCreate(&drain_task, "wii_log", 3072, NULL, tskIDLE_PRIORITY + 1, &drain_task_handle);
+}
@@ -0,0 +1,71 @@
+#ifndef __WII_LOG_H__
+#define __WII_LOG_H__
+
+#include <stdint.h>
+
+/*
+ * Deferred logging
+ *
+ * WII_LOGx(module, fmt, ...) stores the format pointer and up to
+ * WII_LOG_MAX_ARGS pointer sized arguments into a ring, a low priority task
+ * formats and prints them later. Therefore:
+ *  - fmt must be a string literal
+ *  - conversions are %s, %p or 32 bit integers (no length modifiers, no
+ *    64 bit or double), more than WII_LOG_MAX_ARGS arguments fail to compile
+ *  - %s arguments must be cast to uintptr_t and point to constant strings,
+ *    never to buffers (use WII_LOG_ADDR() for BD addresses)
+ */
+
+#define WII_LOG_LEVEL_NONE 0
+#define WII_LOG_LEVEL_ERROR 1
+#define WII_LOG_LEVEL_WARN 2
+#define WII_LOG_LEVEL_INFO 3
+#define WII_LOG_LEVEL_DEBUG 4
+
+// Modules, a bit each in WII_LOG_MODULES
+#define WII_LOG_MOD_BT 0  // GAP, HCI, L2CAP, connection manager
+#define WII_LOG_MOD_HID 1 // reports from the remotes
+#define WII_LOG_MOD_NVS 2
+#define WII_LOG_MOD_APP 3
+#define WII_LOG_MOD_COUNT 4
+
+// Compile time filters, can be overridden by CFLAGS in component.mk
+#ifndef WII_LOG_LEVEL
+#define WII_LOG_LEVEL WII_LOG_LEVEL_INFO
+#endif
+#ifndef WII_LOG_MODULES
+#define WII_LOG_MODULES 0xff
+#endif
+
+#define WII_LOG_MAX_ARGS 6
+#define WII_LOG_RING_SIZE 128 // records per core, power of 2
+
+// BD address as two arguments
+#define WII_LOG_ADDR_FMT "%04X%08X"
+#define WII_LOG_ADDR(a) ((a)[0] << 8 | (a)[1]), ((uint32_t)(a)[2] << 24 | (a)[3] << 16 | (a)[4] << 8 | (a)[5])
+
+#define WII_LOG(level, mod, fmt, ...)                                                                                  \
+    do {                                                                                                               \
+        if ((level) <= WII_LOG_LEVEL && (WII_LOG_MODULES & (1 << WII_LOG_MOD_##mod))) {                                \
+            const uintptr_t _wii_log_args[] = {0, ##__VA_ARGS__};                                                      \
+            _Static_assert(sizeof(_wii_log_args) / sizeof(uintptr_t) - 1 <= WII_LOG_MAX_ARGS, "too many log args");    \
+            wii_log_write((level), WII_LOG_MOD_##mod, fmt, &_wii_log_args[1],                                          \
+                          sizeof(_wii_log_args) / sizeof(uintptr_t) - 1);                                              \
+        }                                                                                                              \
+    } while (0)
+
+#define WII_LOGE(mod, fmt, ...) WII_LOG(WII_LOG_LEVEL_ERROR, mod, fmt, ##__VA_ARGS__)
+#define WII_LOGW(mod, fmt, ...) WII_LOG(WII_LOG_LEVEL_WARN, mod, fmt, ##__VA_ARGS__)
+#define WII_LOGI(mod, fmt, ...) WII_LOG(WII_LOG_LEVEL_INFO, mod, fmt, ##__VA_ARGS__)
+#define WII_LOGD(mod, fmt, ...) WII_LOG(WII_LOG_LEVEL_DEBUG, mod, fmt, ##__VA_ARGS__)
+
+// Start the drain task, records written before are kept
+void wii_log_init(void);
+
+// Store a record, never blocks; drops the record if the ring is full
+void wii_log_write(uint8_t level, uint8_t module, const char *fmt, const uintptr_t *args, uint32_t nargs);
+
+// Records dropped so far on all cores
+uint32_t wii_log_dropped(void);
+
+#endif /* __WII_LOG_H__ */
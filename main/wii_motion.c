@@ -0,0 +1,190 @@
+/*
+ * MotionPlus gyro decoding and Mahony orientation filter
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wii_motion.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define Q30_ONE (1L << 30)
+// counts to Q16 rad/s, x64: slow mode 20 counts per deg/s, fast mode 4.4
+#define RATE_SLOW_X64 3660
+#define RATE_FAST_X64 16637
+#define STILL_COUNTS 160   // below this difference to the bias the axis is at rest
+#define STILL_SAMPLES 32   // at rest this long before the bias follows
+#define MAX_DT_US 50000    // longer gaps are not integrated
+#define ACCEL_MIN (WII_ACCEL_ONE_G * 8 / 10)
+#define ACCEL_MAX (WII_ACCEL_ONE_G * 12 / 10)
+
+/***************************************************************************
+ * Math
+ ***************************************************************************/
+static inline int32_t mul_q30(int32_t a, int32_t b) { return (int32_t)(((int64_t)a * b) >> 30); }
+
+static uint32_t isqrt(uint32_t v) {
+    uint32_t r = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+// q stays close to unit length, one Newton step of 1/sqrt is enough
+static void normalize(int32_t *q) {
+    int64_t n2 = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        n2 += ((int64_t)q[i] * q[i]) >> 30;
+    }
+    int32_t k = (int32_t)((3 * (int64_t)Q30_ONE - n2) >> 1); // (3 - |q|^2) / 2
+    for (i = 0; i < 4; i++) {
+        q[i] = mul_q30(q[i], k);
+    }
+}
+
+/***************************************************************************
+ * Filter
+ ***************************************************************************/
+void wii_motion_init(wii_motion_state_t *st) {
+    memset(st, 0, sizeof(wii_motion_state_t));
+    st->q[0] = Q30_ONE;
+    st->out.q[0] = Q30_ONE;
+}
+
+// The first gyro zero is the mean of STILL_SAMPLES samples in a row that stay
+// close to the first of them; one taken while moving would never be corrected
+static void calibrate_bias(wii_motion_state_t *st, const uint16_t *raw) {
+    int i;
+    for (i = 0; i < 3; i++) {
+        int32_t d = raw[i] - st->bias[i];
+        if (!st->still || d > STILL_COUNTS || d < -STILL_COUNTS) {
+            break;
+        }
+    }
+    if (i < 3) {
+        memcpy(st->bias, raw, sizeof(st->bias)); // start over from this sample
+        st->still = 0;
+        memset(st->cal_sum, 0, sizeof(st->cal_sum));
+    }
+    for (i = 0; i < 3; i++) {
+        st->cal_sum[i] += raw[i];
+    }
+    if (++st->still < STILL_SAMPLES) {
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        st->bias[i] = (st->cal_sum[i] + STILL_SAMPLES / 2) / STILL_SAMPLES;
+    }
+    st->calibrated = 1;
+}
+
+// Update the gyro zero while the remote lies still
+static void track_bias(wii_motion_state_t *st, const uint16_t *raw) {
+    int i;
+    if (!st->calibrated) {
+        calibrate_bias(st, raw);
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        int32_t d = raw[i] - st->bias[i];
+        if (d > STILL_COUNTS || d < -STILL_COUNTS) {
+            st->still = 0;
+            return;
+        }
+    }
+    if (st->still < STILL_SAMPLES) {
+        st->still++;
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        st->bias[i] += (int32_t)(raw[i] - st->bias[i]) / 32;
+    }
+}
+
+uint8_t wii_motion_update(wii_motion_state_t *st, const uint8_t *ext, const wii_accel_t *accel, int64_t time) {
+    uint16_t raw[3];
+    uint8_t slow[3];
+    int32_t w[3];
+    int32_t *q = st->q;
+    int32_t dt;
+    int i;
+
+    if ((ext[5] & 0x03) != 0x02) {
+        return 0; // extension pass-through data
+    }
+    // 14 bit yaw, roll, pitch: low byte, then 6 high bits above the slow mode flags
+    raw[0] = ext[0] | (ext[3] & 0xfc) << 6; // yaw
+    raw[1] = ext[1] | (ext[4] & 0xfc) << 6; // roll
+    raw[2] = ext[2] | (ext[5] & 0xfc) << 6; // pitch
+    slow[0] = ext[3] & 0x02;
+    slow[1] = ext[4] & 0x02;
+    slow[2] = ext[3] & 0x01;
+
+    track_bias(st, raw);
+    dt = st->primed ? (int32_t)(time - st->last_time) : 0;
+    st->last_time = time;
+    st->primed = 1;
+    if (!st->calibrated) {
+        return 1; // rates stay 0
+    }
+
+    // body rates around x (pitch), y (roll), z (yaw)
+    for (i = 0; i < 3; i++) {
+        int32_t c = raw[i] - st->bias[i];
+        w[2 - i] = (c * (slow[i] ? RATE_SLOW_X64 : RATE_FAST_X64)) >> 6;
+    }
+    st->out.rate[0] = w[0];
+    st->out.rate[1] = w[1];
+    st->out.rate[2] = w[2];
+    if (dt <= 0 || dt > MAX_DT_US) {
+        return 1;
+    }
+
+    // accelerometer correction, skipped under strong acceleration
+    uint32_t an = isqrt(accel->gx * accel->gx + accel->gy * accel->gy + accel->gz * accel->gz);
+    if (an >= ACCEL_MIN && an <= ACCEL_MAX) {
+        int32_t ax = ((int64_t)accel->gx << 30) / an;
+        int32_t ay = ((int64_t)accel->gy << 30) / an;
+        int32_t az = ((int64_t)accel->gz << 30) / an;
+        // gravity as seen from the current estimate
+        int32_t vx = (int32_t)(((int64_t)q[1] * q[3] - (int64_t)q[0] * q[2]) >> 29);
+        int32_t vy = (int32_t)(((int64_t)q[0] * q[1] + (int64_t)q[2] * q[3]) >> 29);
+        int32_t vz = mul_q30(q[0], q[0]) - mul_q30(q[1], q[1]) - mul_q30(q[2], q[2]) + mul_q30(q[3], q[3]);
+        int32_t e[3];
+        e[0] = mul_q30(ay, vz) - mul_q30(az, vy);
+        e[1] = mul_q30(az, vx) - mul_q30(ax, vz);
+        e[2] = mul_q30(ax, vy) - mul_q30(ay, vx);
+        for (i = 0; i < 3; i++) {
+            st->integral[i] += (int32_t)(((((int64_t)e[i] * WII_MOTION_KI_Q8) >> 22) * dt) / 1000000);
+            w[i] += (int32_t)(((int64_t)e[i] * WII_MOTION_KP_Q8) >> 22) + st->integral[i];
+        }
+    }
+
+    // q += q * (0, w) * dt / 2; half angles in Q30 rad
+    int32_t scale = dt << 13; // Q16 -> Q30 / 2 with dt in us: * 2^13 / 10^6
+    int32_t hx = (int32_t)(((int64_t)w[0] * scale) / 1000000);
+    int32_t hy = (int32_t)(((int64_t)w[1] * scale) / 1000000);
+    int32_t hz = (int32_t)(((int64_t)w[2] * scale) / 1000000);
+    int32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    q[0] = q0 - mul_q30(q1, hx) - mul_q30(q2, hy) - mul_q30(q3, hz);
+    q[1] = q1 + mul_q30(q0, hx) + mul_q30(q2, hz) - mul_q30(q3, hy);
+    q[2] = q2 + mul_q30(q0, hy) - mul_q30(q1, hz) + mul_q30(q3, hx);
+    q[3] = q3 + mul_q30(q0, hz) + mul_q30(q1, hy) - mul_q30(q2, hx);
+    normalize(q);
+
+    memcpy(st->out.q, q, sizeof(st->out.q));
+    return 1;
+}
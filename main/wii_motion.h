@@ -0,0 +1,36 @@
+#ifndef __WII_MOTION_H__
+#define __WII_MOTION_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * MotionPlus gyro decoding and Mahony orientation filter
+ *
+ * Fixed point throughout: quaternion Q30, rates Q16 rad/s, accel
+ * in WII_ACCEL_ONE_G units. One update per report, no heap. Nothing is
+ * integrated until the gyro zero was measured with the remote at rest.
+ */
+
+#define WII_MOTION_KP_Q8 256 // proportional gain, 1.0 rad/s
+#define WII_MOTION_KI_Q8 3   // integral gain, ~0.01 rad/s
+
+typedef struct {
+    int32_t q[4];         // w, x, y, z Q30
+    int32_t integral[3];  // Mahony integral term, Q16 rad/s
+    uint16_t bias[3];     // gyro zero, raw counts
+    uint16_t still;       // samples in a row without rotation
+    uint8_t calibrated;   // bias measured at rest, rates are integrated
+    uint32_t cal_sum[3];  // samples at rest so far, while not calibrated
+    uint8_t primed;
+    int64_t last_time;    // us
+    wii_motion_t out;
+} wii_motion_state_t;
+
+void wii_motion_init(wii_motion_state_t *st);
+
+// 6 MotionPlus bytes of a data report; returns 0 if they are not MotionPlus data
+uint8_t wii_motion_update(wii_motion_state_t *st, const uint8_t *ext, const wii_accel_t *accel, int64_t time);
+
+#endif /* __WII_MOTION_H__ */
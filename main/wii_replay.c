@@ -0,0 +1,230 @@
+/*
+ * Input report record and replay
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "btstack.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "wii_log.h"
+#include "wii_replay.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define RECORD_HEADER_LEN 6
+#define POLL_MS 100 // start and stop requests from other tasks
+#define DUMP_LINE_BYTES 48
+
+static const uint8_t magic[4] = {'W', 'R', 'P', 'L'};
+
+// recording
+static uint8_t *rec_buf = NULL;
+static uint32_t rec_size = 0;
+static uint32_t rec_len = 0;
+static volatile uint8_t recording = 0;
+static int64_t rec_start;
+
+// replay
+enum REQUEST { REQ_NONE, REQ_START, REQ_STOP };
+static volatile uint32_t request = REQ_NONE; // set by other tasks, taken with take_request()
+static const uint8_t *req_data;
+static uint32_t req_len;
+static uint8_t req_fast;
+
+static const uint8_t *play_data;
+static uint32_t play_len;
+static uint32_t play_pos;
+static uint8_t play_fast;
+static uint8_t playing = 0;
+static int64_t play_base; // esp_timer time of recorded time 0
+static int64_t play_wall; // esp_timer time the replay started
+static uint32_t play_count;
+
+static wii_replay_sink_t sink_cb;
+static wii_replay_done_t done_cb;
+static btstack_timer_source_t replay_timer;
+
+static void replay_timer_handler(btstack_timer_source_t *ts);
+
+/***************************************************************************
+ * Recording
+ ***************************************************************************/
+void wii_replay_init(wii_replay_sink_t sink, wii_replay_done_t done) {
+    sink_cb = sink;
+    done_cb = done;
+    btstack_run_loop_set_timer_handler(&replay_timer, &replay_timer_handler);
+    btstack_run_loop_set_timer(&replay_timer, POLL_MS);
+    btstack_run_loop_add_timer(&replay_timer);
+#if WII_REPLAY_RECORD
+    wii_replay_record_start();
+#endif
+}
+
+// Starts over, the previous recording is lost
+void wii_replay_record_start(void) {
+    if (!rec_buf) {
+        rec_buf = heap_caps_malloc(WII_REPLAY_BUF_PSRAM, MALLOC_CAP_SPIRAM);
+        rec_size = WII_REPLAY_BUF_PSRAM;
+        if (!rec_buf) {
+            rec_buf = heap_caps_malloc(WII_REPLAY_BUF_INTERNAL, MALLOC_CAP_8BIT);
+            rec_size = rec_buf ? WII_REPLAY_BUF_INTERNAL : 0;
+        }
+        if (!rec_buf) {
+            WII_LOGE(APP, "Report recording: no memory");
+            return;
+        }
+    }
+    memcpy(rec_buf, magic, sizeof(magic));
+    rec_buf[4] = WII_REPLAY_VERSION;
+    rec_len = WII_REPLAY_HEADER_LEN;
+    rec_start = esp_timer_get_time();
+    recording = 1;
+}
+
+void wii_replay_record_stop(void) { recording = 0; }
+
+void wii_replay_record(uint8_t idx, const uint8_t *report, uint16_t len, int64_t time) {
+    uint8_t *p;
+
+    if (!recording || len > 255) {
+        return;
+    }
+    if (rec_len + RECORD_HEADER_LEN + len > rec_size) {
+        recording = 0;
+        WII_LOGW(APP, "Report recording full, %u bytes", rec_len);
+        return;
+    }
+    p = &rec_buf[rec_len];
+    little_endian_store_32(p, 0, (uint32_t)(time - rec_start));
+    p[4] = idx;
+    p[5] = len;
+    memcpy(&p[RECORD_HEADER_LEN], report, len);
+    rec_len += RECORD_HEADER_LEN + len;
+}
+
+// Stops the recording, then prints it
+void wii_replay_dump(void) {
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char out[5 + DUMP_LINE_BYTES / 3 * 4 + 2];
+    uint32_t pos, i;
+
+    recording = 0;
+    if (!rec_buf) {
+        return;
+    }
+    printf("\nWRPL-BEGIN %u bytes\n", rec_len);
+    for (pos = 0; pos < rec_len; pos += DUMP_LINE_BYTES) {
+        uint32_t n = (rec_len - pos < DUMP_LINE_BYTES) ? rec_len - pos : DUMP_LINE_BYTES;
+        const uint8_t *d = &rec_buf[pos];
+        int o = 5;
+        memcpy(out, "WRPL:", 5);
+        for (i = 0; i < n; i += 3) {
+            uint32_t v = d[i] << 16 | ((i + 1 < n) ? d[i + 1] << 8 : 0) | ((i + 2 < n) ? d[i + 2] : 0);
+            out[o++] = b64[(v >> 18) & 0x3f];
+            out[o++] = b64[(v >> 12) & 0x3f];
+            out[o++] = (i + 1 < n) ? b64[(v >> 6) & 0x3f] : '=';
+            out[o++] = (i + 2 < n) ? b64[v & 0x3f] : '=';
+        }
+        out[o++] = '\n';
+        fwrite(out, 1, o, stdout);
+        if ((pos / DUMP_LINE_BYTES & 63) == 63) {
+            vTaskDelay(1);
+        }
+    }
+    printf("WRPL-END\n");
+}
+
+/***************************************************************************
+ * Replay
+ ***************************************************************************/
+uint8_t wii_replay_start(const uint8_t *data, uint32_t len, uint8_t fast) {
+    if (len < WII_REPLAY_HEADER_LEN || memcmp(data, magic, sizeof(magic)) || data[4] != WII_REPLAY_VERSION) {
+        return 0;
+    }
+    req_data = data;
+    req_len = len;
+    req_fast = fast;
+    request = REQ_START;
+    return 1;
+}
+
+void wii_replay_stop(void) { request = REQ_STOP; }
+
+uint8_t wii_replay_active(void) { return playing || request == REQ_START; }
+
+static void replay_finish(void) {
+    int64_t wall = esp_timer_get_time() - play_wall;
+
+    playing = 0;
+    WII_LOGI(APP, "Replay: %u reports in %u us, %u reports/s", play_count, (uint32_t)wall,
+             wall ? (uint32_t)(play_count * 1000000LL / wall) : 0);
+    if (done_cb) {
+        done_cb();
+    }
+}
+
+// Hand out the reports that are due; returns the ms until the next one
+static uint32_t replay_run(void) {
+    int64_t now = esp_timer_get_time();
+    uint32_t n = 0;
+
+    while (play_pos + RECORD_HEADER_LEN <= play_len) {
+        const uint8_t *p = &play_data[play_pos];
+        int64_t t = play_base + little_endian_read_32(p, 0);
+        uint8_t len = p[5];
+
+        if (play_pos + RECORD_HEADER_LEN + len > play_len) {
+            break; // truncated capture
+        }
+        if (play_fast ? n == WII_REPLAY_BATCH : t > now) {
+            // rounded up, a timer due before the report would only re-arm itself
+            return play_fast ? 0 : (uint32_t)((t - now + 999) / 1000);
+        }
+        sink_cb(p[4], &p[RECORD_HEADER_LEN], len, t);
+        play_pos += RECORD_HEADER_LEN + len;
+        play_count++;
+        n++;
+    }
+    replay_finish();
+    return POLL_MS;
+}
+
+// A request set meanwhile stays for the next poll
+static uint32_t take_request(void) {
+    uint32_t old, set;
+    do {
+        old = request;
+        set = REQ_NONE;
+        uxPortCompareSet(&request, old, &set);
+    } while (set != old);
+    return old;
+}
+
+static void replay_timer_handler(btstack_timer_source_t *ts) {
+    uint32_t next = POLL_MS;
+    uint32_t req = take_request();
+
+    if (req == REQ_START) {
+        play_data = req_data;
+        play_len = req_len;
+        play_fast = req_fast;
+        play_pos = WII_REPLAY_HEADER_LEN;
+        play_count = 0;
+        play_wall = play_base = esp_timer_get_time();
+        playing = 1;
+    } else if (req == REQ_STOP && playing) {
+        replay_finish();
+    }
+    if (playing) {
+        next = replay_run();
+    }
+    btstack_run_loop_set_timer(ts, next);
+    btstack_run_loop_add_timer(ts);
+}
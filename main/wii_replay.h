@@ -0,0 +1,47 @@
+#ifndef __WII_REPLAY_H__
+#define __WII_REPLAY_H__
+
+#include <stdint.h>
+
+/*
+ * Input report record and replay
+ *
+ * Capture format, little endian: "WRPL", version byte, then per report
+ * u32 time (us since the recording started), u8 controller, u8 length
+ * and the report as received (0xa1 ...).
+ *
+ * Recording runs on the BTstack thread into a RAM buffer and stops when
+ * it is full; wii_replay_dump() prints it base64 encoded ("WRPL:" lines),
+ * tools/replay_extract.py writes it back to a file. Replay feeds a
+ * capture to a sink on the BTstack thread, at the recorded pace or as
+ * fast as possible, with the recorded timestamps either way. The host
+ * build replays captures on Linux (host/build/wii_host --replay).
+ */
+
+#ifndef WII_REPLAY_RECORD
+#define WII_REPLAY_RECORD 0 // 1: record from boot on
+#endif
+
+#define WII_REPLAY_VERSION 1
+#define WII_REPLAY_HEADER_LEN 5
+#define WII_REPLAY_BUF_PSRAM (256 * 1024)
+#define WII_REPLAY_BUF_INTERNAL (16 * 1024)
+#define WII_REPLAY_BATCH 256 // reports per run loop turn in fast mode
+
+typedef void (*wii_replay_sink_t)(uint8_t idx, const uint8_t *report, uint16_t len, int64_t time);
+typedef void (*wii_replay_done_t)(void);
+
+void wii_replay_init(wii_replay_sink_t sink, wii_replay_done_t done);
+
+void wii_replay_record_start(void);
+void wii_replay_record_stop(void);
+void wii_replay_record(uint8_t idx, const uint8_t *report, uint16_t len, int64_t time);
+void wii_replay_dump(void);
+
+// Any task; the capture must stay valid until the done callback
+uint8_t wii_replay_start(const uint8_t *data, uint32_t len, uint8_t fast);
+void wii_replay_stop(void);
+// A capture is playing or about to start
+uint8_t wii_replay_active(void);
+
+#endif /* __WII_REPLAY_H__ */
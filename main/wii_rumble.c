@@ -0,0 +1,84 @@
+/*
+ * Rumble envelopes
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "wii_rumble.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define T WII_RUMBLE_TICK_MS
+#define ERR_LIMIT 512
+
+static const wii_rumble_step_t click[] = {{255, T}, {255, 30}, {0, 0}};
+static const wii_rumble_step_t buzz[] = {{255, T}, {255, 250}, {0, 0}};
+static const wii_rumble_step_t pulse[] = {{255, T}, {255, 80}, {0, T}, {0, 80}, {255, T}, {255, 80}, {0, T}, {0, 80}, {255, T}, {255, 80}, {0, 0}};
+static const wii_rumble_step_t heartbeat[] = {{160, T}, {160, 60}, {0, T}, {0, 100}, {255, T}, {255, 100}, {0, 0}};
+static const wii_rumble_step_t ramp_up[] = {{255, 600}, {0, 0}};
+static const wii_rumble_step_t ramp_down[] = {{255, T}, {0, 600}, {0, 0}};
+
+static const wii_rumble_step_t *patterns[WII_RUMBLE_PATTERNS] = {
+    NULL, click, buzz, pulse, heartbeat, ramp_up, ramp_down,
+};
+
+/***************************************************************************
+ * Envelope
+ ***************************************************************************/
+void wii_rumble_start(wii_rumble_state_t *st, uint8_t pattern) {
+    st->step = (pattern < WII_RUMBLE_PATTERNS) ? patterns[pattern] : NULL;
+    st->elapsed_ms = 0;
+    st->from = st->level;
+}
+
+static void envelope(wii_rumble_state_t *st) {
+    const wii_rumble_step_t *s = st->step;
+
+    if (!s) {
+        st->level = 0;
+        return;
+    }
+    st->elapsed_ms += WII_RUMBLE_TICK_MS;
+    if (st->elapsed_ms < s->ms) {
+        st->level = st->from + ((int32_t)s->level - st->from) * st->elapsed_ms / s->ms;
+        return;
+    }
+    st->level = st->from = s->level;
+    st->elapsed_ms = 0;
+    st->step++;
+    if (!st->step->ms) {
+        st->step = NULL;
+    }
+}
+
+/***************************************************************************
+ * Modulator
+ ***************************************************************************/
+uint8_t wii_rumble_tick(wii_rumble_state_t *st) {
+    uint8_t extra = 0;
+    int32_t v;
+
+    if (st->tokens < WII_RUMBLE_TOKEN) {
+        st->tokens += WII_RUMBLE_MAX_REPORTS_PER_S * WII_RUMBLE_TICK_MS;
+    }
+    envelope(st);
+    if (!st->step && !st->level) {
+        st->err = 0;
+        st->bit = 0;
+    } else {
+        v = st->err + st->level;
+        st->bit = (v >= 128);
+    }
+    if (st->bit != st->sent && st->tokens >= WII_RUMBLE_TOKEN) {
+        st->tokens -= WII_RUMBLE_TOKEN;
+        extra = 1;
+    }
+    if (st->step || st->level) {
+        // the error follows what the motor does, not what was wanted
+        uint8_t on = extra ? st->bit : st->sent;
+        v = st->err + st->level - (on ? 255 : 0);
+        st->err = (v > ERR_LIMIT) ? ERR_LIMIT : (v < -ERR_LIMIT) ? -ERR_LIMIT : v;
+    }
+    return extra;
+}
@@ -0,0 +1,43 @@
+#ifndef __WII_RUMBLE_H__
+#define __WII_RUMBLE_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * Rumble envelopes
+ *
+ * The motor is only on or off, the rumble bit of every output report.
+ * Intensities come from first order sigma-delta modulation of that bit,
+ * one decision per tick. A bit change rides on the next output report; an
+ * extra report (0x10) is only asked for while the budget allows it.
+ */
+
+#define WII_RUMBLE_TICK_MS 10
+#define WII_RUMBLE_MAX_REPORTS_PER_S 20 // extra reports on the interrupt channel
+#define WII_RUMBLE_TOKEN 1000           // budget of one report
+
+// Ramp linearly to level (0..255) within ms; a list ends with ms 0
+typedef struct {
+    uint8_t level;
+    uint16_t ms;
+} wii_rumble_step_t;
+
+typedef struct {
+    const wii_rumble_step_t *step; // NULL when idle
+    uint16_t elapsed_ms;
+    uint8_t from;    // level at the start of the step
+    uint8_t level;
+    int16_t err;     // modulator error
+    uint16_t tokens; // report budget, WII_RUMBLE_TOKEN per report
+    uint8_t bit;     // wanted motor state
+    uint8_t sent;    // motor state in the last report sent
+} wii_rumble_state_t;
+
+void wii_rumble_start(wii_rumble_state_t *st, uint8_t pattern);
+
+// Advance one tick; returns 1 if an extra report should carry the bit now
+uint8_t wii_rumble_tick(wii_rumble_state_t *st);
+
+#endif /* __WII_RUMBLE_H__ */
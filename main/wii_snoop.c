@@ -0,0 +1,195 @@
+/*
+ * HCI capture ring
+ *
+ * Fixed size slots, so capturing is a timestamp and one short memcpy
+ * under a critical section. The btsnoop file is only built when dumping.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "wii_snoop.h"
+
+#if WII_SNOOP_ENABLE
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define H4_ACL 0x02
+#define H4_EVENT 0x04
+#define BTSNOOP_DATALINK_H4 1002
+#define BTSNOOP_FLAG_RECEIVED 0x01
+#define BTSNOOP_FLAG_EVENT 0x02
+#define BTSNOOP_EPOCH_OFFSET 0x00dcddb30f2f8000ULL // 0000-01-01 to 1970-01-01 in us
+#define DUMP_LINE_BYTES 48                          // 64 base64 characters
+
+typedef struct {
+    int64_t time;
+    uint16_t orig_len;
+    uint8_t incl_len;
+    uint8_t flags;
+    uint8_t data[WII_SNOOP_SNAPLEN];
+} snoop_slot_t;
+
+static snoop_slot_t *slots = NULL;
+static uint32_t slot_count = 0;
+static uint32_t head = 0;  // next slot to write
+static uint32_t total = 0; // packets captured, wraps
+static uint8_t paused = 0;
+static portMUX_TYPE snoop_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/***************************************************************************
+ * Capture
+ ***************************************************************************/
+void wii_snoop_init(void) {
+    if (slots) {
+        return;
+    }
+    slots = heap_caps_malloc(WII_SNOOP_SLOTS_PSRAM * sizeof(snoop_slot_t), MALLOC_CAP_SPIRAM);
+    slot_count = WII_SNOOP_SLOTS_PSRAM;
+    if (!slots) {
+        slots = heap_caps_malloc(WII_SNOOP_SLOTS_INTERNAL * sizeof(snoop_slot_t), MALLOC_CAP_8BIT);
+        slot_count = slots ? WII_SNOOP_SLOTS_INTERNAL : 0;
+    }
+    printf("HCI capture: %u packets in %s\n", slot_count, (slot_count == WII_SNOOP_SLOTS_PSRAM) ? "PSRAM" : "internal RAM");
+}
+
+// Store header bytes and payload as one packet
+static void capture(uint8_t flags, const uint8_t *hdr, uint8_t hdr_len, const uint8_t *data, uint16_t len) {
+    int64_t now = esp_timer_get_time();
+    uint16_t copy = (len + hdr_len > WII_SNOOP_SNAPLEN) ? WII_SNOOP_SNAPLEN - hdr_len : len;
+
+    if (!slot_count) {
+        return;
+    }
+    portENTER_CRITICAL(&snoop_mux);
+    if (!paused) {
+        snoop_slot_t *s = &slots[head];
+        s->time = now;
+        s->orig_len = hdr_len + len;
+        s->incl_len = hdr_len + copy;
+        s->flags = flags;
+        memcpy(s->data, hdr, hdr_len);
+        memcpy(&s->data[hdr_len], data, copy);
+        head = (head + 1 < slot_count) ? head + 1 : 0;
+        total++;
+    }
+    portEXIT_CRITICAL(&snoop_mux);
+}
+
+void wii_snoop_hci_event(const uint8_t *packet, uint16_t size) {
+    static const uint8_t hdr[] = {H4_EVENT};
+    // 0x60.. are BTstack, GAP and L2CAP events which never were on the wire
+    if (size < 2 || (packet[0] >= 0x60 && packet[0] != 0xff)) {
+        return;
+    }
+    capture(BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_EVENT, hdr, sizeof(hdr), packet, size);
+}
+
+void wii_snoop_l2cap(hci_con_handle_t handle, uint16_t cid, uint8_t in, const uint8_t *data, uint16_t len) {
+    // ACL header (first automatically flushable fragment) and L2CAP basic header
+    uint8_t hdr[9];
+    hdr[0] = H4_ACL;
+    little_endian_store_16(hdr, 1, (handle & 0x0fff) | 0x2000);
+    little_endian_store_16(hdr, 3, len + 4);
+    little_endian_store_16(hdr, 5, len);
+    little_endian_store_16(hdr, 7, cid);
+    capture(in ? BTSNOOP_FLAG_RECEIVED : 0, hdr, sizeof(hdr), data, len);
+}
+
+/***************************************************************************
+ * Dump
+ ***************************************************************************/
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static uint8_t line_buf[DUMP_LINE_BYTES];
+static int line_len = 0;
+
+static void dump_flush(void) {
+    char out[9 + DUMP_LINE_BYTES / 3 * 4 + 2];
+    int i, o = 0;
+
+    if (!line_len) {
+        return;
+    }
+    memcpy(out, "BTSNOOP:", 8);
+    o = 8;
+    for (i = 0; i < line_len; i += 3) {
+        uint32_t v = line_buf[i] << 16;
+        if (i + 1 < line_len) {
+            v |= line_buf[i + 1] << 8;
+        }
+        if (i + 2 < line_len) {
+            v |= line_buf[i + 2];
+        }
+        out[o++] = b64[(v >> 18) & 0x3f];
+        out[o++] = b64[(v >> 12) & 0x3f];
+        out[o++] = (i + 1 < line_len) ? b64[(v >> 6) & 0x3f] : '=';
+        out[o++] = (i + 2 < line_len) ? b64[v & 0x3f] : '=';
+    }
+    out[o++] = '\n';
+    // one write per line, so log output can only come in between lines
+    fwrite(out, 1, o, stdout);
+    line_len = 0;
+}
+
+static void dump_bytes(const void *data, int len) {
+    const uint8_t *p = data;
+    while (len--) {
+        line_buf[line_len++] = *p++;
+        if (line_len == DUMP_LINE_BYTES) {
+            dump_flush();
+        }
+    }
+}
+
+static void dump_be32(uint32_t v) {
+    uint8_t b[4];
+    big_endian_store_32(b, 0, v);
+    dump_bytes(b, 4);
+}
+
+void wii_snoop_dump(void) {
+    static const uint8_t magic[] = {'b', 't', 's', 'n', 'o', 'o', 'p', 0};
+    uint32_t n, i, pos;
+
+    portENTER_CRITICAL(&snoop_mux);
+    paused = 1;
+    n = (total < slot_count) ? total : slot_count;
+    portEXIT_CRITICAL(&snoop_mux);
+
+    pos = (head + slot_count - n) % (slot_count ? slot_count : 1);
+    printf("\nBTSNOOP-BEGIN %u packets, %u captured\n", n, total);
+    line_len = 0;
+    dump_bytes(magic, sizeof(magic));
+    dump_be32(1); // version
+    dump_be32(BTSNOOP_DATALINK_H4);
+    for (i = 0; i < n; i++) {
+        snoop_slot_t *s = &slots[pos];
+        uint64_t t = (uint64_t)s->time + BTSNOOP_EPOCH_OFFSET;
+        dump_be32(s->orig_len);
+        dump_be32(s->incl_len);
+        dump_be32(s->flags);
+        dump_be32(0); // cumulative drops
+        dump_be32(t >> 32);
+        dump_be32(t & 0xffffffff);
+        dump_bytes(s->data, s->incl_len);
+        pos = (pos + 1 < slot_count) ? pos + 1 : 0;
+        if ((i & 63) == 63) {
+            vTaskDelay(1); // don't hog the CPU for the whole dump
+        }
+    }
+    dump_flush();
+    printf("BTSNOOP-END\n");
+
+    portENTER_CRITICAL(&snoop_mux);
+    paused = 0;
+    portEXIT_CRITICAL(&snoop_mux);
+}
+
+#endif /* WII_SNOOP_ENABLE */
@@ -0,0 +1,43 @@
+#ifndef __WII_SNOOP_H__
+#define __WII_SNOOP_H__
+
+#include <stdint.h>
+
+#include "btstack.h"
+
+/*
+ * HCI capture ring
+ *
+ * Keeps the newest packets of the HID link (HCI events and L2CAP data of
+ * the remotes) with us timestamps, oldest ones are overwritten.
+ * wii_snoop_dump() prints the ring as a base64 encoded btsnoop file,
+ * tools/btsnoop_stats.py extracts it from the serial log.
+ */
+
+#ifndef WII_SNOOP_ENABLE
+#define WII_SNOOP_ENABLE 1
+#endif
+
+#define WII_SNOOP_SNAPLEN 72           // bytes kept of each packet, H4 type included
+#define WII_SNOOP_SLOTS_PSRAM 768      // ~64KB
+#define WII_SNOOP_SLOTS_INTERNAL 96    // if there is no PSRAM
+
+#if WII_SNOOP_ENABLE
+void wii_snoop_init(void);
+
+// HCI event from the controller, BTstack internal events are skipped
+void wii_snoop_hci_event(const uint8_t *packet, uint16_t size);
+
+// L2CAP payload on a local channel; in != 0 for received data
+void wii_snoop_l2cap(hci_con_handle_t handle, uint16_t cid, uint8_t in, const uint8_t *data, uint16_t len);
+
+// Print the ring as btsnoop file (base64, "BTSNOOP:" prefixed lines)
+void wii_snoop_dump(void);
+#else
+#define wii_snoop_init()
+#define wii_snoop_hci_event(packet, size)
+#define wii_snoop_l2cap(handle, cid, in, data, len)
+#define wii_snoop_dump()
+#endif
+
+#endif /* __WII_SNOOP_H__ */
@@ -0,0 +1,118 @@
+/*
+ * Speaker stream
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wii_speaker.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define STEP_MIN 127
+#define STEP_MAX 24576
+
+// step size change per magnitude, Q8
+static const uint16_t step_scale[8] = {230, 230, 230, 230, 307, 409, 512, 614};
+
+/***************************************************************************
+ * Yamaha ADPCM
+ ***************************************************************************/
+void wii_adpcm_init(wii_adpcm_t *st) {
+    st->predictor = 0;
+    st->step = STEP_MIN;
+}
+
+// Decoder side: predictor moves by (2 * magnitude + 1) * step / 8
+static void adpcm_step(wii_adpcm_t *st, uint8_t nibble) {
+    int32_t diff = ((2 * (nibble & 7) + 1) * st->step) >> 3;
+    st->predictor += (nibble & 8) ? -diff : diff;
+    st->predictor = (st->predictor > 32767) ? 32767 : (st->predictor < -32768) ? -32768 : st->predictor;
+    st->step = (st->step * step_scale[nibble & 7]) >> 8;
+    st->step = (st->step > STEP_MAX) ? STEP_MAX : (st->step < STEP_MIN) ? STEP_MIN : st->step;
+}
+
+static uint8_t adpcm_sample(wii_adpcm_t *st, int16_t sample) {
+    int32_t delta = sample - st->predictor;
+    uint8_t nibble = 0;
+    int32_t mag;
+
+    if (delta < 0) {
+        nibble = 8;
+        delta = -delta;
+    }
+    mag = (delta << 2) / st->step;
+    nibble |= (mag > 7) ? 7 : mag;
+    adpcm_step(st, nibble);
+    return nibble;
+}
+
+void wii_adpcm_encode(wii_adpcm_t *st, const int16_t *pcm, uint8_t *out, uint16_t n) {
+    uint16_t i;
+    for (i = 0; i + 1 < n; i += 2) {
+        uint8_t hi = adpcm_sample(st, pcm[i]);
+        *out++ = hi << 4 | adpcm_sample(st, pcm[i + 1]);
+    }
+}
+
+void wii_adpcm_decode(wii_adpcm_t *st, const uint8_t *in, int16_t *pcm, uint16_t n) {
+    uint16_t i;
+    for (i = 0; i + 1 < n; i += 2, in++) {
+        adpcm_step(st, *in >> 4);
+        pcm[i] = st->predictor;
+        adpcm_step(st, *in & 0x0f);
+        pcm[i + 1] = st->predictor;
+    }
+}
+
+/***************************************************************************
+ * Ring
+ ***************************************************************************/
+// Application side, while no stream runs
+void wii_speaker_reset(wii_speaker_t *spk) {
+    spk->tail = spk->head;
+    memset(&spk->stats, 0, sizeof(wii_speaker_stats_t));
+}
+
+// Application side; what does not fit is dropped and counted
+uint16_t wii_speaker_write(wii_speaker_t *spk, const int16_t *pcm, uint16_t n) {
+    uint32_t head = spk->head;
+    uint32_t space = WII_SPEAKER_RING - (head - spk->tail);
+    uint16_t i;
+
+    if (n > space) {
+        spk->stats.dropped += n - space;
+        n = space;
+    }
+    for (i = 0; i < n; i++) {
+        spk->pcm[(head + i) & (WII_SPEAKER_RING - 1)] = pcm[i];
+    }
+    spk->head = head + n;
+    return n;
+}
+
+void wii_speaker_encode(wii_speaker_t *spk, uint8_t *out) {
+    int16_t block[WII_SPEAKER_REPORT_SAMPLES];
+    uint32_t tail = spk->tail;
+    uint32_t avail = spk->head - tail;
+    uint16_t i;
+
+    if (avail < WII_SPEAKER_REPORT_SAMPLES) {
+        spk->stats.underruns++;
+    }
+    for (i = 0; i < WII_SPEAKER_REPORT_SAMPLES; i++) {
+        block[i] = (i < avail) ? spk->pcm[(tail + i) & (WII_SPEAKER_RING - 1)] : 0;
+    }
+    spk->tail = tail + ((avail < WII_SPEAKER_REPORT_SAMPLES) ? avail : WII_SPEAKER_REPORT_SAMPLES);
+    wii_adpcm_encode(&spk->adpcm, block, out, WII_SPEAKER_REPORT_SAMPLES);
+    spk->stats.reports++;
+}
+
+void wii_speaker_skip(wii_speaker_t *spk, uint32_t reports) {
+    uint32_t tail = spk->tail;
+    uint32_t avail = spk->head - tail;
+    uint32_t n = reports * WII_SPEAKER_REPORT_SAMPLES;
+
+    spk->tail = tail + ((n < avail) ? n : avail);
+    spk->stats.late += reports;
+}
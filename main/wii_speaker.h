@@ -0,0 +1,47 @@
+#ifndef __WII_SPEAKER_H__
+#define __WII_SPEAKER_H__
+
+#include <stdint.h>
+
+#include "esp32_wiiremote.h"
+
+/*
+ * Speaker stream
+ *
+ * 16 bit PCM from the application goes through a single producer, single
+ * consumer ring and is encoded to 4 bit Yamaha ADPCM, 40 samples per 0x18
+ * report. Missing samples are replaced by silence and counted.
+ */
+
+#define WII_SPEAKER_RING 4096 // samples, power of 2
+#define WII_SPEAKER_REPORT_SAMPLES 40
+#define WII_SPEAKER_REPORT_BYTES (WII_SPEAKER_REPORT_SAMPLES / 2)
+
+typedef struct {
+    int32_t predictor;
+    int32_t step;
+} wii_adpcm_t;
+
+typedef struct {
+    int16_t pcm[WII_SPEAKER_RING];
+    volatile uint32_t head; // written by the application
+    volatile uint32_t tail; // read by the BTstack thread
+    wii_adpcm_t adpcm;
+    wii_speaker_stats_t stats;
+} wii_speaker_t;
+
+void wii_adpcm_init(wii_adpcm_t *st);
+// n samples to n / 2 bytes, first sample in the high nibble
+void wii_adpcm_encode(wii_adpcm_t *st, const int16_t *pcm, uint8_t *out, uint16_t n);
+// What the speaker plays back, n / 2 bytes to n samples
+void wii_adpcm_decode(wii_adpcm_t *st, const uint8_t *in, int16_t *pcm, uint16_t n);
+
+// Empties the ring and clears the stats; only while the BTstack thread does not use it
+void wii_speaker_reset(wii_speaker_t *spk);
+uint16_t wii_speaker_write(wii_speaker_t *spk, const int16_t *pcm, uint16_t n);
+// Data of the next report, WII_SPEAKER_REPORT_BYTES
+void wii_speaker_encode(wii_speaker_t *spk, uint8_t *out);
+// Drop the samples of reports that were not sent in time
+void wii_speaker_skip(wii_speaker_t *spk, uint32_t reports);
+
+#endif /* __WII_SPEAKER_H__ */
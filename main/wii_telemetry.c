@@ -0,0 +1,349 @@
+/*
+ * Controller state telemetry
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+
+#include "esp32_wiiremote.h"
+#include "wii_log.h"
+#include "wii_telemetry.h"
+
+/***************************************************************************
+ * Definitions & variables
+ ***************************************************************************/
+#define IDLE_MS 100                                  // rate polling while off
+#define PACKET_HEADER_LEN 6
+#define FRAME_MAX (WII_TELEMETRY_PACKET + 2 + 2 + 1) // CRC, COBS overhead, delimiter
+#define UART_TX_BUF 4096
+
+// last values of a controller in the current packet
+typedef struct {
+    uint16_t btn;
+    int16_t accel[3];
+    int16_t ir[2];
+    int16_t tilt[2];
+    int16_t quat[4];
+} sample_t;
+
+// Longest sample: header, time delta, changed buttons, then every value as the
+// zigzag of a 16 bit delta (17 bits)
+#define VARINT_MAX(bits) (((bits) + 6) / 7)
+#define SAMPLE_MAX (1 + VARINT_MAX(32) + VARINT_MAX(16) + (sizeof(sample_t) / sizeof(int16_t) - 1) * VARINT_MAX(17))
+_Static_assert(SAMPLE_MAX == 42, "sample fields changed, check sample_add()");
+_Static_assert(PACKET_HEADER_LEN + SAMPLE_MAX <= WII_TELEMETRY_PACKET, "a sample does not fit into a packet");
+
+static volatile uint16_t rate_request = WII_TELEMETRY_RATE;
+static uint16_t rate;
+static btstack_timer_source_t telemetry_timer;
+static uint32_t last_version[WII_MAX_CONTROLLERS];
+
+// packet being filled
+static uint8_t pkt[WII_TELEMETRY_PACKET + 2];
+static uint16_t packet_len;
+static uint8_t packet_samples;
+static uint8_t packet_seq;
+static int64_t packet_start; // time of the first sample
+static int64_t packet_last;  // time of the last sample
+static sample_t prev[WII_MAX_CONTROLLERS];
+
+static wii_telemetry_stats_t stats;
+
+#if WII_TELEMETRY_SPP
+// framed bytes for the SPP client, the BTstack thread is producer and consumer
+static uint8_t spp_ring[WII_TELEMETRY_SPP_RING];
+static uint32_t spp_head;
+static uint32_t spp_tail;
+static uint16_t spp_cid;
+static uint16_t spp_frame_size;
+static uint8_t spp_service[150];
+static void spp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+#endif
+
+static void telemetry_timer_handler(btstack_timer_source_t *ts);
+
+/***************************************************************************
+ * Encoding
+ ***************************************************************************/
+// CRC-16/CCITT-FALSE
+static uint16_t crc16(const uint8_t *data, uint16_t len) {
+    uint16_t crc = 0xffff;
+    int i;
+    while (len--) {
+        crc ^= *data++ << 8;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Returns the framed length, including the 0x00 delimiter
+static uint16_t cobs_encode(const uint8_t *in, uint16_t len, uint8_t *out) {
+    uint16_t code_pos = 0;
+    uint16_t o = 1;
+    uint8_t code = 1;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        if (in[i]) {
+            out[o++] = in[i];
+            code++;
+        }
+        if (!in[i] || code == 0xff) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    out[o++] = 0x00;
+    return o;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint8_t *put_signed(uint8_t *p, int32_t v) { return put_varint(p, (uint32_t)((v << 1) ^ (v >> 31))); }
+
+// Deltas of n values, *flags gets field if any of them changed
+static uint8_t *put_deltas(uint8_t *p, int16_t *last, const int16_t *v, int n, uint8_t field, uint8_t *flags) {
+    int i;
+    if (!memcmp(last, v, n * sizeof(int16_t))) {
+        return p;
+    }
+    for (i = 0; i < n; i++) {
+        p = put_signed(p, v[i] - last[i]);
+        last[i] = v[i];
+    }
+    *flags |= field;
+    return p;
+}
+
+static void packet_reset(void) {
+    int i;
+    packet_len = PACKET_HEADER_LEN;
+    packet_samples = 0;
+    memset(prev, 0, sizeof(prev));
+    for (i = 0; i < WII_MAX_CONTROLLERS; i++) {
+        prev[i].ir[0] = prev[i].ir[1] = -1;
+    }
+}
+
+static void sample_add(uint8_t idx, const wii_state_t *st) {
+    sample_t *last = &prev[idx];
+    uint8_t *head = &pkt[packet_len];
+    uint8_t *p = head + 1;
+    uint8_t flags = idx & 0x03;
+    int16_t v[4];
+
+    if (!packet_samples) {
+        packet_start = packet_last = st->time;
+    }
+    p = put_signed(p, (int32_t)(st->time - packet_last));
+    packet_last = st->time;
+
+    if (st->btn != last->btn) {
+        p = put_varint(p, st->btn ^ last->btn);
+        last->btn = st->btn;
+        flags |= WII_TELEMETRY_F_BTN;
+    }
+    v[0] = st->accel.gx, v[1] = st->accel.gy, v[2] = st->accel.gz;
+    p = put_deltas(p, last->accel, v, 3, WII_TELEMETRY_F_ACCEL, &flags);
+    v[0] = ((st->valid & WII_STATE_IR) && st->ir.visible) ? st->ir.x : -1;
+    v[1] = ((st->valid & WII_STATE_IR) && st->ir.visible) ? st->ir.y : -1;
+    p = put_deltas(p, last->ir, v, 2, WII_TELEMETRY_F_IR, &flags);
+    v[0] = st->accel.pitch, v[1] = st->accel.roll;
+    p = put_deltas(p, last->tilt, v, 2, WII_TELEMETRY_F_TILT, &flags);
+    if (st->valid & WII_STATE_MOTION) {
+        v[0] = st->motion.q[0] >> 16, v[1] = st->motion.q[1] >> 16;
+        v[2] = st->motion.q[2] >> 16, v[3] = st->motion.q[3] >> 16;
+        p = put_deltas(p, last->quat, v, 4, WII_TELEMETRY_F_QUAT, &flags);
+    }
+    *head = flags;
+    packet_len = p - pkt;
+    packet_samples++;
+    stats.samples++;
+}
+
+/***************************************************************************
+ * Output
+ ***************************************************************************/
+#if WII_TELEMETRY_SPP
+static void spp_write(const uint8_t *frame, uint16_t len) {
+    uint16_t i;
+    if (!spp_cid) {
+        return;
+    }
+    if (WII_TELEMETRY_SPP_RING - (spp_head - spp_tail) < len) {
+        stats.dropped++;
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        spp_ring[(spp_head + i) & (WII_TELEMETRY_SPP_RING - 1)] = frame[i];
+    }
+    spp_head += len;
+    stats.bytes += len;
+    rfcomm_request_can_send_now_event(spp_cid);
+}
+
+static void spp_send(void) {
+    uint32_t tail = spp_tail & (WII_TELEMETRY_SPP_RING - 1);
+    uint32_t n = spp_head - spp_tail;
+
+    // up to the end of the ring, the rest on the next event
+    n = (n > WII_TELEMETRY_SPP_RING - tail) ? WII_TELEMETRY_SPP_RING - tail : n;
+    n = (n > spp_frame_size) ? spp_frame_size : n;
+    if (!n || rfcomm_send(spp_cid, &spp_ring[tail], n)) {
+        return;
+    }
+    spp_tail += n;
+    if (spp_head != spp_tail) {
+        rfcomm_request_can_send_now_event(spp_cid);
+    }
+}
+#endif
+
+static void packet_send(void) {
+    uint8_t frame[FRAME_MAX];
+    uint16_t len;
+
+    if (!packet_samples) {
+        return;
+    }
+    pkt[0] = WII_TELEMETRY_VERSION;
+    pkt[1] = packet_seq++;
+    little_endian_store_32(pkt, 2, (uint32_t)packet_start);
+    little_endian_store_16(pkt, packet_len, crc16(pkt, packet_len));
+    len = cobs_encode(pkt, packet_len + 2, frame);
+    (void)len; // unused without outputs
+    stats.frames++;
+#if WII_TELEMETRY_UART >= 0
+    uart_write_bytes(WII_TELEMETRY_UART, (const char *)frame, len); // blocks only if the buffer is full
+    stats.bytes += len;
+#endif
+#if WII_TELEMETRY_SPP
+    spp_write(frame, len);
+#endif
+    packet_reset();
+}
+
+/***************************************************************************
+ * Sampling
+ ***************************************************************************/
+void wii_telemetry_init(void) {
+#if WII_TELEMETRY_UART >= 0
+    uart_config_t cfg = {
+        .baud_rate = WII_TELEMETRY_UART_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    uart_param_config(WII_TELEMETRY_UART, &cfg);
+    uart_set_pin(WII_TELEMETRY_UART, WII_TELEMETRY_UART_TX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_driver_install(WII_TELEMETRY_UART, UART_FIFO_LEN * 2, UART_TX_BUF, 0, NULL, 0);
+#endif
+#if WII_TELEMETRY_SPP
+    rfcomm_init();
+    rfcomm_register_service(spp_packet_handler, WII_TELEMETRY_SPP_CHANNEL, 0xffff);
+    sdp_init();
+    memset(spp_service, 0, sizeof(spp_service));
+    spp_create_sdp_record(spp_service, sdp_create_service_record_handle(), WII_TELEMETRY_SPP_CHANNEL, "Wii telemetry");
+    sdp_register_service(spp_service);
+    gap_set_local_name("Wii Remote host 00:00:00:00:00:00"); // BTstack fills in the address
+#if WII_TELEMETRY_SPP_DISCOVERABLE
+    gap_discoverable_control(1); // to be paired with the client
+#endif
+#endif
+    packet_reset();
+    btstack_run_loop_set_timer_handler(&telemetry_timer, &telemetry_timer_handler);
+    btstack_run_loop_set_timer(&telemetry_timer, IDLE_MS);
+    btstack_run_loop_add_timer(&telemetry_timer);
+}
+
+void wii_telemetry_set_rate(uint16_t r) { rate_request = (r > 1000) ? 1000 : r; }
+
+// Copied without locking, counters may be off by a frame
+void wii_telemetry_get_stats(wii_telemetry_stats_t *s) { *s = stats; }
+
+static void telemetry_timer_handler(btstack_timer_source_t *ts) {
+    int64_t now = esp_timer_get_time();
+    wii_state_t st;
+    int i;
+
+    if (rate != rate_request) {
+        rate = rate_request;
+        WII_LOGI(APP, "Telemetry: %u samples/s", rate);
+    }
+    for (i = 0; rate && i < WII_MAX_CONTROLLERS; i++) {
+        if (!wii_getState(i, &st) || st.version == last_version[i]) {
+            continue;
+        }
+        last_version[i] = st.version;
+        if (packet_len + SAMPLE_MAX > WII_TELEMETRY_PACKET) {
+            packet_send();
+        }
+        sample_add(i, &st);
+        if (packet_samples >= WII_TELEMETRY_BATCH) {
+            packet_send();
+        }
+    }
+    if (packet_samples && now - packet_start >= WII_TELEMETRY_MAX_AGE_MS * 1000) {
+        packet_send();
+    }
+    btstack_run_loop_set_timer(ts, rate ? ((1000 / rate) ? 1000 / rate : 1) : IDLE_MS);
+    btstack_run_loop_add_timer(ts);
+}
+
+/***************************************************************************
+ * SPP service
+ ***************************************************************************/
+#if WII_TELEMETRY_SPP
+static void spp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    bd_addr_t addr;
+    uint16_t cid;
+
+    if (packet_type != HCI_EVENT_PACKET) {
+        return; // nothing is expected from the client
+    }
+    switch (hci_event_packet_get_type(packet)) {
+    case RFCOMM_EVENT_INCOMING_CONNECTION:
+        rfcomm_event_incoming_connection_get_bd_addr(packet, addr);
+        cid = rfcomm_event_incoming_connection_get_rfcomm_cid(packet);
+        WII_LOGI(BT, "Telemetry: connection from " WII_LOG_ADDR_FMT, WII_LOG_ADDR(addr));
+        rfcomm_accept_connection(cid);
+        break;
+    case RFCOMM_EVENT_CHANNEL_OPENED:
+        if (rfcomm_event_channel_opened_get_status(packet)) {
+            WII_LOGW(BT, "Telemetry: channel open failed, status %u", rfcomm_event_channel_opened_get_status(packet));
+            break;
+        }
+        spp_cid = rfcomm_event_channel_opened_get_rfcomm_cid(packet);
+        spp_frame_size = rfcomm_event_channel_opened_get_max_frame_size(packet);
+        spp_tail = spp_head;
+        WII_LOGI(BT, "Telemetry: channel 0x%04x open, max frame size %u", spp_cid, spp_frame_size);
+        break;
+    case RFCOMM_EVENT_CAN_SEND_NOW:
+        if (spp_cid) {
+            spp_send();
+        }
+        break;
+    case RFCOMM_EVENT_CHANNEL_CLOSED:
+        WII_LOGI(BT, "Telemetry: channel closed, %u frames, %u dropped", stats.frames, stats.dropped);
+        spp_cid = 0;
+        break;
+    default:
+        break;
+    }
+}
+#endif
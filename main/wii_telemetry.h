@@ -0,0 +1,76 @@
+#ifndef __WII_TELEMETRY_H__
+#define __WII_TELEMETRY_H__
+
+#include <stdint.h>
+
+/*
+ * Controller state telemetry
+ *
+ * The published state of every ready controller is sampled at a set rate
+ * on the BTstack thread, skipping controllers without a new report. Several
+ * samples are batched into one packet; a packet is closed by a CRC-16 and
+ * COBS framed, 0x00 ends each frame. Frames go to a UART and to the client
+ * of an SPP service, paced by RFCOMM_EVENT_CAN_SEND_NOW; frames that do not
+ * fit into the SPP ring are dropped whole. Both outputs are off by default;
+ * the SPP service makes the host discoverable only with
+ * WII_TELEMETRY_SPP_DISCOVERABLE, for pairing a new client.
+ *
+ * Packet, little endian: version, sequence number, u32 base time (us, low
+ * 32 bits of esp_timer time), samples, u16 CRC-16/CCITT-FALSE of all that.
+ * Sample: header (controller in bits 0-1, WII_TELEMETRY_F_ fields present),
+ * time since the previous sample, then the fields present. Values are sent
+ * as deltas to the previous sample of the same controller in the packet;
+ * every packet starts from zero values and IR -1, -1 (not visible), so a
+ * lost packet does not affect the next one. Signed numbers are zigzag
+ * varints, the buttons a varint of the changed bits.
+ * tools/telemetry_decode.py decodes the stream.
+ */
+
+#ifndef WII_TELEMETRY_UART
+#define WII_TELEMETRY_UART -1 // UART number, -1: no UART output
+#endif
+#define WII_TELEMETRY_UART_TX 17
+#define WII_TELEMETRY_UART_BAUD 921600
+#ifndef WII_TELEMETRY_SPP
+#define WII_TELEMETRY_SPP 0 // SPP service
+#endif
+#ifndef WII_TELEMETRY_SPP_DISCOVERABLE
+#define WII_TELEMETRY_SPP_DISCOVERABLE 0 // inquiry scan for pairing a new client, otherwise only bonded clients find the host
+#endif
+#define WII_TELEMETRY_SPP_CHANNEL 1
+#ifndef WII_TELEMETRY_RATE
+#if WII_TELEMETRY_UART >= 0 || WII_TELEMETRY_SPP
+#define WII_TELEMETRY_RATE 50 // samples per second and controller, 0: off
+#else
+#define WII_TELEMETRY_RATE 0 // no output configured
+#endif
+#endif
+
+#define WII_TELEMETRY_VERSION 1
+#define WII_TELEMETRY_BATCH 8        // samples per packet
+#define WII_TELEMETRY_MAX_AGE_MS 100 // a packet is sent when its first sample is this old
+#define WII_TELEMETRY_PACKET 255     // bytes before framing
+#define WII_TELEMETRY_SPP_RING 2048  // power of 2
+
+// Sample fields
+#define WII_TELEMETRY_F_BTN 0x04   // buttons
+#define WII_TELEMETRY_F_ACCEL 0x08 // gx, gy, gz
+#define WII_TELEMETRY_F_IR 0x10    // pointer x, y
+#define WII_TELEMETRY_F_TILT 0x20  // pitch, roll
+#define WII_TELEMETRY_F_QUAT 0x40  // MotionPlus orientation, Q14
+
+typedef struct {
+    uint32_t samples;
+    uint32_t frames;
+    uint32_t bytes;   // framed, summed over the outputs
+    uint32_t dropped; // frames that did not fit into the SPP ring
+} wii_telemetry_stats_t;
+
+// BTstack thread, after l2cap_init()
+void wii_telemetry_init(void);
+
+// Any task; picked up within one sampling period
+void wii_telemetry_set_rate(uint16_t rate);
+void wii_telemetry_get_stats(wii_telemetry_stats_t *stats);
+
+#endif /* __WII_TELEMETRY_H__ */
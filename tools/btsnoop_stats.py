@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+Per-channel timing statistics of a btsnoop capture.
+
+The input is either a btsnoop file or a serial log containing the output
+of wii_snoop_dump() (lines with a "BTSNOOP:" prefix); the last dump in the
+log is used.
+
+  btsnoop_stats.py monitor.log
+  btsnoop_stats.py monitor.log --write capture.btsnoop   # for Wireshark
+  btsnoop_stats.py capture.btsnoop --gap 15 --reports
+"""
+import argparse
+import base64
+import struct
+import sys
+
+BTSNOOP_MAGIC = b"btsnoop\0"
+H4_ACL = 0x02
+H4_EVENT = 0x04
+
+
+def extract_dump(text):
+    """Return the bytes of the last dump in a serial log, or None."""
+    dump = None
+    lines = None
+    for line in text.splitlines():
+        if "BTSNOOP-BEGIN" in line:
+            lines = []
+        elif "BTSNOOP-END" in line:
+            if lines is not None:
+                dump = lines
+            lines = None
+        elif lines is not None and "BTSNOOP:" in line:
+            # log output may precede the prefix, never follows on the same line
+            lines.append(line.split("BTSNOOP:", 1)[1].strip())
+    if dump is None:
+        return None
+    return base64.b64decode("".join(dump))
+
+
+def parse(data):
+    if data[:8] != BTSNOOP_MAGIC:
+        raise ValueError("not a btsnoop file")
+    version, datalink = struct.unpack(">II", data[8:16])
+    if version != 1 or datalink != 1002:
+        raise ValueError("unsupported btsnoop version %d / datalink %d" % (version, datalink))
+    pos = 16
+    packets = []
+    while pos + 24 <= len(data):
+        orig_len, incl_len, flags, _drops, ts = struct.unpack(">IIIIQ", data[pos:pos + 24])
+        pos += 24
+        packets.append((ts, flags, orig_len, data[pos:pos + incl_len]))
+        pos += incl_len
+    return packets
+
+
+def channel_of(flags, pkt, reports):
+    """Key to group a packet by, None to skip it."""
+    if not pkt:
+        return None
+    direction = "in " if flags & 1 else "out"
+    if pkt[0] == H4_EVENT and len(pkt) > 1:
+        return "event 0x%02x" % pkt[1]
+    if pkt[0] == H4_ACL and len(pkt) >= 9:
+        handle = struct.unpack("<H", pkt[1:3])[0] & 0x0FFF
+        cid = struct.unpack("<H", pkt[7:9])[0]
+        key = "%s handle 0x%03x cid 0x%04x" % (direction, handle, cid)
+        # HID DATA report id
+        if reports and len(pkt) >= 11 and pkt[9] in (0xA1, 0xA2):
+            key += " report 0x%02x" % pkt[10]
+        return key
+    return None
+
+
+def stats(times, gap_ms):
+    deltas = [(b - a) / 1000.0 for a, b in zip(times, times[1:])]
+    if not deltas:
+        return None
+    avg = sum(deltas) / len(deltas)
+    var = sum((d - avg) ** 2 for d in deltas) / len(deltas)
+    return {
+        "min": min(deltas),
+        "avg": avg,
+        "max": max(deltas),
+        "jitter": var ** 0.5,
+        "gaps": sum(1 for d in deltas if d > gap_ms),
+    }
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", help="btsnoop file or serial log")
+    ap.add_argument("--write", metavar="FILE", help="save the extracted btsnoop file")
+    ap.add_argument("--gap", type=float, default=20.0, help="inter-arrival time counted as gap, ms (default 20)")
+    ap.add_argument("--reports", action="store_true", help="split HID channels by report id")
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        raw = f.read()
+    data = raw if raw[:8] == BTSNOOP_MAGIC else extract_dump(raw.decode("utf-8", "replace"))
+    if data is None:
+        sys.exit("no BTSNOOP dump found in %s" % args.input)
+    if args.write:
+        with open(args.write, "wb") as f:
+            f.write(data)
+
+    packets = parse(data)
+    if not packets:
+        sys.exit("capture is empty")
+    channels = {}
+    truncated = 0
+    for ts, flags, orig_len, pkt in packets:
+        truncated += orig_len > len(pkt)
+        key = channel_of(flags, pkt, args.reports)
+        if key is not None:
+            channels.setdefault(key, []).append(ts)
+
+    span = (packets[-1][0] - packets[0][0]) / 1e6
+    print("%d packets over %.3f s, %d truncated" % (len(packets), span, truncated))
+    print("%-44s %7s %8s %8s %8s %8s %8s %6s" % ("channel", "count", "rate/s", "min ms", "avg ms", "max ms", "jitter", "gaps"))
+    for key in sorted(channels):
+        times = channels[key]
+        s = stats(times, args.gap)
+        rate = (len(times) - 1) / ((times[-1] - times[0]) / 1e6) if s and times[-1] > times[0] else 0.0
+        if s:
+            print("%-44s %7d %8.1f %8.2f %8.2f %8.2f %8.2f %6d" %
+                  (key, len(times), rate, s["min"], s["avg"], s["max"], s["jitter"], s["gaps"]))
+        else:
+            print("%-44s %7d" % (key, len(times)))
+
+
+if __name__ == "__main__":
+    main()
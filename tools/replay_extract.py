@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""
+Extract and summarize an input report capture.
+
+The input is either a capture file or a serial log containing the output
+of wii_replay_dump() (lines with a "WRPL:" prefix); the last dump in the
+log is used.
+
+  replay_extract.py monitor.log --write session.wrpl
+  replay_extract.py session.wrpl --list
+"""
+import argparse
+import base64
+import struct
+import sys
+
+MAGIC = b"WRPL"
+VERSION = 1
+RECORD_HEADER = struct.Struct("<IBB")
+
+
+def extract_dump(text):
+    """Return the bytes of the last dump in a serial log, or None."""
+    dump = None
+    lines = None
+    for line in text.splitlines():
+        if "WRPL-BEGIN" in line:
+            lines = []
+        elif "WRPL-END" in line:
+            if lines is not None:
+                dump = lines
+            lines = None
+        elif lines is not None and "WRPL:" in line:
+            lines.append(line.split("WRPL:", 1)[1].strip())
+    if dump is None:
+        return None
+    return base64.b64decode("".join(dump))
+
+
+def records(data):
+    """Yield (time_us, controller, report bytes)."""
+    if data[:4] != MAGIC or data[4] != VERSION:
+        raise ValueError("not a version %d capture" % VERSION)
+    pos = 5
+    while pos + RECORD_HEADER.size <= len(data):
+        t, idx, n = RECORD_HEADER.unpack_from(data, pos)
+        pos += RECORD_HEADER.size
+        if pos + n > len(data):
+            print("truncated record at %d" % pos, file=sys.stderr)
+            break
+        yield t, idx, data[pos:pos + n]
+        pos += n
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", help="capture file or serial log")
+    ap.add_argument("--write", metavar="FILE", help="write the capture to FILE")
+    ap.add_argument("--list", action="store_true", help="print every report")
+    args = ap.parse_args()
+
+    raw = open(args.input, "rb").read()
+    data = raw if raw[:4] == MAGIC else extract_dump(raw.decode("utf-8", "replace"))
+    if data is None:
+        sys.exit("no capture found in %s" % args.input)
+    if args.write:
+        with open(args.write, "wb") as f:
+            f.write(data)
+
+    per = {}
+    for t, idx, report in records(data):
+        if args.list:
+            print("%10.3f ms  %d  %s" % (t / 1000.0, idx, report.hex()))
+        s = per.setdefault(idx, {"n": 0, "first": t, "last": t, "types": {}})
+        s["n"] += 1
+        s["last"] = t
+        rid = report[1] if len(report) > 1 else None
+        s["types"][rid] = s["types"].get(rid, 0) + 1
+
+    for idx in sorted(per):
+        s = per[idx]
+        span = (s["last"] - s["first"]) / 1e6
+        rate = (s["n"] - 1) / span if span > 0 else 0
+        types = ", ".join("%02x:%d" % (k, v) for k, v in sorted(s["types"].items()) if k is not None)
+        print("controller %d: %d reports over %.2f s, %.1f/s  [%s]" % (idx, s["n"], span, rate, types))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+"""
+Decode the controller state telemetry stream (see main/wii_telemetry.h).
+
+The input is a serial port, a pty, a file or "-" for stdin. Frames are
+COBS encoded and end with 0x00; frames with a bad CRC and gaps in the
+packet sequence are counted and reported at the end.
+
+  telemetry_decode.py /dev/ttyUSB1 --baud 921600
+  telemetry_decode.py /dev/rfcomm0 --csv > session.csv
+
+To test without hardware, connect two ptys and feed one of them with
+synthetic frames:
+
+  socat -d -d pty,raw,echo=0 pty,raw,echo=0
+  telemetry_decode.py /dev/pts/3 &
+  telemetry_decode.py /dev/pts/4 --fake 100
+"""
+import argparse
+import math
+import os
+import struct
+import sys
+import termios
+import tty
+
+VERSION = 1
+HEADER = struct.Struct("<BBI")
+F_BTN = 0x04
+F_ACCEL = 0x08
+F_IR = 0x10
+F_TILT = 0x20
+F_QUAT = 0x40
+FIELDS = ((F_ACCEL, "accel", 3), (F_IR, "ir", 2), (F_TILT, "tilt", 2), (F_QUAT, "quat", 4))
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE."""
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    pos = 0
+    while pos < len(frame):
+        code = frame[pos]
+        if code == 0 or pos + code > len(frame):
+            raise ValueError("bad COBS block")
+        out += frame[pos + 1:pos + code]
+        pos += code
+        if code < 0xFF and pos < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos = 0
+    code = 1
+    for b in data:
+        if b:
+            out.append(b)
+            code += 1
+        if not b or code == 0xFF:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+    out[code_pos] = code
+    out.append(0)
+    return bytes(out)
+
+
+def varint(data, pos):
+    v = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, pos
+
+
+def signed(data, pos):
+    v, pos = varint(data, pos)
+    return (v >> 1) ^ -(v & 1), pos
+
+
+def put_varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return out
+
+
+def put_signed(v):
+    return put_varint(v << 1 if v >= 0 else (-v << 1) - 1)
+
+
+def initial():
+    return {"btn": 0, "accel": [0, 0, 0], "ir": [-1, -1], "tilt": [0, 0], "quat": [0, 0, 0, 0]}
+
+
+def decode_packet(data):
+    """Return (seq, [(time_us, controller, state)])."""
+    if len(data) < HEADER.size + 2 or crc16(data[:-2]) != struct.unpack_from("<H", data, len(data) - 2)[0]:
+        raise ValueError("bad CRC")
+    version, seq, t = HEADER.unpack_from(data)
+    if version != VERSION:
+        raise ValueError("version %d" % version)
+    last = {}
+    samples = []
+    pos = HEADER.size
+    end = len(data) - 2
+    while pos < end:
+        head = data[pos]
+        pos += 1
+        idx = head & 0x03
+        dt, pos = signed(data, pos)
+        t += dt
+        s = last.setdefault(idx, initial())
+        if head & F_BTN:
+            v, pos = varint(data, pos)
+            s["btn"] ^= v
+        for flag, name, n in FIELDS:
+            if head & flag:
+                for i in range(n):
+                    d, pos = signed(data, pos)
+                    s[name][i] += d
+        samples.append((t & 0xFFFFFFFF, idx, {k: (list(v) if isinstance(v, list) else v) for k, v in s.items()}))
+    return seq, samples
+
+
+def encode_packet(seq, samples):
+    """Inverse of decode_packet, for --fake."""
+    base = samples[0][0]
+    out = bytearray(HEADER.pack(VERSION, seq, base & 0xFFFFFFFF))
+    last = {}
+    t_last = base
+    for t, idx, st in samples:
+        s = last.setdefault(idx, initial())
+        head = idx
+        body = put_signed(t - t_last)
+        t_last = t
+        if st["btn"] != s["btn"]:
+            head |= F_BTN
+            body += put_varint(st["btn"] ^ s["btn"])
+        for flag, name, n in FIELDS:
+            if st[name] != s[name]:
+                head |= flag
+                for i in range(n):
+                    body += put_signed(st[name][i] - s[name][i])
+        last[idx] = {k: (list(v) if isinstance(v, list) else v) for k, v in st.items()}
+        out.append(head)
+        out += body
+    out += struct.pack("<H", crc16(out))
+    return bytes(out)
+
+
+def fake(path, packets):
+    """Write packets of a slowly turning remote with a blinking button."""
+    with open(path, "wb", buffering=0) as f:
+        t = 0
+        for seq in range(packets):
+            samples = []
+            for _ in range(8):
+                a = t / 1e6
+                st = initial()
+                st["btn"] = 0x0008 if int(a * 2) % 2 else 0
+                st["accel"] = [int(1024 * math.sin(a)), 0, int(1024 * math.cos(a))]
+                st["ir"] = [512 + int(200 * math.cos(a)), 384 + int(150 * math.sin(a))]
+                st["tilt"] = [int(5730 * a) % 36000 - 18000, 0]
+                st["quat"] = [int(16384 * math.cos(a / 2)), int(16384 * math.sin(a / 2)), 0, 0]
+                samples.append((t, 0, st))
+                t += 10000
+            f.write(cobs_encode(encode_packet(seq & 0xFF, samples)))
+
+
+def open_input(path, baud):
+    if path == "-":
+        return sys.stdin.buffer.fileno()
+    fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+        if baud:
+            attrs = termios.tcgetattr(fd)
+            speed = getattr(termios, "B%d" % baud)
+            attrs[4] = attrs[5] = speed
+            termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", help="serial port, pty, file or - for stdin")
+    ap.add_argument("--baud", type=int, help="set the baud rate of a serial port")
+    ap.add_argument("--csv", action="store_true", help="one CSV line per sample")
+    ap.add_argument("--fake", type=int, metavar="N", help="write N synthetic packets to the input instead")
+    args = ap.parse_args()
+
+    if args.fake:
+        fake(args.input, args.fake)
+        return
+
+    fd = open_input(args.input, args.baud)
+    if args.csv:
+        print("time_us,controller,btn,gx,gy,gz,ir_x,ir_y,pitch,roll,qw,qx,qy,qz")
+    buf = bytearray()
+    packets = bad = lost = 0
+    seq_next = None
+    try:
+        while True:
+            chunk = os.read(fd, 4096)
+            if not chunk:
+                break
+            buf += chunk
+            while 0 in buf:
+                end = buf.index(0)
+                frame = bytes(buf[:end])
+                del buf[:end + 1]
+                if not frame:
+                    continue
+                try:
+                    seq, samples = decode_packet(cobs_decode(frame))
+                except (ValueError, IndexError):
+                    bad += 1
+                    continue
+                packets += 1
+                if seq_next is not None:
+                    lost += (seq - seq_next) & 0xFF
+                seq_next = (seq + 1) & 0xFF
+                for t, idx, s in samples:
+                    if args.csv:
+                        print(",".join(str(v) for v in [t, idx, s["btn"]] + s["accel"] + s["ir"] + s["tilt"] + s["quat"]))
+                    else:
+                        print("%10.3f ms  %d  btn %04x  accel %6d %6d %6d  ir %5d %5d  tilt %6d %6d  q %6d %6d %6d %6d" %
+                              tuple([t / 1000.0, idx, s["btn"]] + s["accel"] + s["ir"] + s["tilt"] + s["quat"]))
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    print("%d packets, %d bad frames, %d packets lost" % (packets, bad, lost), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()